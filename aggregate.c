@@ -0,0 +1,554 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "aggregate.h"
+#include "parallel.h"
+
+/* Selection words aggregated per parallel work item */
+#define AGGREGATE_BLOCK 256
+
+/* Components of a value of a type, 0 if it can't be aggregated */
+int component_count(uint8_t type) {
+	switch (type) {
+	case RBX_TYPE_INT32:
+	case RBX_TYPE_FLOAT:
+	case RBX_TYPE_REAL:
+	case RBX_TYPE_BRICKCOLOR:
+	case RBX_TYPE_TOKEN:
+		return 1;
+	case RBX_TYPE_VECTOR2:
+		return 2;
+	case RBX_TYPE_VECTOR3:
+	case RBX_TYPE_COLOR3:
+	case RBX_TYPE_CFRAME:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+/* The components of a slot of a column as doubles */
+void value_components(struct rbx_object_prop *prop, union rbx_slot *slot, double *out) {
+	struct rbx_value value;
+	rbx_slot_get(prop, slot, &value);
+	switch (prop->value_type) {
+	case RBX_TYPE_INT32:
+		out[0] = value.int32_value.data;
+		break;
+	case RBX_TYPE_FLOAT:
+		out[0] = value.float_value.data;
+		break;
+	case RBX_TYPE_REAL:
+		out[0] = value.real_value.data;
+		break;
+	case RBX_TYPE_BRICKCOLOR:
+		out[0] = value.brickcolor_value.data;
+		break;
+	case RBX_TYPE_TOKEN:
+		out[0] = value.token_value.data;
+		break;
+	case RBX_TYPE_VECTOR2:
+		out[0] = value.vector2_value.x;
+		out[1] = value.vector2_value.y;
+		break;
+	case RBX_TYPE_VECTOR3:
+		out[0] = value.vector3_value.x;
+		out[1] = value.vector3_value.y;
+		out[2] = value.vector3_value.z;
+		break;
+	case RBX_TYPE_COLOR3:
+		out[0] = value.color3_value.r;
+		out[1] = value.color3_value.g;
+		out[2] = value.color3_value.b;
+		break;
+	case RBX_TYPE_CFRAME:
+		out[0] = value.cframe_value.position.x;
+		out[1] = value.cframe_value.position.y;
+		out[2] = value.cframe_value.position.z;
+		break;
+	}
+}
+
+/* An empty aggregate of a type, with min and max ready to be lowered and
+ * raised */
+void reset_aggregate(struct rbx_aggregate *aggregate, uint8_t type) {
+	memset(aggregate, 0x0, sizeof(struct rbx_aggregate));
+	aggregate->value_type = type;
+	aggregate->component_count = component_count(type);
+	for (int c = 0; c < RBX_AGGREGATE_COMPONENTS; ++c) {
+		aggregate->min[c] = INFINITY;
+		aggregate->max[c] = -INFINITY;
+	}
+}
+
+/* Add weight copies of a value */
+void add_value(struct rbx_aggregate *aggregate, const double *value, uint64_t weight) {
+	double product = 1;
+	aggregate->count += weight;
+	for (uint32_t c = 0; c < aggregate->component_count; ++c) {
+		aggregate->sum[c] += weight*value[c];
+		if (value[c] < aggregate->min[c]) {
+			aggregate->min[c] = value[c];
+		}
+		if (value[c] > aggregate->max[c]) {
+			aggregate->max[c] = value[c];
+		}
+		product *= value[c];
+	}
+	aggregate->product_sum += weight*product;
+}
+
+int merge_aggregates(struct rbx_aggregate *a, const struct rbx_aggregate *b) {
+	if (b->count == 0) {
+		return 1;
+	} else if (a->count == 0) {
+		*a = *b;
+		return 1;
+	} else if (a->value_type != b->value_type) {
+		return 0;
+	}
+	a->count += b->count;
+	for (uint32_t c = 0; c < a->component_count; ++c) {
+		a->sum[c] += b->sum[c];
+		a->min[c] = b->min[c] < a->min[c] ? b->min[c] : a->min[c];
+		a->max[c] = b->max[c] > a->max[c] ? b->max[c] : a->max[c];
+	}
+	a->product_sum += b->product_sum;
+	return 1;
+}
+
+double aggregate_mean(const struct rbx_aggregate *aggregate, int component) {
+	return aggregate->count ? aggregate->sum[component] / aggregate->count : 0;
+}
+
+/* Bits of a selection word for the values [first, last) */
+uint64_t selected_bits(const uint64_t *selection, size_t word, uint32_t first, uint32_t last) {
+	uint64_t bits = selection ? selection[word] : ~(uint64_t)0;
+	if (last - first < 64) {
+		bits &= ((uint64_t)1 << (last - first)) - 1;
+	}
+	return bits;
+}
+
+/* Number of selected values in [begin, end) */
+uint64_t count_selected(const uint64_t *selection, uint32_t begin, uint32_t end) {
+	if (selection == NULL) {
+		return end - begin;
+	}
+	uint64_t count = 0;
+	for (; begin < end && begin % 64 != 0; ++begin) {
+		count += (selection[begin/64] >> (begin % 64)) & 1;
+	}
+	for (; begin + 64 <= end; begin += 64) {
+		count += rbx_selection_count(&selection[begin/64], 64);
+	}
+	for (; begin < end; ++begin) {
+		count += (selection[begin/64] >> (begin % 64)) & 1;
+	}
+	return count;
+}
+
+/* Number of selected values sharing each slot of an encoded column, NULL
+ * on allocation failure */
+uint64_t *weigh_slots(struct rbx_object_prop *prop, const uint64_t *selection) {
+	uint64_t *weights = (uint64_t*)calloc(prop->slot_count + 1, sizeof(uint64_t));
+	if (weights == NULL) {
+		return NULL;
+	}
+	if (prop->encoding == RBX_ENCODING_CONSTANT) {
+		weights[0] = count_selected(selection, 0, prop->value_count);
+	} else if (prop->encoding == RBX_ENCODING_RUNS) {
+		uint32_t begin = 0;
+		for (uint32_t k = 0; k < prop->slot_count; ++k) {
+			weights[k] = count_selected(selection, begin, prop->run_end_array[k]);
+			begin = prop->run_end_array[k];
+		}
+	} else if (prop->encoding == RBX_ENCODING_DICTIONARY) {
+		for (uint32_t i = 0; i < prop->value_count; ++i) {
+			if (selection == NULL || ((selection[i/64] >> (i % 64)) & 1)) {
+				++weights[prop->code_array[i]];
+			}
+		}
+	}
+	return weights;
+}
+
+#ifdef __SSE2__
+/* Load 4 values of a plain Int32, Float or Real column as doubles. Int32
+ * and Float values sit in the low bytes of their 8 byte slots, so they are
+ * gathered from pairs of slots with a shuffle. */
+void load_4_pd(uint8_t type, union rbx_slot *slots, __m128d *low, __m128d *high) {
+	if (type == RBX_TYPE_REAL) {
+		*low = _mm_loadu_pd((const double*)&slots[0]);
+		*high = _mm_loadu_pd((const double*)&slots[2]);
+		return;
+	}
+	__m128 a = _mm_loadu_ps((const float*)&slots[0]);
+	__m128 b = _mm_loadu_ps((const float*)&slots[2]);
+	__m128 values = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	if (type == RBX_TYPE_FLOAT) {
+		*low = _mm_cvtps_pd(values);
+		*high = _mm_cvtps_pd(_mm_movehl_ps(values, values));
+	} else {
+		__m128i ints = _mm_castps_si128(values);
+		*low = _mm_cvtepi32_pd(ints);
+		*high = _mm_cvtepi32_pd(_mm_shuffle_epi32(ints, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+}
+
+/* Add the 64 values of a plain column from first on with SSE. Numbers go 4
+ * at a time, vectors a value at a time with their components side by side,
+ * loading the 4 bytes after a pooled vector with it. Returns 0 for the
+ * types it doesn't handle. */
+int add_64_sse(struct rbx_object_prop *prop, uint32_t first, struct rbx_aggregate *aggregate) {
+	uint8_t type = prop->value_type;
+	union rbx_slot *slots = prop->slot_array + first;
+	double sum[4], low[4], high[4];
+	float low_ps[4], high_ps[4];
+	double product = 0;
+	struct rbx_aggregate block;
+	reset_aggregate(&block, type);
+	block.count = 64;
+
+	if (type == RBX_TYPE_INT32 || type == RBX_TYPE_FLOAT || type == RBX_TYPE_REAL) {
+		__m128d sum_pd = _mm_setzero_pd();
+		__m128d low_pd = _mm_set1_pd(INFINITY);
+		__m128d high_pd = _mm_set1_pd(-INFINITY);
+		for (int k = 0; k < 64; k += 4) {
+			__m128d a, b;
+			load_4_pd(type, slots + k, &a, &b);
+			sum_pd = _mm_add_pd(sum_pd, _mm_add_pd(a, b));
+			low_pd = _mm_min_pd(low_pd, _mm_min_pd(a, b));
+			high_pd = _mm_max_pd(high_pd, _mm_max_pd(a, b));
+		}
+		_mm_storeu_pd(sum, sum_pd);
+		_mm_storeu_pd(low, low_pd);
+		_mm_storeu_pd(high, high_pd);
+		block.sum[0] = sum[0] + sum[1];
+		block.min[0] = low[0] < low[1] ? low[0] : low[1];
+		block.max[0] = high[0] > high[1] ? high[0] : high[1];
+		block.product_sum = block.sum[0];
+	} else if (type == RBX_TYPE_VECTOR2) {
+		__m128d sum_pd = _mm_setzero_pd();
+		__m128d product_pd = _mm_setzero_pd();
+		__m128 low_v = _mm_set1_ps(INFINITY);
+		__m128 high_v = _mm_set1_ps(-INFINITY);
+		for (int k = 0; k < 64; k += 2) {
+			// x and y of two values
+			__m128 v = _mm_loadu_ps((const float*)&slots[k]);
+			__m128d a = _mm_cvtps_pd(v);
+			__m128d b = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+			sum_pd = _mm_add_pd(sum_pd, _mm_add_pd(a, b));
+			product_pd = _mm_add_sd(product_pd, _mm_add_sd(
+				_mm_mul_sd(a, _mm_unpackhi_pd(a, a)), _mm_mul_sd(b, _mm_unpackhi_pd(b, b))));
+			low_v = _mm_min_ps(low_v, v);
+			high_v = _mm_max_ps(high_v, v);
+		}
+		_mm_storeu_pd(sum, sum_pd);
+		_mm_storeu_ps(low_ps, low_v);
+		_mm_storeu_ps(high_ps, high_v);
+		_mm_store_sd(&product, product_pd);
+		for (int c = 0; c < 2; ++c) {
+			block.sum[c] = sum[c];
+			block.min[c] = low_ps[c] < low_ps[c + 2] ? low_ps[c] : low_ps[c + 2];
+			block.max[c] = high_ps[c] > high_ps[c + 2] ? high_ps[c] : high_ps[c + 2];
+		}
+		block.product_sum = product;
+	} else if (type == RBX_TYPE_VECTOR3 || type == RBX_TYPE_COLOR3 || type == RBX_TYPE_CFRAME) {
+		size_t stride = rbx_pool_stride(type);
+		uint8_t *base = (uint8_t*)prop->pool +
+			(type == RBX_TYPE_CFRAME ? offsetof(struct rbx_cframe, position) : 0);
+		__m128d sum_xy = _mm_setzero_pd();
+		__m128d sum_z = _mm_setzero_pd();
+		__m128d product_pd = _mm_setzero_pd();
+		__m128 low_v = _mm_set1_ps(INFINITY);
+		__m128 high_v = _mm_set1_ps(-INFINITY);
+		for (int k = 0; k < 64; ++k) {
+			__m128 v = _mm_loadu_ps((const float*)(base + stride*slots[k].pool_index));
+			__m128d xy = _mm_cvtps_pd(v);
+			__m128d zw = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+			sum_xy = _mm_add_pd(sum_xy, xy);
+			sum_z = _mm_add_sd(sum_z, zw);
+			product_pd = _mm_add_sd(product_pd,
+				_mm_mul_sd(_mm_mul_sd(xy, _mm_unpackhi_pd(xy, xy)), zw));
+			low_v = _mm_min_ps(low_v, v);
+			high_v = _mm_max_ps(high_v, v);
+		}
+		_mm_storeu_pd(sum, sum_xy);
+		_mm_store_sd(&sum[2], sum_z);
+		_mm_storeu_ps(low_ps, low_v);
+		_mm_storeu_ps(high_ps, high_v);
+		_mm_store_sd(&product, product_pd);
+		for (int c = 0; c < 3; ++c) {
+			block.sum[c] = sum[c];
+			block.min[c] = low_ps[c];
+			block.max[c] = high_ps[c];
+		}
+		block.product_sum = product;
+	} else {
+		return 0;
+	}
+
+	merge_aggregates(aggregate, &block);
+	return 1;
+}
+#endif
+
+/* Shared state of the parallel passes over a plain column */
+struct aggregate_context {
+	struct rbx_object_prop *prop;
+	const uint64_t *selection;
+	struct rbx_aggregate *partial_array; /* One per block */
+
+	/* Histograms */
+	int component;
+	double min, max, scale;
+	uint32_t bucket_count;
+	uint64_t *bucket_storage; /* bucket_count per block */
+};
+
+/* Aggregate the selected values of a word of a plain column */
+void aggregate_word(struct aggregate_context *ctx, size_t word, struct rbx_aggregate *aggregate) {
+	struct rbx_object_prop *prop = ctx->prop;
+	uint32_t first = (uint32_t)(word*64);
+	uint32_t last = first + 64 < prop->value_count ? first + 64 : prop->value_count;
+	uint64_t bits = selected_bits(ctx->selection, word, first, last);
+	if (bits == 0) {
+		return;
+	}
+#ifdef __SSE2__
+	// Every value selected, and not the word of the last value, whose
+	// vector can't be loaded with the bytes after it
+	if (bits == ~(uint64_t)0 && last < prop->value_count && add_64_sse(prop, first, aggregate)) {
+		return;
+	}
+#endif
+	double value[RBX_AGGREGATE_COMPONENTS];
+	for (uint32_t i = first; i < last; ++i) {
+		if ((bits >> (i - first)) & 1) {
+			value_components(prop, &prop->slot_array[i], value);
+			add_value(aggregate, value, 1);
+		}
+	}
+}
+
+void aggregate_blocks(void *context, size_t begin, size_t end) {
+	struct aggregate_context *ctx = (struct aggregate_context*)context;
+	size_t words = RBX_SELECTION_WORDS(ctx->prop->value_count);
+	for (size_t b = begin; b < end; ++b) {
+		struct rbx_aggregate *partial = &ctx->partial_array[b];
+		reset_aggregate(partial, ctx->prop->value_type);
+		size_t last = (b + 1)*AGGREGATE_BLOCK < words ? (b + 1)*AGGREGATE_BLOCK : words;
+		for (size_t w = b*AGGREGATE_BLOCK; w < last; ++w) {
+			aggregate_word(ctx, w, partial);
+		}
+	}
+}
+
+int aggregate_prop(struct rbx_object_prop *prop, const uint64_t *selection,
+                   struct rbx_aggregate *aggregate) {
+	memset(aggregate, 0x0, sizeof(struct rbx_aggregate));
+	int components = component_count(prop->value_type);
+	if (components == 0) {
+		return 0;
+	}
+	struct rbx_aggregate result;
+	reset_aggregate(&result, prop->value_type);
+
+	if (prop->encoding == RBX_ENCODING_PLAIN) {
+		// Blocks of words in parallel, merged in order
+		size_t words = RBX_SELECTION_WORDS(prop->value_count);
+		size_t block_count = (words + AGGREGATE_BLOCK - 1) / AGGREGATE_BLOCK;
+		struct aggregate_context ctx;
+		ctx.prop = prop;
+		ctx.selection = selection;
+		ctx.partial_array =
+			(struct rbx_aggregate*)malloc(sizeof(struct rbx_aggregate)*(block_count + 1));
+		if (ctx.partial_array == NULL) {
+			return 0;
+		}
+		parallel_for(block_count, 1, aggregate_blocks, &ctx);
+		for (size_t b = 0; b < block_count; ++b) {
+			merge_aggregates(&result, &ctx.partial_array[b]);
+		}
+		free(ctx.partial_array);
+	} else {
+		// Each slot once, weighted
+		uint64_t *weights = weigh_slots(prop, selection);
+		if (weights == NULL) {
+			return 0;
+		}
+		double value[RBX_AGGREGATE_COMPONENTS];
+		for (uint32_t k = 0; k < prop->slot_count; ++k) {
+			if (weights[k] > 0) {
+				value_components(prop, &prop->slot_array[k], value);
+				add_value(&result, value, weights[k]);
+			}
+		}
+		free(weights);
+	}
+
+	if (result.count == 0) {
+		for (int c = 0; c < RBX_AGGREGATE_COMPONENTS; ++c) {
+			result.min[c] = 0;
+			result.max[c] = 0;
+		}
+	}
+	*aggregate = result;
+	return 1;
+}
+
+int aggregate_by_class(struct rbx_file *file, const char *name, uint64_t **selection_array,
+                       struct rbx_aggregate *aggregate_array, struct rbx_aggregate *total) {
+	if (total != NULL) {
+		memset(total, 0x0, sizeof(struct rbx_aggregate));
+	}
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type = &file->type_array[i];
+		memset(&aggregate_array[i], 0x0, sizeof(struct rbx_aggregate));
+		struct rbx_object_prop *prop = type->prop_list;
+		while (prop != NULL && 0 != strcmp((const char*)prop->name.data, name)) {
+			prop = prop->next;
+		}
+		if (prop == NULL || component_count(prop->value_type) == 0) {
+			continue;
+		}
+		if (!aggregate_prop(prop, selection_array ? selection_array[i] : NULL,
+		                    &aggregate_array[i])) {
+			return 0;
+		}
+		if (total != NULL) {
+			merge_aggregates(total, &aggregate_array[i]);
+		}
+	}
+	return 1;
+}
+
+/* Bucket of a value, -1 if it's outside the histogram */
+int64_t bucket_of(struct aggregate_context *ctx, double value) {
+	if (!(value >= ctx->min && value <= ctx->max)) {
+		return -1;
+	}
+	uint32_t bucket = (uint32_t)((value - ctx->min)*ctx->scale);
+	return bucket < ctx->bucket_count ? bucket : ctx->bucket_count - 1;
+}
+
+/* Count the selected values of a word of a plain column into buckets */
+void histogram_word(struct aggregate_context *ctx, size_t word, uint64_t *buckets) {
+	struct rbx_object_prop *prop = ctx->prop;
+	uint32_t first = (uint32_t)(word*64);
+	uint32_t last = first + 64 < prop->value_count ? first + 64 : prop->value_count;
+	uint64_t bits = selected_bits(ctx->selection, word, first, last);
+	if (bits == 0) {
+		return;
+	}
+#ifdef __SSE2__
+	// Buckets of 4 numbers at a time, counted one by one
+	uint8_t type = prop->value_type;
+	if (bits == ~(uint64_t)0 &&
+	    (type == RBX_TYPE_INT32 || type == RBX_TYPE_FLOAT || type == RBX_TYPE_REAL)) {
+		const __m128d min = _mm_set1_pd(ctx->min);
+		const __m128d max = _mm_set1_pd(ctx->max);
+		const __m128d scale = _mm_set1_pd(ctx->scale);
+		for (int k = 0; k < 64; k += 4) {
+			__m128d values[2];
+			load_4_pd(type, prop->slot_array + first + k, &values[0], &values[1]);
+			for (int h = 0; h < 2; ++h) {
+				int inside = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(values[h], min),
+				                                        _mm_cmple_pd(values[h], max)));
+				int32_t index[4];
+				_mm_storeu_si128((__m128i*)index,
+					_mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(values[h], min), scale)));
+				for (int j = 0; j < 2; ++j) {
+					if ((inside >> j) & 1) {
+						uint32_t bucket = (uint32_t)index[j];
+						++buckets[bucket < ctx->bucket_count ? bucket : ctx->bucket_count - 1];
+					}
+				}
+			}
+		}
+		return;
+	}
+#endif
+	double value[RBX_AGGREGATE_COMPONENTS];
+	for (uint32_t i = first; i < last; ++i) {
+		if ((bits >> (i - first)) & 1) {
+			value_components(prop, &prop->slot_array[i], value);
+			int64_t bucket = bucket_of(ctx, value[ctx->component]);
+			if (bucket >= 0) {
+				++buckets[bucket];
+			}
+		}
+	}
+}
+
+void histogram_blocks(void *context, size_t begin, size_t end) {
+	struct aggregate_context *ctx = (struct aggregate_context*)context;
+	size_t words = RBX_SELECTION_WORDS(ctx->prop->value_count);
+	for (size_t b = begin; b < end; ++b) {
+		uint64_t *buckets = ctx->bucket_storage + b*ctx->bucket_count;
+		size_t last = (b + 1)*AGGREGATE_BLOCK < words ? (b + 1)*AGGREGATE_BLOCK : words;
+		for (size_t w = b*AGGREGATE_BLOCK; w < last; ++w) {
+			histogram_word(ctx, w, buckets);
+		}
+	}
+}
+
+int histogram_prop(struct rbx_object_prop *prop, const uint64_t *selection, int component,
+                   double min, double max, uint32_t bucket_count, uint64_t *bucket_array) {
+	int components = component_count(prop->value_type);
+	if (component < 0 || component >= components || bucket_count == 0) {
+		return 0;
+	}
+	memset(bucket_array, 0x0, sizeof(uint64_t)*bucket_count);
+
+	struct aggregate_context ctx;
+	ctx.prop = prop;
+	ctx.selection = selection;
+	ctx.component = component;
+	ctx.min = min;
+	ctx.max = max;
+	ctx.scale = max > min ? bucket_count / (max - min) : 0;
+	ctx.bucket_count = bucket_count;
+
+	if (prop->encoding == RBX_ENCODING_PLAIN) {
+		// A set of buckets per block, added up in order
+		size_t words = RBX_SELECTION_WORDS(prop->value_count);
+		size_t block_count = (words + AGGREGATE_BLOCK - 1) / AGGREGATE_BLOCK;
+		ctx.bucket_storage =
+			(uint64_t*)calloc(block_count*bucket_count + 1, sizeof(uint64_t));
+		if (ctx.bucket_storage == NULL) {
+			return 0;
+		}
+		parallel_for(block_count, 1, histogram_blocks, &ctx);
+		for (size_t b = 0; b < block_count; ++b) {
+			for (uint32_t k = 0; k < bucket_count; ++k) {
+				bucket_array[k] += ctx.bucket_storage[b*bucket_count + k];
+			}
+		}
+		free(ctx.bucket_storage);
+	} else {
+		uint64_t *weights = weigh_slots(prop, selection);
+		if (weights == NULL) {
+			return 0;
+		}
+		double value[RBX_AGGREGATE_COMPONENTS];
+		for (uint32_t k = 0; k < prop->slot_count; ++k) {
+			if (weights[k] > 0) {
+				value_components(prop, &prop->slot_array[k], value);
+				int64_t bucket = bucket_of(&ctx, value[component]);
+				if (bucket >= 0) {
+					bucket_array[bucket] += weights[k];
+				}
+			}
+		}
+		free(weights);
+	}
+	return 1;
+}
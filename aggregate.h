@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rbx_types.h"
+#include "fmt_rbx.h"
+
+/* Aggregates over the values of a column
+ * - Int32, Float and Real columns have one component, Vector2 columns two,
+ *   and Vector3, Color3 and CFrame columns three, a CFrame by its position.
+ *   BrickColor and Token values count as integers, so that a histogram of
+ *   them is a palette.
+ * - The values can be restricted to a selection of the objects of the
+ *   class (see RBX_SELECTION_WORDS), such as one from query_objects.
+ *   Objects without a value are skipped.
+ * - Plain columns are aggregated a selection word at a time, 64 values at
+ *   a time with SSE when it's available and every value is selected, and
+ *   in parallel for big columns. Encoded columns are aggregated once per
+ *   slot, weighted by the number of selected values that share it.
+ * - Sums are kept as doubles, and are the same from run to run however
+ *   many threads there are.
+ */
+
+#define RBX_AGGREGATE_COMPONENTS 3
+
+struct rbx_aggregate {
+	uint8_t value_type;       /* RBX_TYPE_* of the column */
+	uint32_t component_count; /* 0 if the column can't be aggregated */
+	uint32_t count;           /* Values aggregated */
+	double sum[RBX_AGGREGATE_COMPONENTS];
+	double min[RBX_AGGREGATE_COMPONENTS]; /* min and max are 0 if count is */
+	double max[RBX_AGGREGATE_COMPONENTS];
+	double product_sum;       /* Sum over the values of the product of their
+	                             components, the total volume of a Size
+	                             column */
+};
+
+/* Aggregate a column over the objects in selection, or over all of them if
+ * selection is NULL. Returns 0 if the column's type can't be aggregated or
+ * there isn't enough memory. */
+int aggregate_prop(struct rbx_object_prop *prop, const uint64_t *selection,
+                   struct rbx_aggregate *aggregate);
+
+/* Mean of a component, 0 if nothing was aggregated */
+double aggregate_mean(const struct rbx_aggregate *aggregate, int component);
+
+/* Fold the aggregate b into a, a zeroed aggregate is empty. Returns 0, and
+ * leaves a as it was, if both have values of different types. */
+int merge_aggregates(struct rbx_aggregate *a, const struct rbx_aggregate *b);
+
+/* Aggregate the property called name of every class that has it, into
+ * aggregate_array indexed like the file's type_array, and their total into
+ * total if it isn't NULL. selection_array is a selection per class, as in
+ * rbx_query_result, or NULL for every object. Classes without the
+ * property, or with one that can't be aggregated, get a component_count
+ * of 0. total only takes the classes whose property has the type of the
+ * first one with values, compare value_type to find the others. Returns 0
+ * on allocation failure. */
+int aggregate_by_class(struct rbx_file *file, const char *name, uint64_t **selection_array,
+                       struct rbx_aggregate *aggregate_array, struct rbx_aggregate *total);
+
+/* Count one component of the values of a column into bucket_count equal
+ * buckets over [min, max], with the values equal to max in the last one.
+ * Values outside the range are left out. bucket_array is zeroed first.
+ * Returns 0 if the column's type can't be aggregated or there isn't
+ * enough memory. */
+int histogram_prop(struct rbx_object_prop *prop, const uint64_t *selection, int component,
+                   double min, double max, uint32_t bucket_count, uint64_t *bucket_array);
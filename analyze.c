@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "diff.h"
+#include "parallel.h"
+
+/* Shared state of the column pass */
+struct analyze_context {
+	struct rbx_column_analysis *column_array;
+	uint64_t *ref_array;  /* Stand in hashes for object references */
+	uint64_t *size_array; /* Total value size of each column */
+};
+
+int compare_value_hashes(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : (x > y);
+}
+
+/* Count the set and distinct values of a range of columns, and add up
+ * their value sizes for sharing out their cost. */
+void analyze_columns(void *context, size_t begin, size_t end) {
+	struct analyze_context *ctx = (struct analyze_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		struct rbx_column_analysis *column = &ctx->column_array[i];
+		struct rbx_object_prop *prop = column->prop;
+		uint32_t count = prop->parent_type->object_count;
+		uint64_t *hashes = (uint64_t*)malloc(sizeof(uint64_t)*(count + 1));
+
+		uint64_t size = 0;
+		uint32_t set = 0;
+		for (uint32_t j = 0; j < count; ++j) {
+			struct rbx_value expanded;
+			struct rbx_value *value = rbx_prop_get(prop, j, &expanded);
+			size += value_size(prop->value_type, value);
+			if (value != NULL) {
+				if (hashes) {
+					hashes[set] = hash_value(prop->value_type, value, ctx->ref_array);
+				}
+				++set;
+			}
+		}
+		ctx->size_array[i] = size;
+		column->value_count = set;
+
+		// Leave the distinct count at 0 if there's no room to count them
+		column->distinct_count = 0;
+		if (hashes) {
+			qsort(hashes, set, sizeof(uint64_t), compare_value_hashes);
+			for (uint32_t j = 0; j < set; ++j) {
+				column->distinct_count += (j == 0 || hashes[j] != hashes[j - 1]);
+			}
+			free(hashes);
+		}
+	}
+}
+
+int compare_columns(const void *a, const void *b) {
+	const struct rbx_column_analysis *x = (const struct rbx_column_analysis*)a;
+	const struct rbx_column_analysis *y = (const struct rbx_column_analysis*)b;
+	return x->compressed_bytes > y->compressed_bytes ? -1 :
+	       (x->compressed_bytes < y->compressed_bytes);
+}
+
+int compare_classes(const void *a, const void *b) {
+	const struct rbx_class_analysis *x = (const struct rbx_class_analysis*)a;
+	const struct rbx_class_analysis *y = (const struct rbx_class_analysis*)b;
+	return x->compressed_bytes > y->compressed_bytes ? -1 :
+	       (x->compressed_bytes < y->compressed_bytes);
+}
+
+int compare_subtree_costs(const void *a, const void *b) {
+	const struct rbx_subtree_analysis *x = (const struct rbx_subtree_analysis*)a;
+	const struct rbx_subtree_analysis *y = (const struct rbx_subtree_analysis*)b;
+	return x->compressed_bytes > y->compressed_bytes ? -1 :
+	       (x->compressed_bytes < y->compressed_bytes);
+}
+
+/* Columns that were read from a PROP record, not added by the reader */
+int is_file_column(struct rbx_object_prop *prop) {
+	return prop->decompressed_bytes > 0;
+}
+
+/* Share out the cost of each class and column over its objects, then sum
+ * it up over the top level subtrees. */
+int analyze_subtrees(struct rbx_file *file, struct rbx_analysis *analysis,
+                     uint64_t *size_array) {
+	uint32_t count = file->object_count;
+	double *cost = (double*)calloc(3*((size_t)count + 1), sizeof(double));
+	double *cost_before = (double*)malloc(3*((size_t)file->tree_count + 1)*sizeof(double));
+	uint32_t subtree_count = file->root_count;
+	for (uint32_t i = 0; i < file->root_count; ++i) {
+		subtree_count += file->root_array[i]->child_count;
+	}
+	analysis->subtree_array = (struct rbx_subtree_analysis*)
+		malloc(sizeof(struct rbx_subtree_analysis)*(subtree_count + 1));
+	if (!cost || !cost_before || !analysis->subtree_array) {
+		free(cost);
+		free(cost_before);
+		return 0;
+	}
+
+	// Per object compressed bytes, decompressed bytes and decode time
+	uint32_t column = 0;
+	for (uint32_t i = 0; i < analysis->class_count; ++i) {
+		struct rbx_class_analysis *class_info = &analysis->class_array[i];
+		struct rbx_object_class *type = class_info->type;
+		for (uint32_t j = 0; j < type->object_count; ++j) {
+			double *object_cost = &cost[3*type->object_referent_array[j]];
+			object_cost[0] += (double)type->compressed_bytes / type->object_count;
+			object_cost[1] += (double)type->decompressed_bytes / type->object_count;
+		}
+		for (uint32_t k = 0; k < class_info->column_count; ++k, ++column) {
+			struct rbx_column_analysis *info = &class_info->column_array[k];
+			struct rbx_object_prop *prop = info->prop;
+			uint64_t size = size_array[column];
+			for (uint32_t j = 0; j < type->object_count; ++j) {
+				struct rbx_value expanded;
+				struct rbx_value *value = rbx_prop_get(prop, j, &expanded);
+				double share = size ? (double)value_size(prop->value_type, value) / size : 0;
+				double *object_cost = &cost[3*type->object_referent_array[j]];
+				object_cost[0] += share*info->compressed_bytes;
+				object_cost[1] += share*info->decompressed_bytes;
+				if (value != NULL) {
+					object_cost[2] += info->decode_ns / info->value_count;
+				}
+			}
+		}
+	}
+
+	// Sums before each position in tree order, so that the cost of a
+	// subtree is a difference of two entries.
+	for (int k = 0; k < 3; ++k) {
+		cost_before[k] = 0;
+	}
+	for (uint32_t i = 0; i < file->tree_count; ++i) {
+		double *object_cost = &cost[3*file->tree_order[i]->referent];
+		for (int k = 0; k < 3; ++k) {
+			cost_before[3*(i + 1) + k] = cost_before[3*i + k] + object_cost[k];
+		}
+	}
+
+	for (uint32_t i = 0; i < file->root_count; ++i) {
+		struct rbx_object *root = file->root_array[i];
+		for (int64_t j = -1; j < (int64_t)root->child_count; ++j) {
+			struct rbx_object *object = (j < 0) ? root : root->child_array[j];
+			struct rbx_subtree_analysis *subtree =
+				&analysis->subtree_array[analysis->subtree_count++];
+			double *enter = &cost_before[3*object->tree_enter];
+			double *exit = &cost_before[3*object->tree_exit];
+			subtree->object = object;
+			subtree->instance_count = object->tree_exit - object->tree_enter;
+			subtree->compressed_bytes = exit[0] - enter[0];
+			subtree->decompressed_bytes = exit[1] - enter[1];
+			subtree->decode_ns = exit[2] - enter[2];
+		}
+	}
+	qsort(analysis->subtree_array, analysis->subtree_count,
+		sizeof(struct rbx_subtree_analysis), compare_subtree_costs);
+
+	free(cost);
+	free(cost_before);
+	return 1;
+}
+
+struct rbx_analysis *analyze_file(struct rbx_file *file) {
+	struct rbx_analysis *analysis =
+		(struct rbx_analysis*)calloc(1, sizeof(struct rbx_analysis));
+	if (!analysis) {
+		return NULL;
+	}
+
+	uint32_t column_count = 0;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_prop *prop = file->type_array[i].prop_list;
+		for (; prop != NULL; prop = prop->next) {
+			column_count += is_file_column(prop);
+		}
+	}
+
+	struct analyze_context ctx;
+	ctx.column_array = analysis->column_storage = (struct rbx_column_analysis*)
+		malloc(sizeof(struct rbx_column_analysis)*(column_count + 1));
+	ctx.ref_array = (uint64_t*)malloc(sizeof(uint64_t)*(file->object_count + 1));
+	ctx.size_array = (uint64_t*)malloc(sizeof(uint64_t)*(column_count + 1));
+	analysis->class_array = (struct rbx_class_analysis*)
+		malloc(sizeof(struct rbx_class_analysis)*(file->type_count + 1));
+	analysis->column_array = (struct rbx_column_analysis*)
+		malloc(sizeof(struct rbx_column_analysis)*(column_count + 1));
+	if (!ctx.ref_array || !ctx.size_array || !analysis->column_storage ||
+	    !analysis->class_array || !analysis->column_array) {
+		free(ctx.ref_array);
+		free(ctx.size_array);
+		free_analysis(analysis);
+		return NULL;
+	}
+
+	// Objects are distinct values of a reference column
+	for (uint32_t i = 0; i < file->object_count; ++i) {
+		ctx.ref_array[i] = i + 1;
+	}
+
+	// Lay out the columns grouped by class
+	struct rbx_column_analysis *columns = analysis->column_storage;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type = &file->type_array[i];
+		struct rbx_class_analysis *class_info = &analysis->class_array[i];
+		class_info->type = type;
+		class_info->compressed_bytes = type->compressed_bytes;
+		class_info->decompressed_bytes = type->decompressed_bytes;
+		class_info->decode_ns = 0;
+		class_info->column_count = 0;
+		class_info->column_array = columns;
+		for (struct rbx_object_prop *prop = type->prop_list; prop; prop = prop->next) {
+			if (!is_file_column(prop)) {
+				continue;
+			}
+			columns->prop = prop;
+			columns->compressed_bytes = prop->compressed_bytes;
+			columns->decompressed_bytes = prop->decompressed_bytes;
+			columns->decode_ns = prop->decode_ns;
+			class_info->compressed_bytes += prop->compressed_bytes;
+			class_info->decompressed_bytes += prop->decompressed_bytes;
+			class_info->decode_ns += prop->decode_ns;
+			++class_info->column_count;
+			++columns;
+		}
+	}
+	analysis->class_count = file->type_count;
+	analysis->column_count = column_count;
+
+	parallel_for(column_count, 1, analyze_columns, &ctx);
+	free(ctx.ref_array);
+
+	// Attribute the cost to subtrees while the columns are still in the
+	// same order as the size array
+	int ok = analyze_subtrees(file, analysis, ctx.size_array);
+	free(ctx.size_array);
+	if (!ok) {
+		free_analysis(analysis);
+		return NULL;
+	}
+
+	// Sort everything by cost, the class array last since the columns are
+	// found through it
+	memcpy(analysis->column_array, analysis->column_storage,
+		sizeof(struct rbx_column_analysis)*column_count);
+	qsort(analysis->column_array, column_count,
+		sizeof(struct rbx_column_analysis), compare_columns);
+	for (uint32_t i = 0; i < analysis->class_count; ++i) {
+		struct rbx_class_analysis *class_info = &analysis->class_array[i];
+		qsort(class_info->column_array, class_info->column_count,
+			sizeof(struct rbx_column_analysis), compare_columns);
+	}
+	qsort(analysis->class_array, analysis->class_count,
+		sizeof(struct rbx_class_analysis), compare_classes);
+
+	return analysis;
+}
+
+void free_analysis(struct rbx_analysis *analysis) {
+	if (analysis != NULL) {
+		free(analysis->class_array);
+		free(analysis->column_array);
+		free(analysis->subtree_array);
+		free(analysis->column_storage);
+		free(analysis);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rbx_types.h"
+#include "fmt_rbx.h"
+
+/* Size attribution, where the bytes and load time of a file go
+ * - Every column is charged the compressed and decompressed size of the
+ *   PROP record it was read from, and every class the size of its INST
+ *   record plus its columns. Decode times are only known for files read
+ *   with stats (see read_rbx_file_ex), and are zero otherwise.
+ * - The cost of a column is shared out over its objects by the size of
+ *   each value, and its decode time by value count, so that the cost of a
+ *   subtree is the sum over the objects in it.
+ * - Everything is sorted by cost, which is compressed bytes, the part of
+ *   the file that has to be downloaded.
+ */
+
+struct rbx_column_analysis {
+	struct rbx_object_prop *prop;
+	uint64_t compressed_bytes;
+	uint64_t decompressed_bytes;
+	uint32_t value_count;    /* Values that are set */
+	uint32_t distinct_count; /* Distinct values among them */
+	double decode_ns;
+};
+
+struct rbx_class_analysis {
+	struct rbx_object_class *type;
+	uint64_t compressed_bytes;   /* INST record and every column */
+	uint64_t decompressed_bytes;
+	double decode_ns;
+	uint32_t column_count;
+	struct rbx_column_analysis *column_array; /* The class's columns */
+};
+
+struct rbx_subtree_analysis {
+	struct rbx_object *object;
+	uint32_t instance_count;
+	double compressed_bytes; /* Shares of the columns, so fractional */
+	double decompressed_bytes;
+	double decode_ns;
+};
+
+struct rbx_analysis {
+	uint32_t class_count;
+	struct rbx_class_analysis *class_array;   /* Most costly first */
+	uint32_t column_count;
+	struct rbx_column_analysis *column_array; /* Most costly first */
+
+	/* The top level objects and their children, most costly first */
+	uint32_t subtree_count;
+	struct rbx_subtree_analysis *subtree_array;
+
+	struct rbx_column_analysis *column_storage; /* Columns grouped by class */
+};
+
+/* Analyze a file, NULL on allocation failure. Distinct values are counted
+ * a column at a time, in parallel. */
+struct rbx_analysis *analyze_file(struct rbx_file *file);
+
+void free_analysis(struct rbx_analysis *analysis);
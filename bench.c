@@ -0,0 +1,766 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "rbx_types.h"
+#include "fmt_rbx.h"
+
+/* Microbenchmarks of each stage of reading a file
+ * - Every case runs WARMUP times untimed, then REPETITIONS timed times, and
+ *   reports the median, mean and standard deviation of the repetitions,
+ *   along with the median time per item and throughput.
+ * - Cases time only their own stage, the setup and cleanup around each
+ *   repetition isn't counted.
+ * - Synthetic columns are generated from a fixed seed, so the inputs are
+ *   the same from run to run.
+ *
+ * Regression checks
+ * - bench --json file writes the median and median absolute deviation
+ *   (MAD) of every case as JSON, one result per line.
+ * - bench --baseline file compares against results written that way, and
+ *   exits with EXIT_FAILURE if any case got slower by more than both
+ *   REGRESSION_MADS times the (scaled) MADs of the two runs and
+ *   REGRESSION_TOLERANCE of the baseline median. The MAD term is capped at
+ *   REGRESSION_NOISE_CAP of the median, so a noisy case still fails on a
+ *   slowdown bigger than that. Cases that aren't in the baseline are
+ *   reported but never fail.
+ * - make perf checks against bench_baseline.json, make perf-baseline
+ *   rewrites it. Baselines are only comparable on the machine that made
+ *   them.
+ */
+
+#define WARMUP 3
+#define REPETITIONS 15
+
+#define REGRESSION_MADS 3.0
+#define REGRESSION_TOLERANCE 0.10
+#define REGRESSION_NOISE_CAP 0.20
+
+// Scales a MAD to estimate the standard deviation of normal noise
+#define MAD_SCALE 1.4826
+
+#define MAX_RESULTS 256
+#define MAX_RUNS 32
+
+// Values in each synthetic column, and the most bytes any type takes for
+// one, a CFrame with a full matrix
+#define COLUMN_VALUES 65536
+#define COLUMN_VALUE_BYTES 49
+
+/* Run one repetition of a case, returning the nanoseconds spent in the
+ * part being measured. */
+typedef double (*bench_fn)(void *context);
+
+double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : (x > y);
+}
+
+/* Result of a case, kept for the JSON output and baseline comparison */
+struct bench_result {
+	char group[128]; /* Section of the report the case is in */
+	char name[64];
+	double median_ns; /* Median over the runs of the median of each run */
+	double mad_ns;    /* MAD of the run medians, or of the samples of the
+	                     only run */
+	double ns_per_item;
+
+	double items;
+	double run_median_ns[MAX_RUNS];
+	double sample_mad_ns;
+};
+
+struct bench_result result_array[MAX_RESULTS];
+int result_count = 0;
+int case_index = 0; /* Of the next case in the current run */
+int run_index = 0;
+const char *current_group = "";
+
+/* Median of a sorted array */
+double median_of(const double *sorted, int count) {
+	return (count % 2) ? sorted[count/2] : 0.5*(sorted[count/2 - 1] + sorted[count/2]);
+}
+
+/* Run a case and print its line of the report. items is what the time per
+ * item is reported in terms of, bytes is the input size for MB/s. */
+void run_bench(const char *name, bench_fn fn, void *context, double items, double bytes) {
+	double samples[REPETITIONS];
+	for (int i = 0; i < WARMUP; ++i) {
+		fn(context);
+	}
+	for (int i = 0; i < REPETITIONS; ++i) {
+		samples[i] = fn(context);
+	}
+
+	double mean = 0, variance = 0;
+	for (int i = 0; i < REPETITIONS; ++i) {
+		mean += samples[i];
+	}
+	mean /= REPETITIONS;
+	for (int i = 0; i < REPETITIONS; ++i) {
+		variance += (samples[i] - mean)*(samples[i] - mean);
+	}
+	variance /= (REPETITIONS - 1);
+	qsort(samples, REPETITIONS, sizeof(double), compare_doubles);
+	double median = median_of(samples, REPETITIONS);
+
+	double deviations[REPETITIONS];
+	for (int i = 0; i < REPETITIONS; ++i) {
+		deviations[i] = fabs(samples[i] - median);
+	}
+	qsort(deviations, REPETITIONS, sizeof(double), compare_doubles);
+	double mad = median_of(deviations, REPETITIONS);
+
+	printf("%-36s %12.0f %12.0f %7.2f%% %10.2f %10.1f\n",
+		name, median, mean, 100*sqrt(variance)/mean,
+		median/items, bytes/(median*1e-9)/1e6);
+
+	// Every run goes through the cases in the same order
+	if (case_index < MAX_RESULTS) {
+		struct bench_result *result = &result_array[case_index++];
+		if (run_index == 0) {
+			snprintf(result->group, sizeof(result->group), "%s", current_group);
+			snprintf(result->name, sizeof(result->name), "%s", name);
+			result->items = items;
+			result->sample_mad_ns = mad;
+			result_count = case_index;
+		}
+		result->run_median_ns[run_index] = median;
+	}
+}
+
+/* Combine the runs of each case */
+void summarize_results(int run_count) {
+	for (int i = 0; i < result_count; ++i) {
+		struct bench_result *result = &result_array[i];
+		double medians[MAX_RUNS], deviations[MAX_RUNS];
+		memcpy(medians, result->run_median_ns, sizeof(double)*run_count);
+		qsort(medians, run_count, sizeof(double), compare_doubles);
+		result->median_ns = median_of(medians, run_count);
+		for (int j = 0; j < run_count; ++j) {
+			deviations[j] = fabs(medians[j] - result->median_ns);
+		}
+		qsort(deviations, run_count, sizeof(double), compare_doubles);
+		result->mad_ns = (run_count > 1) ?
+			median_of(deviations, run_count) : result->sample_mad_ns;
+		result->ns_per_item = result->median_ns / result->items;
+	}
+}
+
+/* Start a section of the report, the cases in it are keyed by group in the
+ * JSON output. */
+void print_header(const char *group, const char *title) {
+	current_group = group;
+	printf("\n%s\n", title);
+	printf("%-36s %12s %12s %8s %10s %10s\n",
+		"case", "median ns", "mean ns", "stddev", "ns/item", "MB/s");
+}
+
+/* xorshift64*, the synthetic data generator */
+uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ull;
+}
+
+/******************************************************************************
+ * unmix_32_array
+ */
+
+struct unmix_context {
+	uint8_t *data;
+	size_t length;
+};
+
+double bench_unmix(void *context) {
+	struct unmix_context *ctx = (struct unmix_context*)context;
+	struct rbx_reader reader = {0};
+	double start = now_ns();
+	unmix_32_array(&reader, ctx->data, ctx->length);
+	return now_ns() - start;
+}
+
+/******************************************************************************
+ * read_values, one case per type branch
+ */
+
+struct column_context {
+	uint8_t type;
+	uint8_t *data;
+	size_t length;
+	uint32_t value_count;
+};
+
+/* Fill a synthetic column of a type with plausible data, returns its length */
+size_t make_column(uint8_t type, uint8_t *data, uint32_t count, uint64_t *seed) {
+	uint8_t *ptr = data;
+	switch (type) {
+	case RBX_TYPE_STRING:
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t length = 4 + next_random(seed) % 28;
+			memcpy(ptr, &length, 4);
+			ptr += 4;
+			for (uint32_t j = 0; j < length; ++j) {
+				*(ptr++) = 'a' + next_random(seed) % 26;
+			}
+		}
+		return ptr - data;
+	case RBX_TYPE_BOOLEAN:
+		for (uint32_t i = 0; i < count; ++i) {
+			*(ptr++) = next_random(seed) & 1;
+		}
+		return count;
+	case RBX_TYPE_REAL:
+		for (uint32_t i = 0; i < count; ++i) {
+			double value = (double)(next_random(seed) % 100000) / 7;
+			memcpy(ptr, &value, 8);
+			ptr += 8;
+		}
+		return ptr - data;
+	case RBX_TYPE_CFRAME:
+		// Mostly axis aligned rotations, some full matrices
+		for (uint32_t i = 0; i < count; ++i) {
+			if (next_random(seed) % 4 == 0) {
+				*(ptr++) = 0x0;
+				for (int j = 0; j < 9; ++j) {
+					float value = (float)(next_random(seed) % 1000) / 1000;
+					memcpy(ptr, &value, 4);
+					ptr += 4;
+				}
+			} else {
+				*(ptr++) = rbx_rotation_ids[next_random(seed) % RBX_ROTATION_ID_COUNT];
+			}
+		}
+		for (uint32_t i = 0; i < 3*count; ++i) {
+			uint32_t value = (uint32_t)next_random(seed);
+			memcpy(ptr, &value, 4);
+			ptr += 4;
+		}
+		return ptr - data;
+	default: {
+		// Interleaved 32 bit values, one block per component
+		uint32_t components = 1;
+		if (type == RBX_TYPE_UDIM2) {
+			components = 4;
+		} else if (type == RBX_TYPE_COLOR3 || type == RBX_TYPE_VECTOR3) {
+			components = 3;
+		} else if (type == RBX_TYPE_VECTOR2) {
+			components = 2;
+		}
+		for (uint32_t i = 0; i < components*count; ++i) {
+			uint32_t value = (uint32_t)(next_random(seed) % 4096);
+			memcpy(ptr, &value, 4);
+			ptr += 4;
+		}
+		return ptr - data;
+	}
+	}
+}
+
+double bench_read_values(void *context) {
+	struct column_context *ctx = (struct column_context*)context;
+	uint8_t *ptr = ctx->data;
+	struct rbx_reader reader = {0};
+	struct rbx_object_prop prop = {0};
+	prop.value_type = ctx->type;
+	double start = now_ns();
+	read_values(&reader, &prop, &ptr, ctx->length, ctx->value_count);
+	double elapsed = now_ns() - start;
+	free_prop_values(NULL, &prop);
+	return elapsed;
+}
+
+/******************************************************************************
+ * Whole files, and the stages of reading one
+ */
+
+struct file_context {
+	const char *filename;
+	uint8_t *data;
+	size_t length;
+	uint32_t object_count;
+	size_t decompressed_length;
+	size_t arena_capacity; /* Enough for every allocation of a read */
+};
+
+/* A bump allocator for comparing against malloc, free does nothing and the
+ * whole arena is reset between reads. */
+struct arena {
+	uint8_t *base;
+	size_t capacity;
+	size_t used;
+};
+
+void *arena_alloc(void *user, size_t size) {
+	struct arena *arena = (struct arena*)user;
+	size_t offset = (arena->used + 15) & ~(size_t)15;
+	if (offset + size > arena->capacity) {
+		return NULL;
+	}
+	arena->used = offset + size;
+	return arena->base + offset;
+}
+
+void arena_free(void *user, void *ptr) {
+	(void)user;
+	(void)ptr;
+}
+
+/* Everything read_rbx_file has after decoding the records */
+struct staged_file {
+	uint32_t type_count;
+	struct rbx_object_class *type_array;
+	uint32_t object_count;
+	struct rbx_object *object_array;
+	uint32_t parent_count;
+	struct prnt_record *parents;
+};
+
+/* The record decoding part of read_rbx_file */
+int read_records(struct file_context *ctx, struct staged_file *file) {
+	struct rbx_reader reader = {0};
+	uint8_t *ptr = ctx->data + 16;
+	file->type_count = *(uint32_t*)ptr;
+	file->object_count = *(uint32_t*)(ptr + 4);
+	ptr += 16;
+
+	file->type_array = (struct rbx_object_class*)
+		calloc(file->type_count + 1, sizeof(struct rbx_object_class));
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		if (!read_type_record(&reader, &ptr, file->type_array + i)) {
+			free_type_array(NULL, file->type_array, i);
+			return 0;
+		}
+	}
+	while (read_prop_record(&reader, &ptr, file->type_array));
+
+	file->parents = (struct prnt_record*)
+		malloc(sizeof(struct prnt_record)*(file->object_count + 1));
+	if (!read_parent_record(&reader, &ptr, file->parents, file->object_count,
+		&file->parent_count))
+	{
+		free(file->parents);
+		free_type_array(NULL, file->type_array, file->type_count);
+		return 0;
+	}
+	file->object_array = NULL;
+	return 1;
+}
+
+/* The rest of read_rbx_file, minus the hierarchy index */
+void finish_objects(struct staged_file *file) {
+	struct rbx_reader reader = {0};
+	if (file->object_array == NULL) {
+		file->object_array =
+			build_objects(&reader, file->type_array, file->type_count, file->object_count);
+	}
+	link_parents(file->object_array, file->object_count, file->parents, file->parent_count);
+	add_parent_props(&reader, file->type_array, file->type_count, file->object_array);
+}
+
+void free_staged_file(struct staged_file *file) {
+	free_object_array(NULL, file->object_array, file->object_count);
+	free_type_array(NULL, file->type_array, file->type_count);
+	free(file->parents);
+}
+
+double bench_read_file(void *context) {
+	struct file_context *ctx = (struct file_context*)context;
+	double start = now_ns();
+	struct rbx_file *file = read_rbx_file(ctx->data, ctx->length);
+	double elapsed = now_ns() - start;
+	if (file) {
+		free_rbx_file(file);
+	}
+	return elapsed;
+}
+
+double bench_read_file_arena(void *context) {
+	struct file_context *ctx = (struct file_context*)context;
+	struct arena arena;
+	arena.base = (uint8_t*)malloc(ctx->arena_capacity);
+	arena.capacity = ctx->arena_capacity;
+	arena.used = 0;
+	struct rbx_allocator allocator = {arena_alloc, arena_free, &arena};
+	double start = now_ns();
+	struct rbx_file *file = read_rbx_file_ex(ctx->data, ctx->length, NULL, &allocator);
+	double elapsed = now_ns() - start;
+	if (file) {
+		free_rbx_file(file);
+	}
+	free(arena.base);
+	return elapsed;
+}
+
+/* Decompress every record of the file, from the first INST record to the
+ * END record */
+double bench_read_compressed(void *context) {
+	struct file_context *ctx = (struct file_context*)context;
+	uint8_t *ptr = ctx->data + 32;
+	uint8_t *end = ctx->data + ctx->length;
+	double elapsed = 0;
+	while (end - ptr > 16) {
+		ptr += 4;
+		struct lz4_data record;
+		struct rbx_reader reader = {0};
+		double start = now_ns();
+		int ok = read_compressed(&reader, &ptr, &record);
+		elapsed += now_ns() - start;
+		if (!ok) {
+			break;
+		}
+		free(record.data);
+	}
+	return elapsed;
+}
+
+double bench_assembly(void *context) {
+	struct file_context *ctx = (struct file_context*)context;
+	struct staged_file file;
+	if (!read_records(ctx, &file)) {
+		return 0;
+	}
+	struct rbx_reader reader = {0};
+	double start = now_ns();
+	file.object_array =
+		build_objects(&reader, file.type_array, file.type_count, file.object_count);
+	double elapsed = now_ns() - start;
+	finish_objects(&file);
+	free_staged_file(&file);
+	return elapsed;
+}
+
+double bench_parents(void *context) {
+	struct file_context *ctx = (struct file_context*)context;
+	struct staged_file file;
+	if (!read_records(ctx, &file)) {
+		return 0;
+	}
+	struct rbx_reader reader = {0};
+	file.object_array =
+		build_objects(&reader, file.type_array, file.type_count, file.object_count);
+	double start = now_ns();
+	link_parents(file.object_array, file.object_count, file.parents, file.parent_count);
+	add_parent_props(&reader, file.type_array, file.type_count, file.object_array);
+	double elapsed = now_ns() - start;
+	free_staged_file(&file);
+	return elapsed;
+}
+
+/* Load a file for the file cases, returns 0 if it can't be read */
+int load_bench_file(const char *filename, struct file_context *ctx) {
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	ctx->length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	ctx->data = (uint8_t*)malloc(ctx->length + 1);
+	if (!ctx->data || fread(ctx->data, 1, ctx->length, f) != ctx->length) {
+		free(ctx->data);
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	ctx->filename = filename;
+
+	struct rbx_load_stats stats;
+	struct rbx_file *file = read_rbx_file_ex(ctx->data, ctx->length, &stats, NULL);
+	if (!file) {
+		free(ctx->data);
+		return 0;
+	}
+	ctx->object_count = file->object_count;
+	ctx->arena_capacity = stats.alloc_bytes + 16*stats.alloc_count;
+	free_rbx_file(file);
+
+	// Total decompressed size of the records
+	ctx->decompressed_length = 0;
+	uint8_t *ptr = ctx->data + 32;
+	while (ctx->data + ctx->length - ptr > 16) {
+		uint32_t compressed_length = *(uint32_t*)(ptr + 4);
+		ctx->decompressed_length += *(uint32_t*)(ptr + 8);
+		ptr += 16 + compressed_length;
+	}
+	return 1;
+}
+
+void bench_file(const char *filename) {
+	struct file_context ctx;
+	if (!load_bench_file(filename, &ctx)) {
+		printf("\nCouldn't read %s, skipping it.\n", filename);
+		return;
+	}
+
+	char title[512];
+	snprintf(title, sizeof(title), "%s: %zu bytes, %u objects, %zu bytes decompressed",
+		filename, ctx.length, ctx.object_count, ctx.decompressed_length);
+	print_header(filename, title);
+	run_bench("read_rbx_file (ns/object)", bench_read_file, &ctx,
+		ctx.object_count, ctx.length);
+	run_bench("read_rbx_file arena (ns/object)", bench_read_file_arena, &ctx,
+		ctx.object_count, ctx.length);
+	run_bench("read_compressed (ns/object, out MB/s)", bench_read_compressed, &ctx,
+		ctx.object_count, ctx.decompressed_length);
+	run_bench("build_objects (ns/object)", bench_assembly, &ctx,
+		ctx.object_count, ctx.decompressed_length);
+	run_bench("link_parents + Parent (ns/object)", bench_parents, &ctx,
+		ctx.object_count, ctx.decompressed_length);
+
+	free(ctx.data);
+}
+
+/******************************************************************************
+ * Results and baselines
+ */
+
+int write_results(const char *filename, int run_count) {
+	FILE *f = fopen(filename, "w");
+	if (!f) {
+		return 0;
+	}
+	fprintf(f, "{\"repetitions\": %d, \"runs\": %d, \"results\": [\n",
+		REPETITIONS, run_count);
+	for (int i = 0; i < result_count; ++i) {
+		struct bench_result *result = &result_array[i];
+		fprintf(f, "{\"group\": \"%s\", \"name\": \"%s\", \"median_ns\": %.1f, "
+			"\"mad_ns\": %.1f, \"ns_per_item\": %.3f}%s\n",
+			result->group, result->name, result->median_ns, result->mad_ns,
+			result->ns_per_item, (i + 1 < result_count) ? "," : "");
+	}
+	fprintf(f, "]}\n");
+	return 0 == fclose(f);
+}
+
+/* Copy the string value of "key" in a line of the results into buffer */
+int json_string_field(const char *line, const char *key, char *buffer, size_t size) {
+	char pattern[64];
+	snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+	const char *start = strstr(line, pattern);
+	if (!start) {
+		return 0;
+	}
+	start += strlen(pattern);
+	const char *end = strchr(start, '"');
+	if (!end || (size_t)(end - start) >= size) {
+		return 0;
+	}
+	memcpy(buffer, start, end - start);
+	buffer[end - start] = '\0';
+	return 1;
+}
+
+int json_number_field(const char *line, const char *key, double *value) {
+	char pattern[64];
+	snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+	const char *start = strstr(line, pattern);
+	return start && 1 == sscanf(start + strlen(pattern), "%lf", value);
+}
+
+/* Read the results written by write_results, one per line. Returns the
+ * number read, or -1 if the file can't be opened. */
+int read_results(const char *filename, struct bench_result *results, int capacity) {
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		return -1;
+	}
+	int count = 0;
+	char line[1024];
+	while (count < capacity && fgets(line, sizeof(line), f)) {
+		struct bench_result *result = &results[count];
+		if (json_string_field(line, "group", result->group, sizeof(result->group)) &&
+		    json_string_field(line, "name", result->name, sizeof(result->name)) &&
+		    json_number_field(line, "median_ns", &result->median_ns) &&
+		    json_number_field(line, "mad_ns", &result->mad_ns))
+		{
+			++count;
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+/* Compare the results against a baseline, returns the number of cases that
+ * regressed */
+int compare_results(struct bench_result *baseline, int baseline_count) {
+	int regressions = 0;
+	printf("\n%-36s %12s %12s %8s %12s\n",
+		"Against baseline", "base ns", "median ns", "change", "threshold");
+	for (int i = 0; i < result_count; ++i) {
+		struct bench_result *result = &result_array[i];
+		struct bench_result *base = NULL;
+		for (int j = 0; j < baseline_count && !base; ++j) {
+			if (0 == strcmp(baseline[j].group, result->group) &&
+			    0 == strcmp(baseline[j].name, result->name)) {
+				base = &baseline[j];
+			}
+		}
+		if (base == NULL) {
+			printf("%-36s %12s %12.0f %8s %12s  new (%s)\n",
+				result->name, "-", result->median_ns, "-", "-", result->group);
+			continue;
+		}
+
+		// Noise threshold from the spread of both runs, but never looser
+		// than the noise cap or tighter than the relative tolerance
+		double threshold = REGRESSION_MADS*MAD_SCALE*(base->mad_ns + result->mad_ns);
+		if (threshold > REGRESSION_NOISE_CAP*base->median_ns) {
+			threshold = REGRESSION_NOISE_CAP*base->median_ns;
+		}
+		if (threshold < REGRESSION_TOLERANCE*base->median_ns) {
+			threshold = REGRESSION_TOLERANCE*base->median_ns;
+		}
+		double change = result->median_ns - base->median_ns;
+		int regressed = change > threshold;
+		regressions += regressed;
+		printf("%-36s %12.0f %12.0f %+7.1f%% %12.0f  %s(%s)\n",
+			result->name, base->median_ns, result->median_ns,
+			100*change/base->median_ns, threshold,
+			regressed ? "REGRESSED " : "", result->group);
+	}
+	return regressions;
+}
+
+/* Run every case once, over the given files or the fixtures, returns 0 if
+ * there wasn't enough memory */
+int run_cases(char **files, int file_count) {
+	uint64_t seed = 0x5EED5EED5EED5EEDull;
+	case_index = 0;
+
+	// unmix_32_array over 4MB
+	struct unmix_context unmix;
+	unmix.length = 4 << 20;
+	unmix.data = (uint8_t*)malloc(unmix.length);
+	if (unmix.data == NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i < unmix.length; ++i) {
+		unmix.data[i] = (uint8_t)next_random(&seed);
+	}
+	print_header("unmix_32_array", "unmix_32_array, 1M values");
+	run_bench("unmix_32_array (ns/value)", bench_unmix, &unmix, unmix.length / 4, unmix.length);
+	free(unmix.data);
+	// read_values on a synthetic column of each type it decodes
+	static const struct {
+		uint8_t type;
+		const char *name;
+	} types[] = {
+		{RBX_TYPE_STRING, "String"},
+		{RBX_TYPE_BOOLEAN, "Boolean"},
+		{RBX_TYPE_INT32, "Int32"},
+		{RBX_TYPE_FLOAT, "Float"},
+		{RBX_TYPE_REAL, "Real"},
+		{RBX_TYPE_UDIM2, "UDim2"},
+		{RBX_TYPE_BRICKCOLOR, "BrickColor"},
+		{RBX_TYPE_COLOR3, "Color3"},
+		{RBX_TYPE_VECTOR2, "Vector2"},
+		{RBX_TYPE_VECTOR3, "Vector3"},
+		{RBX_TYPE_CFRAME, "CFrame"},
+		{RBX_TYPE_TOKEN, "Token"},
+		{RBX_TYPE_REFERENT, "Referent"},
+	};
+	print_header("read_values", "read_values, 64K values per column");
+	uint8_t *column = (uint8_t*)malloc(COLUMN_VALUES*COLUMN_VALUE_BYTES);
+	if (column == NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); ++i) {
+		struct column_context ctx;
+		ctx.type = types[i].type;
+		ctx.data = column;
+		ctx.value_count = COLUMN_VALUES;
+		ctx.length = make_column(ctx.type, column, COLUMN_VALUES, &seed);
+		char name[64];
+		snprintf(name, sizeof(name), "read_values %s (ns/value)", types[i].name);
+		run_bench(name, bench_read_values, &ctx, COLUMN_VALUES, ctx.length);
+	}
+	free(column);
+
+	// Whole files, the fixtures unless some are given
+	if (file_count > 0) {
+		for (int i = 0; i < file_count; ++i) {
+			bench_file(files[i]);
+		}
+	} else {
+		bench_file("test_file.rbxl");
+		bench_file("test_model.rbxm");
+		bench_file("test_mesh.rbxm");
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	// Options, the remaining arguments are files to run the file cases on
+	const char *json_file = NULL;
+	const char *baseline_file = NULL;
+	int run_count = 1;
+	int file_count = 0;
+	char **files = (char**)malloc(sizeof(char*)*argc);
+	for (int i = 1; i < argc; ++i) {
+		if (0 == strcmp(argv[i], "--json") && i + 1 < argc) {
+			json_file = argv[++i];
+		} else if (0 == strcmp(argv[i], "--baseline") && i + 1 < argc) {
+			baseline_file = argv[++i];
+		} else if (0 == strcmp(argv[i], "--runs") && i + 1 < argc) {
+			run_count = atoi(argv[++i]);
+			if (run_count < 1 || run_count > MAX_RUNS) {
+				printf("--runs must be from 1 to %d.\n", MAX_RUNS);
+				return EXIT_FAILURE;
+			}
+		} else {
+			files[file_count++] = argv[i];
+		}
+	}
+
+	// Read the baseline first, so that a bad path fails before running
+	static struct bench_result baseline[MAX_RESULTS];
+	int baseline_count = 0;
+	if (baseline_file) {
+		baseline_count = read_results(baseline_file, baseline, MAX_RESULTS);
+		if (baseline_count < 0) {
+			printf("Couldn't read the baseline %s.\n", baseline_file);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (run_index = 0; run_index < run_count; ++run_index) {
+		if (run_count > 1) {
+			printf("\nRun %d of %d\n", run_index + 1, run_count);
+		}
+		if (!run_cases(files, file_count)) {
+			printf("Not enough memory to run the cases.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	free(files);
+	summarize_results(run_count);
+
+	if (json_file && !write_results(json_file, run_count)) {
+		printf("Couldn't write the results to %s.\n", json_file);
+		return EXIT_FAILURE;
+	}
+	if (baseline_file) {
+		int regressions = compare_results(baseline, baseline_count);
+		if (regressions > 0) {
+			printf("\n%d cases regressed.\n", regressions);
+			return EXIT_FAILURE;
+		}
+		printf("\nNo regressions.\n");
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rbx_types.h"
+#include "lz4.h"
+
+/* Synthetic binary place generator, for scale testing the reader
+ * - Every value is a hash of the seed, the object and the property, so the
+ *   output only depends on the options, and the classes can be written one
+ *   at a time without holding the whole file in memory.
+ * - The hierarchy is a forest of identically shaped models, each one a
+ *   complete tree of the given depth and fan-out.
+ * - The entropy is the percentage of values that are random, the rest come
+ *   from a pool of 16 values per property, which makes them compressible.
+ * - Referent values always refer to an object, never nil, and two objects
+ *   in a row never refer to the same object, as the reader treats a zero
+ *   delta as a special case.
+ */
+
+#define POOL_SIZE 16
+
+// Largest record the LZ4 block API can compress
+#define MAX_RECORD 0x7E000000
+
+struct gen_options {
+	uint64_t instance_count;
+	uint32_t class_count;
+	const char *class_weights; /* Comma separated, NULL for an even mix */
+	uint32_t prop_count;   /* Per class, besides Name */
+	const char *type_mix;  /* One letter per property type */
+	uint32_t depth;
+	uint32_t fanout;
+	uint32_t string_length;
+	uint32_t entropy;      /* 0 to 100 */
+	uint64_t seed;
+	const char *output;
+};
+
+static const struct {
+	char letter;
+	uint8_t type;
+	const char *name;
+} prop_types[] = {
+	{'s', RBX_TYPE_STRING, "String"},
+	{'b', RBX_TYPE_BOOLEAN, "Boolean"},
+	{'i', RBX_TYPE_INT32, "Int32"},
+	{'f', RBX_TYPE_FLOAT, "Float"},
+	{'r', RBX_TYPE_REAL, "Real"},
+	{'u', RBX_TYPE_UDIM2, "UDim2"},
+	{'k', RBX_TYPE_BRICKCOLOR, "BrickColor"},
+	{'c', RBX_TYPE_COLOR3, "Color3"},
+	{'2', RBX_TYPE_VECTOR2, "Vector2"},
+	{'v', RBX_TYPE_VECTOR3, "Vector3"},
+	{'x', RBX_TYPE_CFRAME, "CFrame"},
+	{'t', RBX_TYPE_TOKEN, "Token"},
+	{'o', RBX_TYPE_REFERENT, "Referent"},
+};
+#define PROP_TYPE_COUNT (sizeof(prop_types)/sizeof(prop_types[0]))
+
+/* splitmix64 finalizer */
+uint64_t mix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Read the class weights into running totals, one per class. Classes past
+ * the end of the list weigh as much as the last one in it, and without a
+ * list every class weighs 1. Returns 0 if the list isn't valid or the
+ * weights add up to 0. */
+int read_class_weights(const char *text, uint32_t class_count, uint64_t *total_array) {
+	uint64_t weight = 1;
+	uint64_t total = 0;
+	for (uint32_t c = 0; c < class_count; ++c) {
+		if (text != NULL && *text != '\0') {
+			char *end;
+			if (*text < '0' || *text > '9') {
+				return 0;
+			}
+			weight = strtoull(text, &end, 10);
+			if (weight > UINT32_MAX || (*end != ',' && *end != '\0')) {
+				return 0;
+			}
+			text = *end == ',' ? end + 1 : end;
+		}
+		total += weight;
+		total_array[c] = total;
+	}
+	return total > 0;
+}
+
+/* Random bits for one value, either unique to the object or from the pool
+ * of the property */
+uint64_t value_bits(struct gen_options *options, uint32_t prop, uint32_t referent) {
+	uint64_t key = mix(options->seed ^ mix(((uint64_t)prop << 32) | referent));
+	if (key % 100 >= options->entropy) {
+		key = mix(options->seed ^ ((uint64_t)prop << 32) ^ (key % POOL_SIZE));
+	}
+	return key;
+}
+
+/******************************************************************************
+ * Encoding, the inverse of the reads in fmt_rbx.c
+ */
+
+uint32_t fold_int(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+uint32_t fold_float(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	return (bits << 1) | (bits >> 31);
+}
+
+/* Write 32 bit values big endian with their bytes interleaved */
+void write_interleaved(uint8_t *ptr, uint32_t *values, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i) {
+		for (uint32_t j = 0; j < 4; ++j) {
+			ptr[i + (size_t)j*count] = (values[i] >> (24 - 8*j)) & 0xFF;
+		}
+	}
+}
+
+void write_u32(uint8_t **ptr, uint32_t value) {
+	memcpy(*ptr, &value, 4);
+	*ptr += 4;
+}
+
+void write_name(uint8_t **ptr, const char *name) {
+	write_u32(ptr, (uint32_t)strlen(name));
+	memcpy(*ptr, name, strlen(name));
+	*ptr += strlen(name);
+}
+
+/* Compress and write a record, returns 0 on failure */
+int write_record(FILE *file, const char *tag, uint8_t *data, size_t length) {
+	if (length > MAX_RECORD) {
+		fprintf(stderr, "A %s record is too big, use more classes.\n", tag);
+		return 0;
+	}
+	uint8_t *compressed = (uint8_t*)malloc(LZ4_compressBound((int)length) + 1);
+	if (!compressed) {
+		return 0;
+	}
+	uint32_t header[3];
+	header[0] = (uint32_t)LZ4_compress((char*)data, (char*)compressed, (int)length);
+	header[1] = (uint32_t)length;
+	header[2] = 0;
+	int ok = fwrite(tag, 1, 4, file) == 4 &&
+		fwrite(header, 4, 3, file) == 3 &&
+		fwrite(compressed, 1, header[0], file) == header[0];
+	free(compressed);
+	return ok;
+}
+
+/* Encode the column of one property for the objects of a class */
+uint8_t *encode_column(struct gen_options *options, uint8_t type, uint32_t prop,
+	uint32_t *referent_array, uint32_t count, uint32_t *scratch, uint8_t *ptr)
+{
+	switch (type) {
+	case RBX_TYPE_STRING:
+		for (uint32_t i = 0; i < count; ++i) {
+			uint64_t bits = value_bits(options, prop, referent_array[i]);
+			uint32_t length = options->string_length/2 +
+				(uint32_t)(bits % (options->string_length + 1));
+			write_u32(&ptr, length);
+			for (uint32_t j = 0; j < length; ++j) {
+				bits = mix(bits + j);
+				*(ptr++) = 'a' + bits % 26;
+			}
+		}
+		return ptr;
+	case RBX_TYPE_BOOLEAN:
+		for (uint32_t i = 0; i < count; ++i) {
+			*(ptr++) = value_bits(options, prop, referent_array[i]) & 1;
+		}
+		return ptr;
+	case RBX_TYPE_REAL:
+		for (uint32_t i = 0; i < count; ++i) {
+			double value = (double)(value_bits(options, prop, referent_array[i]) % 1000000) / 64;
+			memcpy(ptr, &value, 8);
+			ptr += 8;
+		}
+		return ptr;
+	case RBX_TYPE_CFRAME:
+		// Mostly axis aligned rotations, the rest full matrices
+		for (uint32_t i = 0; i < count; ++i) {
+			uint64_t bits = value_bits(options, prop, referent_array[i]);
+			if (bits % 8 == 0) {
+				*(ptr++) = 0x0;
+				for (int j = 0; j < 9; ++j) {
+					float value = (float)((bits >> (4*j)) % 2001) / 1000 - 1;
+					memcpy(ptr, &value, 4);
+					ptr += 4;
+				}
+			} else {
+				*(ptr++) = rbx_rotation_ids[(bits >> 8) % RBX_ROTATION_ID_COUNT];
+			}
+		}
+		for (uint32_t axis = 0; axis < 3; ++axis) {
+			for (uint32_t i = 0; i < count; ++i) {
+				uint64_t bits = mix(value_bits(options, prop, referent_array[i]) + axis);
+				scratch[i] = fold_float((float)(bits % 40000) / 8 - 2500);
+			}
+			write_interleaved(ptr, scratch, count);
+			ptr += (size_t)count*4;
+		}
+		return ptr;
+	case RBX_TYPE_REFERENT: {
+		int32_t previous = 0;
+		for (uint32_t i = 0; i < count; ++i) {
+			uint64_t bits = value_bits(options, prop, referent_array[i]);
+			int32_t target = (int32_t)(bits % options->instance_count);
+			if (target == previous) {
+				target = (target + 1) % (int32_t)options->instance_count;
+			}
+			scratch[i] = fold_int(target - previous);
+			previous = target;
+		}
+		write_interleaved(ptr, scratch, count);
+		return ptr + (size_t)count*4;
+	}
+	default: {
+		// Blocks of interleaved 32 bit components
+		uint32_t components = 1;
+		if (type == RBX_TYPE_UDIM2) {
+			components = 4;
+		} else if (type == RBX_TYPE_COLOR3 || type == RBX_TYPE_VECTOR3) {
+			components = 3;
+		} else if (type == RBX_TYPE_VECTOR2) {
+			components = 2;
+		}
+		for (uint32_t c = 0; c < components; ++c) {
+			for (uint32_t i = 0; i < count; ++i) {
+				uint64_t bits = mix(value_bits(options, prop, referent_array[i]) + c);
+				int is_int = type == RBX_TYPE_INT32 || (type == RBX_TYPE_UDIM2 && c >= 2);
+				if (type == RBX_TYPE_BRICKCOLOR) {
+					scratch[i] = 1 + bits % 1032;
+				} else if (type == RBX_TYPE_TOKEN) {
+					scratch[i] = bits % 8;
+				} else if (is_int) {
+					scratch[i] = fold_int((int32_t)(bits % 2001) - 1000);
+				} else if (type == RBX_TYPE_COLOR3) {
+					scratch[i] = fold_float((float)(bits % 256) / 255);
+				} else {
+					scratch[i] = fold_float((float)(bits % 20001) / 16 - 625);
+				}
+			}
+			write_interleaved(ptr, scratch, count);
+			ptr += (size_t)count*4;
+		}
+		return ptr;
+	}
+	}
+}
+
+/******************************************************************************
+ * The file
+ */
+
+/* Type of the j'th property of a class, from the mix */
+uint8_t prop_type(struct gen_options *options, uint32_t class_id, uint32_t j) {
+	size_t mix_length = strlen(options->type_mix);
+	char letter = options->type_mix[(class_id + j) % mix_length];
+	for (size_t i = 0; i < PROP_TYPE_COUNT; ++i) {
+		if (prop_types[i].letter == letter) {
+			return prop_types[i].type;
+		}
+	}
+	return RBX_TYPE_STRING;
+}
+
+const char *type_name(uint8_t type) {
+	for (size_t i = 0; i < PROP_TYPE_COUNT; ++i) {
+		if (prop_types[i].type == type) {
+			return prop_types[i].name;
+		}
+	}
+	return "String";
+}
+
+/* Parent of an object, -1 for the roots of the models */
+int32_t parent_of(struct gen_options *options, uint32_t model_size, uint32_t referent) {
+	uint32_t local = referent % model_size;
+	if (local == 0) {
+		return -1;
+	}
+	return (int32_t)(referent - local + (local - 1) / options->fanout);
+}
+
+int write_place(struct gen_options *options, FILE *file) {
+	uint32_t count = (uint32_t)options->instance_count;
+
+	// Size of one model, a complete tree
+	uint64_t model_size = 0;
+	for (uint64_t level = 1, i = 0; i < options->depth && model_size < count; ++i) {
+		model_size += level;
+		level *= options->fanout;
+	}
+	if (model_size > count) {
+		model_size = count;
+	}
+
+	// Class of each object
+	uint32_t *class_array = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	uint32_t *class_offsets = (uint32_t*)calloc(options->class_count + 1, sizeof(uint32_t));
+	uint64_t *class_totals = (uint64_t*)malloc(sizeof(uint64_t)*options->class_count);
+	uint32_t *referent_array = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	uint32_t *scratch = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	if (!class_array || !class_offsets || !class_totals || !referent_array || !scratch ||
+	    !read_class_weights(options->class_weights, options->class_count, class_totals)) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		// The first class whose running total passes a number below the
+		// total weight
+		uint64_t pick = mix(options->seed ^ mix(i)) % class_totals[options->class_count - 1];
+		uint32_t low = 0, high = options->class_count - 1;
+		while (low < high) {
+			uint32_t middle = low + (high - low) / 2;
+			if (class_totals[middle] > pick) {
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+		class_array[i] = low;
+		++class_offsets[class_array[i] + 1];
+	}
+	free(class_totals);
+	for (uint32_t c = 0; c < options->class_count; ++c) {
+		class_offsets[c + 1] += class_offsets[c];
+	}
+	for (uint32_t i = 0, *next = scratch; i < options->class_count; ++i) {
+		next[i] = class_offsets[i];
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		referent_array[scratch[class_array[i]]++] = i;
+	}
+	free(class_array);
+
+	// Header
+	static const uint8_t magic[16] = {
+		'<', 'r', 'o', 'b', 'l', 'o', 'x', '!', 0x89, 0xFF, 0x0D, 0x0A, 0x1A, 0x0A, 0, 0};
+	uint32_t counts[4] = {options->class_count, count, 0, 0};
+	fwrite(magic, 1, 16, file);
+	fwrite(counts, 4, 4, file);
+
+	// Largest record: a CFrame column of full matrices, or a string column
+	size_t largest = 0;
+	for (uint32_t c = 0; c < options->class_count; ++c) {
+		size_t objects = class_offsets[c + 1] - class_offsets[c];
+		if (objects > largest) {
+			largest = objects;
+		}
+	}
+	size_t per_value = 49;
+	if (per_value < 4 + 2*(size_t)options->string_length) {
+		per_value = 4 + 2*(size_t)options->string_length;
+	}
+	if (largest*per_value + 256 > MAX_RECORD || 8*(size_t)count + 16 > MAX_RECORD) {
+		fprintf(stderr, "Too many instances per class, use more classes.\n");
+		return 0;
+	}
+	uint8_t *record = (uint8_t*)malloc(largest*per_value + 8*(size_t)count + 256);
+	if (!record) {
+		return 0;
+	}
+
+	// INST records
+	for (uint32_t c = 0; c < options->class_count; ++c) {
+		uint32_t *referents = referent_array + class_offsets[c];
+		uint32_t objects = class_offsets[c + 1] - class_offsets[c];
+		char name[32];
+		snprintf(name, sizeof(name), "Class%u", c);
+		uint8_t *ptr = record;
+		write_u32(&ptr, c);
+		write_name(&ptr, name);
+		*(ptr++) = 0;
+		write_u32(&ptr, objects);
+		for (uint32_t i = 0; i < objects; ++i) {
+			scratch[i] = fold_int((int32_t)(referents[i] - (i > 0 ? referents[i - 1] : 0)));
+		}
+		write_interleaved(ptr, scratch, objects);
+		ptr += (size_t)objects*4;
+		if (!write_record(file, "INST", record, ptr - record)) {
+			return 0;
+		}
+	}
+
+	// PROP records, a Name and then the mix of types
+	for (uint32_t c = 0; c < options->class_count; ++c) {
+		uint32_t *referents = referent_array + class_offsets[c];
+		uint32_t objects = class_offsets[c + 1] - class_offsets[c];
+		int named_cframe = 0, named_size = 0;
+		for (uint32_t j = 0; j <= options->prop_count; ++j) {
+			uint8_t type = j == 0 ? RBX_TYPE_STRING : prop_type(options, c, j - 1);
+			char name[32];
+			if (j == 0) {
+				snprintf(name, sizeof(name), "Name");
+			} else if (type == RBX_TYPE_CFRAME && !named_cframe) {
+				snprintf(name, sizeof(name), "CFrame");
+				named_cframe = 1;
+			} else if (type == RBX_TYPE_VECTOR3 && !named_size) {
+				snprintf(name, sizeof(name), "Size");
+				named_size = 1;
+			} else {
+				snprintf(name, sizeof(name), "%s%u", type_name(type), j);
+			}
+
+			uint8_t *ptr = record;
+			write_u32(&ptr, c);
+			write_name(&ptr, name);
+			*(ptr++) = type;
+			ptr = encode_column(options, type, c*256 + j, referents, objects, scratch, ptr);
+			if (!write_record(file, "PROP", record, ptr - record)) {
+				return 0;
+			}
+		}
+	}
+
+	// PRNT record
+	uint8_t *ptr = record;
+	*(ptr++) = 0;
+	write_u32(&ptr, count);
+	for (uint32_t i = 0; i < count; ++i) {
+		scratch[i] = fold_int(i > 0 ? 1 : 0);
+	}
+	write_interleaved(ptr, scratch, count);
+	ptr += (size_t)count*4;
+	int32_t previous = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		int32_t parent = parent_of(options, (uint32_t)model_size, i);
+		scratch[i] = fold_int(parent - previous);
+		previous = parent;
+	}
+	write_interleaved(ptr, scratch, count);
+	ptr += (size_t)count*4;
+	if (!write_record(file, "PRNT", record, ptr - record)) {
+		return 0;
+	}
+
+	// END record, stored uncompressed
+	uint32_t end_header[3] = {0, 9, 0};
+	fwrite("END\0", 1, 4, file);
+	fwrite(end_header, 4, 3, file);
+	fwrite("</roblox>", 1, 9, file);
+
+	free(record);
+	free(referent_array);
+	free(class_offsets);
+	free(scratch);
+	return !ferror(file);
+}
+
+void usage(void) {
+	fprintf(stderr,
+		"Usage: datagen [options]\n"
+		" -n#   : instances (default 100000)\n"
+		" -c#   : classes (default 8)\n"
+		" -wW,W : class weights, classes past the end of the list weigh as\n"
+		"         much as the last one (default all equal)\n"
+		" -p#   : properties per class besides Name (default 8)\n"
+		" -tMIX : property type mix, one letter per type, properties take the\n"
+		"         letters in turn (default sbifrukc2vxto)\n"
+		"         s String, b Boolean, i Int32, f Float, r Real, u UDim2,\n"
+		"         k BrickColor, c Color3, 2 Vector2, v Vector3, x CFrame,\n"
+		"         t Token, o Referent\n"
+		" -d#   : model depth (default 4)\n"
+		" -f#   : model fan-out (default 4)\n"
+		" -l#   : mean string length (default 16)\n"
+		" -e#   : entropy, percent of random values (default 50)\n"
+		" -s#   : seed (default 0)\n"
+		" -oFILE: output file (default stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+	struct gen_options options;
+	options.instance_count = 100000;
+	options.class_count = 8;
+	options.class_weights = NULL;
+	options.prop_count = 8;
+	options.type_mix = "sbifrukc2vxto";
+	options.depth = 4;
+	options.fanout = 4;
+	options.string_length = 16;
+	options.entropy = 50;
+	options.seed = 0;
+	options.output = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (arg[0] != '-' || arg[1] == '\0') {
+			usage();
+			return EXIT_FAILURE;
+		}
+		// The value can be attached, -n1000, or the next argument, -n 1000
+		const char *value = arg + 2;
+		if (*value == '\0' && i + 1 < argc) {
+			value = argv[++i];
+		}
+		switch (arg[1]) {
+		case 'n': options.instance_count = strtoull(value, NULL, 10); break;
+		case 'c': options.class_count = (uint32_t)strtoul(value, NULL, 10); break;
+		case 'w': options.class_weights = value; break;
+		case 'p': options.prop_count = (uint32_t)strtoul(value, NULL, 10); break;
+		case 't': options.type_mix = value; break;
+		case 'd': options.depth = (uint32_t)strtoul(value, NULL, 10); break;
+		case 'f': options.fanout = (uint32_t)strtoul(value, NULL, 10); break;
+		case 'l': options.string_length = (uint32_t)strtoul(value, NULL, 10); break;
+		case 'e': options.entropy = (uint32_t)strtoul(value, NULL, 10); break;
+		case 's': options.seed = strtoull(value, NULL, 10); break;
+		case 'o': options.output = value; break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (options.instance_count < 1 || options.instance_count > INT32_MAX ||
+		options.class_count < 1 || options.prop_count > 255 ||
+		options.depth < 1 || options.fanout < 1 || options.entropy > 100 ||
+		options.type_mix[0] == '\0')
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+	uint64_t *class_totals = (uint64_t*)malloc(sizeof(uint64_t)*options.class_count);
+	int weights_ok = class_totals &&
+		read_class_weights(options.class_weights, options.class_count, class_totals);
+	free(class_totals);
+	if (!weights_ok) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	FILE *file = options.output ? fopen(options.output, "wb") : stdout;
+	if (!file) {
+		fprintf(stderr, "Couldn't open %s\n", options.output);
+		return EXIT_FAILURE;
+	}
+	int ok = write_place(&options, file);
+	if (options.output) {
+		fclose(file);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
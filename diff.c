@@ -0,0 +1,698 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "parallel.h"
+#include "xxhash.h"
+
+/* Objects hashed per parallel work item */
+#define HASH_BLOCK 4096
+
+/* Objects per parallel work item of a level of the subtree hashing */
+#define SUBTREE_BLOCK 1024
+
+/* Mix the bits of a 64 bit value (splitmix64 finalizer) */
+uint64_t mix64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Is a property the synthetic Parent property added by read_rbx_file */
+int is_parent_prop(struct rbx_object_prop *prop) {
+	return prop->value_type == RBX_TYPE_OBJECT &&
+	       0 == strcmp("Parent", (char*)prop->name.data);
+}
+
+/* Hash a single value, object references hash as the entry of ref_array
+ * for the object they refer to. */
+uint64_t hash_value(uint8_t type, struct rbx_value *value, uint64_t *ref_array) {
+	if (value == NULL) {
+		return 0x1;
+	}
+	switch (type) {
+	case RBX_TYPE_STRING:
+		return XXH64(value->string_value.data, value->string_value.length, type);
+	case RBX_TYPE_BOOLEAN:
+		return XXH64(&value->boolean_value, sizeof(struct rbx_boolean), type);
+	case RBX_TYPE_INT32:
+		return XXH64(&value->int32_value, sizeof(struct rbx_int32), type);
+	case RBX_TYPE_FLOAT:
+		return XXH64(&value->float_value, sizeof(struct rbx_float), type);
+	case RBX_TYPE_REAL:
+		return XXH64(&value->real_value, sizeof(struct rbx_real), type);
+	case RBX_TYPE_UDIM2:
+		return XXH64(&value->udim2_value, sizeof(struct rbx_udim2), type);
+	case RBX_TYPE_RAY:
+		return XXH64(&value->ray_value, sizeof(struct rbx_ray), type);
+	case RBX_TYPE_FACES:
+		return XXH64(&value->faces_value, sizeof(struct rbx_faces), type);
+	case RBX_TYPE_AXIS:
+		return XXH64(&value->axis_value, sizeof(struct rbx_axis), type);
+	case RBX_TYPE_BRICKCOLOR:
+		return XXH64(&value->brickcolor_value, sizeof(struct rbx_brickcolor), type);
+	case RBX_TYPE_COLOR3:
+		return XXH64(&value->color3_value, sizeof(struct rbx_color3), type);
+	case RBX_TYPE_VECTOR2:
+		return XXH64(&value->vector2_value, sizeof(struct rbx_vector2), type);
+	case RBX_TYPE_VECTOR3:
+		return XXH64(&value->vector3_value, sizeof(struct rbx_vector3), type);
+	case RBX_TYPE_CFRAME:
+		return XXH64(&value->cframe_value, sizeof(struct rbx_cframe), type);
+	case RBX_TYPE_TOKEN:
+		return XXH64(&value->token_value, sizeof(struct rbx_token), type);
+	case RBX_TYPE_REFERENT:
+		return XXH64(&value->referent_value, sizeof(struct rbx_referent), type);
+	case RBX_TYPE_OBJECT: {
+		struct rbx_object *object = (struct rbx_object*)value->object_value.data;
+		uint64_t key = object ? ref_array[object->referent] : 0;
+		return XXH64(&key, sizeof(key), type);
+	}
+	default:
+		return 0x2;
+	}
+}
+
+/* Sibling sort record for numbering siblings that share a name */
+struct sibling_key {
+	uint64_t hash;
+	uint32_t position;
+};
+
+int compare_siblings(const void *a, const void *b) {
+	const struct sibling_key *x = (const struct sibling_key*)a;
+	const struct sibling_key *y = (const struct sibling_key*)b;
+	if (x->hash != y->hash) {
+		return x->hash < y->hash ? -1 : 1;
+	}
+	return x->position < y->position ? -1 : (x->position > y->position);
+}
+
+/* Compute the keys of a group of siblings from their parent's key */
+void key_children(struct rbx_object **children, uint32_t count, uint64_t parent_key,
+	struct rbx_string **names, struct rbx_object_hashes *hashes,
+	struct sibling_key *scratch) {
+	for (uint32_t i = 0; i < count; ++i) {
+		struct rbx_object *child = children[i];
+		struct rbx_string *name = names[child->referent];
+		uint64_t name_hash = name ? XXH64(name->data, name->length, 0) : 0;
+		uint64_t class_hash = 
+			mix64(XXH64(child->type->name.data, child->type->name.length, 0));
+		hashes->name_array[child->referent] = name_hash ^ class_hash;
+
+		uint64_t hash = name ? XXH64(name->data, name->length, parent_key) : parent_key;
+		hash ^= class_hash;
+		scratch[i].hash = hash;
+		scratch[i].position = i;
+	}
+
+	// Siblings with the same name and class are told apart by their order
+	qsort(scratch, count, sizeof(struct sibling_key), compare_siblings);
+	uint64_t occurrence = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (i > 0 && scratch[i].hash == scratch[i - 1].hash) {
+			++occurrence;
+		} else {
+			occurrence = 0;
+		}
+		struct rbx_object *child = children[scratch[i].position];
+		hashes->key_array[child->referent] = mix64(scratch[i].hash + occurrence);
+	}
+}
+
+/* Work item for the content hashing: a block of the objects of a type */
+struct hash_block {
+	struct rbx_object_class *type_info;
+	uint32_t begin;
+	uint32_t end;
+};
+
+struct hash_context {
+	struct hash_block *block_array;
+	uint64_t *ref_array;
+	uint64_t *hash_array;
+
+	// Subtree hashing
+	struct rbx_file *file;
+	struct rbx_object **level_array; /* Objects of the level being hashed */
+	uint64_t *class_hash_array;      /* Hash of each type's name */
+	uint64_t *subtree_array;
+};
+
+/* Hash a block of objects a column at a time */
+void hash_blocks(void *context, size_t begin, size_t end) {
+	struct hash_context *ctx = (struct hash_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		struct hash_block *block = &ctx->block_array[i];
+		struct rbx_object_class *type_info = block->type_info;
+		struct rbx_object_prop *prop = type_info->prop_list;
+		for (; prop != NULL; prop = prop->next) {
+			if (is_parent_prop(prop)) {
+				continue;
+			}
+			uint64_t name_hash = XXH64(prop->name.data, prop->name.length, 0);
+			for (uint32_t j = block->begin; j < block->end; ++j) {
+				struct rbx_value value;
+				uint64_t value_hash = hash_value(prop->value_type,
+					rbx_prop_get(prop, j, &value), ctx->ref_array);
+				// Summed so that the order of the properties doesn't matter
+				ctx->hash_array[type_info->object_referent_array[j]] +=
+					mix64(name_hash ^ value_hash);
+			}
+		}
+	}
+}
+
+int compare_hashes(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : (x > y);
+}
+
+/* Subtree hash a block of the objects in a level, their children are in
+ * the level below which is already done. */
+void hash_subtree_block(void *context, size_t begin, size_t end) {
+	struct hash_context *ctx = (struct hash_context*)context;
+	uint64_t *scratch = NULL;
+	uint32_t scratch_size = 0;
+	for (size_t i = begin; i < end; ++i) {
+		struct rbx_object *object = ctx->level_array[i];
+		uint64_t seed = ctx->hash_array[object->referent] ^
+			ctx->class_hash_array[object->type - ctx->file->type_array];
+		if (object->child_count > scratch_size) {
+			uint64_t *grown = (uint64_t*)
+				realloc(scratch, sizeof(uint64_t)*object->child_count);
+			if (!grown) {
+				// Leave the hash as just the object's own content
+				ctx->subtree_array[object->referent] = seed;
+				continue;
+			}
+			scratch = grown;
+			scratch_size = object->child_count;
+		}
+		for (uint32_t j = 0; j < object->child_count; ++j) {
+			scratch[j] = ctx->subtree_array[object->child_array[j]->referent];
+		}
+		if (object->child_count > 1) {
+			qsort(scratch, object->child_count, sizeof(uint64_t), compare_hashes);
+		}
+		ctx->subtree_array[object->referent] =
+			XXH64(scratch, sizeof(uint64_t)*object->child_count, seed);
+	}
+	free(scratch);
+}
+
+/* Compute the subtree hashes, deepest level first */
+int hash_subtrees(struct rbx_file *file, struct hash_context *ctx) {
+	uint32_t count = file->tree_count;
+	uint32_t *depth_array = (uint32_t*)malloc(sizeof(uint32_t)*(file->object_count + 1));
+	struct rbx_object **level_storage =
+		(struct rbx_object**)malloc(sizeof(struct rbx_object*)*(count + 1));
+	uint64_t *class_hash_array = (uint64_t*)malloc(sizeof(uint64_t)*(file->type_count + 1));
+	uint32_t *offsets = NULL;
+	if (!depth_array || !level_storage || !class_hash_array) {
+		free(depth_array);
+		free(level_storage);
+		free(class_hash_array);
+		return 0;
+	}
+
+	// Depth of each object, parents come before children in tree order
+	uint32_t max_depth = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		struct rbx_object *object = file->tree_order[i];
+		uint32_t depth = object->parent ? depth_array[object->parent->referent] + 1 : 0;
+		depth_array[object->referent] = depth;
+		if (depth > max_depth) {
+			max_depth = depth;
+		}
+	}
+
+	// Bucket the objects by depth
+	offsets = (uint32_t*)calloc(max_depth + 2, sizeof(uint32_t));
+	if (!offsets) {
+		free(depth_array);
+		free(level_storage);
+		free(class_hash_array);
+		return 0;
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		++offsets[depth_array[file->tree_order[i]->referent] + 1];
+	}
+	for (uint32_t d = 0; d <= max_depth; ++d) {
+		offsets[d + 1] += offsets[d];
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		struct rbx_object *object = file->tree_order[i];
+		level_storage[offsets[depth_array[object->referent]]++] = object;
+	}
+	// (offsets[d] is now the end of level d, and the start of level d + 1)
+
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_string *name = &file->type_array[i].name;
+		class_hash_array[i] = mix64(XXH64(name->data, name->length, 0));
+	}
+	ctx->file = file;
+	ctx->class_hash_array = class_hash_array;
+
+	for (uint32_t d = max_depth + 1; d-- > 0;) {
+		uint32_t begin = d > 0 ? offsets[d - 1] : 0;
+		ctx->level_array = level_storage + begin;
+		parallel_for(offsets[d] - begin, SUBTREE_BLOCK, hash_subtree_block, ctx);
+	}
+
+	free(depth_array);
+	free(level_storage);
+	free(class_hash_array);
+	free(offsets);
+	return 1;
+}
+
+int hash_objects(struct rbx_file *file, int ref_mode, struct rbx_object_hashes *hashes) {
+	uint32_t count = file->object_count;
+	hashes->key_array = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+	hashes->name_array = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+	hashes->hash_array = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+	hashes->subtree_array = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+	struct rbx_string **names = rbx_collect_names(file);
+	struct sibling_key *scratch =
+		(struct sibling_key*)malloc(sizeof(struct sibling_key)*(count + 1));
+
+	// Work items for the content hashes
+	uint32_t block_count = 0;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		block_count += (file->type_array[i].object_count + HASH_BLOCK - 1) / HASH_BLOCK;
+	}
+	struct hash_block *block_array =
+		(struct hash_block*)malloc(sizeof(struct hash_block)*(block_count + 1));
+
+	if (!hashes->key_array || !hashes->name_array || !hashes->hash_array ||
+	    !hashes->subtree_array || !names || !scratch || !block_array) {
+		free_names(file, names);
+		free(scratch);
+		free(block_array);
+		free_object_hashes(hashes);
+		return 0;
+	}
+
+	// Keys, parents before children
+	key_children(file->root_array, file->root_count, 0, names, hashes, scratch);
+	for (uint32_t i = 0; i < file->tree_count; ++i) {
+		struct rbx_object *object = file->tree_order[i];
+		key_children(object->child_array, object->child_count,
+			hashes->key_array[object->referent], names, hashes, scratch);
+	}
+	free_names(file, names);
+	free(scratch);
+
+	// Content hashes
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type_info = (file->type_array + i);
+		for (uint32_t j = 0; j < type_info->object_count; j += HASH_BLOCK) {
+			block_array[n].type_info = type_info;
+			block_array[n].begin = j;
+			block_array[n].end = j + HASH_BLOCK < type_info->object_count ?
+				j + HASH_BLOCK : type_info->object_count;
+			++n;
+		}
+	}
+	struct hash_context ctx;
+	ctx.block_array = block_array;
+	ctx.ref_array = ref_mode == RBX_HASH_REF_NAME ? hashes->name_array : hashes->key_array;
+	ctx.hash_array = hashes->hash_array;
+	parallel_for(block_count, 1, hash_blocks, &ctx);
+	free(block_array);
+
+	// Then the subtree hashes on top of those
+	ctx.subtree_array = hashes->subtree_array;
+	if (!hash_subtrees(file, &ctx)) {
+		free_object_hashes(hashes);
+		return 0;
+	}
+
+	return 1;
+}
+
+void free_object_hashes(struct rbx_object_hashes *hashes) {
+	free(hashes->key_array);
+	free(hashes->name_array);
+	free(hashes->hash_array);
+	free(hashes->subtree_array);
+	hashes->key_array = NULL;
+	hashes->name_array = NULL;
+	hashes->hash_array = NULL;
+	hashes->subtree_array = NULL;
+}
+
+/* Append an entry to a diff */
+int add_entry(struct rbx_diff *diff, uint8_t change, struct rbx_object *object_a,
+	struct rbx_object *object_b, const char *prop_name) {
+	if (diff->entry_count == diff->entry_capacity) {
+		uint32_t capacity = diff->entry_capacity ? 2*diff->entry_capacity : 64;
+		struct rbx_diff_entry *array = (struct rbx_diff_entry*)
+			realloc(diff->entry_array, sizeof(struct rbx_diff_entry)*capacity);
+		if (!array) {
+			return 0;
+		}
+		diff->entry_array = array;
+		diff->entry_capacity = capacity;
+	}
+	struct rbx_diff_entry *entry = &diff->entry_array[diff->entry_count++];
+	entry->change = change;
+	entry->object_a = object_a;
+	entry->object_b = object_b;
+	entry->prop_name = prop_name;
+	return 1;
+}
+
+/* Find a property of an object by name */
+struct rbx_object_propentry *find_prop_entry(struct rbx_object *object,
+	struct rbx_object_prop *like) {
+	for (uint32_t i = 0; i < object->prop_value_count; ++i) {
+		struct rbx_object_propentry *entry = &object->prop_value_array[i];
+		if (entry->prop->value_type == like->value_type &&
+		    entry->prop->name.length == like->name.length &&
+		    0 == memcmp(entry->prop->name.data, like->name.data, like->name.length)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Add the property level entries for a pair of changed objects */
+int diff_props(struct rbx_diff *diff, struct rbx_object *a, struct rbx_object *b,
+	struct rbx_object_hashes *hashes_a, struct rbx_object_hashes *hashes_b) {
+	for (uint32_t i = 0; i < a->prop_value_count; ++i) {
+		struct rbx_object_propentry *entry_a = &a->prop_value_array[i];
+		if (is_parent_prop(entry_a->prop)) {
+			continue;
+		}
+		const char *name = (const char*)entry_a->prop->name.data;
+		struct rbx_object_propentry *entry_b = find_prop_entry(b, entry_a->prop);
+		if (entry_b == NULL) {
+			if (!add_entry(diff, RBX_DIFF_REMOVED, a, b, name)) {
+				return 0;
+			}
+			continue;
+		}
+		uint8_t type = entry_a->prop->value_type;
+		struct rbx_value value_a, value_b;
+		if (hash_value(type, rbx_entry_get(entry_a, &value_a), hashes_a->key_array) !=
+		    hash_value(type, rbx_entry_get(entry_b, &value_b), hashes_b->key_array)) {
+			if (!add_entry(diff, RBX_DIFF_CHANGED, a, b, name)) {
+				return 0;
+			}
+		}
+	}
+	for (uint32_t i = 0; i < b->prop_value_count; ++i) {
+		struct rbx_object_propentry *entry_b = &b->prop_value_array[i];
+		if (!is_parent_prop(entry_b->prop) && !find_prop_entry(a, entry_b->prop)) {
+			if (!add_entry(diff, RBX_DIFF_ADDED, a, b, (const char*)entry_b->prop->name.data)) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/* Build a key -> object table (open addressing, referent + 1, 0 = empty) */
+uint32_t *build_key_table(struct rbx_file *file, uint64_t *key_array, uint32_t *mask) {
+	uint32_t capacity = 16;
+	while (capacity < 2*(uint64_t)file->object_count) {
+		capacity *= 2;
+	}
+	uint32_t *table = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+	if (!table) {
+		return NULL;
+	}
+	*mask = capacity - 1;
+	for (uint32_t i = 0; i < file->tree_count; ++i) {
+		uint32_t referent = file->tree_order[i]->referent;
+		uint64_t key = key_array[referent];
+		for (uint32_t slot = (uint32_t)key & *mask;; slot = (slot + 1) & *mask) {
+			if (table[slot] == 0) {
+				table[slot] = referent + 1;
+				break;
+			}
+			if (key_array[table[slot] - 1] == key) {
+				break; // Keep the first
+			}
+		}
+	}
+	return table;
+}
+
+struct rbx_diff *rbx_diff(struct rbx_file *file_a, struct rbx_file *file_b) {
+	struct rbx_object_hashes hashes_a, hashes_b;
+	if (!hash_objects(file_a, RBX_HASH_REF_PATH, &hashes_a)) {
+		return NULL;
+	}
+	if (!hash_objects(file_b, RBX_HASH_REF_PATH, &hashes_b)) {
+		free_object_hashes(&hashes_a);
+		return NULL;
+	}
+
+	struct rbx_diff *diff = (struct rbx_diff*)calloc(1, sizeof(struct rbx_diff));
+	uint32_t mask = 0;
+	uint32_t *table = build_key_table(file_b, hashes_b.key_array, &mask);
+	uint8_t *matched_a = (uint8_t*)calloc(file_a->object_count + 1, 1);
+	uint8_t *matched_b = (uint8_t*)calloc(file_b->object_count + 1, 1);
+	int ok = diff && table && matched_a && matched_b;
+
+	// Walk a, finding each object in b
+	for (uint32_t i = 0; ok && i < file_a->tree_count; ++i) {
+		struct rbx_object *a = file_a->tree_order[i];
+		uint64_t key = hashes_a.key_array[a->referent];
+		struct rbx_object *b = NULL;
+		for (uint32_t slot = (uint32_t)key & mask; table[slot]; slot = (slot + 1) & mask) {
+			if (hashes_b.key_array[table[slot] - 1] == key) {
+				b = &file_b->object_array[table[slot] - 1];
+				break;
+			}
+		}
+
+		if (b == NULL) {
+			if (a->parent == NULL || matched_a[a->parent->referent]) {
+				ok = add_entry(diff, RBX_DIFF_REMOVED, a, NULL, NULL);
+			}
+			continue;
+		}
+		matched_a[a->referent] = 1;
+		matched_b[b->referent] = 1;
+		if (hashes_a.subtree_array[a->referent] == hashes_b.subtree_array[b->referent]) {
+			// Identical subtrees, skip over them in both files
+			matched_b[b->referent] = 2;
+			i = a->tree_exit - 1;
+			continue;
+		}
+		if (hashes_a.hash_array[a->referent] != hashes_b.hash_array[b->referent]) {
+			ok = add_entry(diff, RBX_DIFF_CHANGED, a, b, NULL) &&
+			     diff_props(diff, a, b, &hashes_a, &hashes_b);
+		}
+	}
+
+	// Then anything left over in b was added
+	for (uint32_t i = 0; ok && i < file_b->tree_count; ++i) {
+		struct rbx_object *b = file_b->tree_order[i];
+		if (matched_b[b->referent] == 2) {
+			i = b->tree_exit - 1;
+			continue;
+		}
+		if (!matched_b[b->referent] &&
+		    (b->parent == NULL || matched_b[b->parent->referent])) {
+			ok = add_entry(diff, RBX_DIFF_ADDED, NULL, b, NULL);
+		}
+	}
+
+	free(table);
+	free(matched_a);
+	free(matched_b);
+	free_object_hashes(&hashes_a);
+	free_object_hashes(&hashes_b);
+	if (!ok) {
+		free_rbx_diff(diff);
+		return NULL;
+	}
+	return diff;
+}
+
+void free_rbx_diff(struct rbx_diff *diff) {
+	if (diff != NULL) {
+		free(diff->entry_array);
+		free(diff);
+	}
+}
+
+/* Approximate number of bytes a value takes up in a file */
+uint32_t value_size(uint8_t type, struct rbx_value *value) {
+	switch (type) {
+	case RBX_TYPE_STRING:
+		return value ? 4 + (uint32_t)value->string_value.length : 4;
+	case RBX_TYPE_BOOLEAN:
+	case RBX_TYPE_FACES:
+	case RBX_TYPE_AXIS:
+		return 1;
+	case RBX_TYPE_REAL:
+	case RBX_TYPE_VECTOR2:
+		return 8;
+	case RBX_TYPE_COLOR3:
+	case RBX_TYPE_VECTOR3:
+		return 12;
+	case RBX_TYPE_UDIM2:
+		return 16;
+	case RBX_TYPE_RAY:
+		return 24;
+	case RBX_TYPE_CFRAME:
+		return 48;
+	default:
+		return 4;
+	}
+}
+
+/* Sort record for grouping objects by subtree hash */
+struct subtree_key {
+	uint64_t hash;
+	struct rbx_object *object;
+};
+
+int compare_subtrees(const void *a, const void *b) {
+	const struct subtree_key *x = (const struct subtree_key*)a;
+	const struct subtree_key *y = (const struct subtree_key*)b;
+	if (x->hash != y->hash) {
+		return x->hash < y->hash ? -1 : 1;
+	}
+	return x->object->tree_enter < y->object->tree_enter ? -1 :
+	       (x->object->tree_enter > y->object->tree_enter);
+}
+
+int compare_groups(const void *a, const void *b) {
+	const struct rbx_duplicate_group *x = (const struct rbx_duplicate_group*)a;
+	const struct rbx_duplicate_group *y = (const struct rbx_duplicate_group*)b;
+	uint64_t wasted_x = (x->copy_count - 1) * x->byte_count;
+	uint64_t wasted_y = (y->copy_count - 1) * y->byte_count;
+	return wasted_x > wasted_y ? -1 : (wasted_x < wasted_y);
+}
+
+struct rbx_duplicate_report *find_duplicates(struct rbx_file *file) {
+	struct rbx_object_hashes hashes;
+	if (!hash_objects(file, RBX_HASH_REF_NAME, &hashes)) {
+		return NULL;
+	}
+
+	uint32_t count = file->tree_count;
+	struct rbx_duplicate_report *report = (struct rbx_duplicate_report*)
+		calloc(1, sizeof(struct rbx_duplicate_report));
+	uint64_t *bytes_before = (uint64_t*)malloc(sizeof(uint64_t)*(count + 1));
+	struct subtree_key *keys =
+		(struct subtree_key*)malloc(sizeof(struct subtree_key)*(count + 1));
+	uint8_t *duplicated = (uint8_t*)calloc(file->object_count + 1, 1);
+	if (!report || !bytes_before || !keys || !duplicated) {
+		free(report);
+		free(bytes_before);
+		free(keys);
+		free(duplicated);
+		free_object_hashes(&hashes);
+		return NULL;
+	}
+
+	// Bytes before each position in tree order, so that the bytes of a
+	// subtree are a difference of two entries.
+	bytes_before[0] = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		struct rbx_object *object = file->tree_order[i];
+		uint64_t bytes = 0;
+		for (uint32_t j = 0; j < object->prop_value_count; ++j) {
+			struct rbx_object_propentry *entry = &object->prop_value_array[j];
+			if (!is_parent_prop(entry->prop)) {
+				struct rbx_value value;
+				bytes += value_size(entry->prop->value_type, rbx_entry_get(entry, &value));
+			}
+		}
+		bytes_before[i + 1] = bytes_before[i] + bytes;
+	}
+
+	// Group by subtree hash, and mark every object that has a copy
+	for (uint32_t i = 0; i < count; ++i) {
+		keys[i].object = file->tree_order[i];
+		keys[i].hash = hashes.subtree_array[keys[i].object->referent];
+	}
+	qsort(keys, count, sizeof(struct subtree_key), compare_subtrees);
+	uint32_t group_count = 0;
+	uint32_t copy_count = 0;
+	for (uint32_t i = 0, end; i < count; i = end) {
+		for (end = i + 1; end < count && keys[end].hash == keys[i].hash; ++end);
+		if (end - i < 2) {
+			continue;
+		}
+		for (uint32_t j = i; j < end; ++j) {
+			duplicated[keys[j].object->referent] = 1;
+		}
+	}
+
+	// Keep the groups that aren't entirely inside of bigger copies
+	for (uint32_t i = 0, end; i < count; i = end) {
+		int outermost = 0;
+		for (end = i; end < count && keys[end].hash == keys[i].hash; ++end) {
+			struct rbx_object *parent = keys[end].object->parent;
+			outermost |= (parent == NULL || !duplicated[parent->referent]);
+		}
+		if (end - i < 2 || !outermost) {
+			// Mark the run as dropped
+			keys[i].object = NULL;
+			continue;
+		}
+		++group_count;
+		copy_count += end - i;
+	}
+
+	report->group_array = (struct rbx_duplicate_group*)
+		malloc(sizeof(struct rbx_duplicate_group)*(group_count + 1));
+	report->copy_storage = (struct rbx_object**)
+		malloc(sizeof(struct rbx_object*)*(copy_count + 1));
+	if (!report->group_array || !report->copy_storage) {
+		free(bytes_before);
+		free(keys);
+		free(duplicated);
+		free_object_hashes(&hashes);
+		free_duplicate_report(report);
+		return NULL;
+	}
+
+	struct rbx_object **copies = report->copy_storage;
+	for (uint32_t i = 0, end; i < count; i = end) {
+		for (end = i + 1; end < count && keys[end].hash == keys[i].hash; ++end);
+		if (keys[i].object == NULL) {
+			continue;
+		}
+		struct rbx_object *first = keys[i].object;
+		struct rbx_duplicate_group *group = &report->group_array[report->group_count++];
+		group->hash = keys[i].hash;
+		group->copy_count = end - i;
+		group->instance_count = first->tree_exit - first->tree_enter;
+		group->byte_count = bytes_before[first->tree_exit] - bytes_before[first->tree_enter];
+		group->copy_array = copies;
+		for (uint32_t j = i; j < end; ++j) {
+			*(copies++) = keys[j].object;
+		}
+	}
+	qsort(report->group_array, report->group_count,
+		sizeof(struct rbx_duplicate_group), compare_groups);
+
+	free(bytes_before);
+	free(keys);
+	free(duplicated);
+	free_object_hashes(&hashes);
+	return report;
+}
+
+void free_duplicate_report(struct rbx_duplicate_report *report) {
+	if (report != NULL) {
+		free(report->group_array);
+		free(report->copy_storage);
+		free(report);
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rbx_types.h"
+#include "fmt_rbx.h"
+
+/* Structural diff between two files
+ * - Objects are matched by their path: the Name and ClassName of the object
+ *   and each of its ancestors, plus which of its same named siblings it is.
+ * - Each object gets an XXH64 based hash of its property values, computed
+ *   column by column in parallel, so only objects whose hashes differ have
+ *   their properties compared.
+ * - The hierarchy itself isn't compared as a property, a moved object shows
+ *   up as removed from its old path and added at the new one. Object
+ *   references are compared by the path of the object they refer to.
+ */
+
+#define RBX_DIFF_ADDED   0x1
+#define RBX_DIFF_REMOVED 0x2
+#define RBX_DIFF_CHANGED 0x3
+
+/* An added, removed or changed object, or a property of a changed object.
+ * Only the topmost object of an added or removed subtree is listed. */
+struct rbx_diff_entry {
+	uint8_t change;              /* RBX_DIFF_* */
+	struct rbx_object *object_a; /* NULL if the object was added */
+	struct rbx_object *object_b; /* NULL if the object was removed */
+	const char *prop_name;       /* NULL for an entry about the object itself,
+	                                otherwise an entry for the property follows
+	                                the RBX_DIFF_CHANGED entry of its object */
+};
+
+struct rbx_diff {
+	uint32_t entry_count;
+	uint32_t entry_capacity;
+	struct rbx_diff_entry *entry_array;
+};
+
+/* How object references are hashed */
+#define RBX_HASH_REF_PATH 0x0 /* By the key of the object referred to */
+#define RBX_HASH_REF_NAME 0x1 /* By the ClassName and Name of the object
+                                 referred to, so that copies of a model hash
+                                 the same wherever they are */
+
+/* Per object hashes of a file, indexed by referent */
+struct rbx_object_hashes {
+	uint64_t *key_array;     /* Hash of the path to the object */
+	uint64_t *name_array;    /* Hash of the object's ClassName and Name */
+	uint64_t *hash_array;    /* Hash of the object's property values */
+	uint64_t *subtree_array; /* Merkle hash of the object's ClassName, property
+	                            values and the sorted subtree hashes of its
+	                            children */
+};
+
+/* Compute the hashes of the objects in a file, returns 0 on allocation
+ * failure. The subtree hashes are computed bottom up a level of the tree
+ * at a time, in parallel within each level. */
+int hash_objects(struct rbx_file *file, int ref_mode, struct rbx_object_hashes *hashes);
+
+void free_object_hashes(struct rbx_object_hashes *hashes);
+
+/* Diff two files, NULL on allocation failure
+ * - Matched objects with equal subtree hashes are skipped along with all
+ *   of their descendants. */
+struct rbx_diff *rbx_diff(struct rbx_file *file_a, struct rbx_file *file_b);
+
+void free_rbx_diff(struct rbx_diff *diff);
+
+/* Hash a single value, object references hash as the entry of ref_array
+ * for the object they refer to. */
+uint64_t hash_value(uint8_t type, struct rbx_value *value, uint64_t *ref_array);
+
+/* Approximate number of bytes a value takes up in a file */
+uint32_t value_size(uint8_t type, struct rbx_value *value);
+
+/* A set of identical subtrees, copies of the same model */
+struct rbx_duplicate_group {
+	uint64_t hash;
+	uint32_t copy_count;
+	uint32_t instance_count; /* Instances in one copy */
+	uint64_t byte_count;     /* Bytes of property data in one copy */
+	struct rbx_object **copy_array; /* The root of each copy */
+};
+
+struct rbx_duplicate_report {
+	uint32_t group_count;
+	struct rbx_duplicate_group *group_array; /* Most wasted bytes first */
+	struct rbx_object **copy_storage;
+};
+
+/* Find groups of identical subtrees in a file. A group is left out when
+ * every one of its copies sits inside a larger duplicated subtree, so a
+ * model copied many times is reported once rather than once per part of
+ * it. NULL on allocation failure. */
+struct rbx_duplicate_report *find_duplicates(struct rbx_file *file);
+
+void free_duplicate_report(struct rbx_duplicate_report *report);
@@ -1,24 +1,126 @@
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdint.h>
 #include <alloca.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "rbx_types.h"
 #include "fmt_rbx.h"
+#include "trace.h"
 #include "lz4.h"
 
 #define UNUSED(x) (void)(x)
 
 typedef unsigned char uchar;
 
-struct lz4_data {
-	uint8_t *data;
-	size_t length;
+/* Allocate or free through an allocator, malloc and free if it's NULL */
+void *rbx_alloc(const struct rbx_allocator *allocator, size_t size) {
+	if (allocator == NULL) {
+		return malloc(size);
+	}
+	return allocator->alloc(allocator->user, size);
+}
+
+void *rbx_calloc(const struct rbx_allocator *allocator, size_t count, size_t size) {
+	void *ptr = rbx_alloc(allocator, count*size);
+	if (ptr != NULL) {
+		memset(ptr, 0x0, count*size);
+	}
+	return ptr;
+}
+
+void rbx_free(const struct rbx_allocator *allocator, void *ptr) {
+	if (allocator == NULL) {
+		free(ptr);
+	} else if (ptr != NULL) {
+		allocator->free(allocator->user, ptr);
+	}
+}
+
+/* Allocations made while reading, counted into the stats if there are any.
+ * Only the reader's own temporaries are freed during a read, and it knows
+ * their sizes, so the live byte count is exact. */
+void *reader_alloc(struct rbx_reader *reader, size_t size) {
+	void *ptr = rbx_alloc(reader->allocator, size);
+	if (reader->stats != NULL && ptr != NULL) {
+		struct rbx_load_stats *stats = reader->stats;
+		++stats->alloc_count;
+		stats->alloc_bytes += size;
+		reader->live_bytes += size;
+		if (reader->live_bytes > stats->peak_bytes) {
+			stats->peak_bytes = reader->live_bytes;
+		}
+	}
+	return ptr;
+}
+
+void *reader_calloc(struct rbx_reader *reader, size_t count, size_t size) {
+	void *ptr = reader_alloc(reader, count*size);
+	if (ptr != NULL) {
+		memset(ptr, 0x0, count*size);
+	}
+	return ptr;
+}
+
+void reader_free(struct rbx_reader *reader, void *ptr, size_t size) {
+	if (reader->stats != NULL && ptr != NULL) {
+		reader->live_bytes -= size;
+	}
+	rbx_free(reader->allocator, ptr);
+}
+
+double clock_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/* Phase timing, does nothing if we aren't collecting stats */
+struct phase_timer {
+	double wall;
+	double cpu;
 };
 
+void start_timer(struct rbx_reader *reader, struct phase_timer *timer) {
+	if (reader->stats != NULL) {
+		timer->wall = clock_ns(CLOCK_MONOTONIC);
+		timer->cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	}
+}
+
+void stop_timer(struct rbx_reader *reader, struct phase_timer *timer,
+                double *wall_ns, double *cpu_ns) {
+	if (reader->stats != NULL) {
+		*wall_ns += clock_ns(CLOCK_MONOTONIC) - timer->wall;
+		*cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu;
+	}
+}
+
+void stop_phase(struct rbx_reader *reader, struct phase_timer *timer, int phase) {
+	if (reader->stats != NULL) {
+		stop_timer(reader, timer,
+			&reader->stats->wall_ns[phase], &reader->stats->cpu_ns[phase]);
+	}
+}
+
+const char *rbx_phase_name(int phase) {
+	static const char *names[RBX_PHASE_COUNT] = {
+		"header", "INST", "PROP decompress", "PROP decode", "PRNT",
+		"assembly", "parent linking", "hierarchy",
+	};
+	return (phase >= 0 && phase < RBX_PHASE_COUNT) ? names[phase] : "?";
+}
+
 void printbytes(uint8_t *ptr, size_t length) {
 	for (int i = 0; i < length; ++i) {
 		uchar c = ptr[i];
@@ -86,7 +188,8 @@ float read_roblox_float(uint8_t **ptr) {
 	integer = (integer >> 1) | ((integer & 0x00000001) << 31);
 
 	// Reinterpret cast to float
-	float f = *(float*)&integer;
+	float f;
+	memcpy(&f, &integer, sizeof(f));
 
 	return f;
 }
@@ -96,15 +199,17 @@ float read_float32(uint8_t **ptr) {
 	uint32_t integer = read_uint32(ptr);
 
 	// Reinterpret cast
-	return *(float*)&integer;
+	float f;
+	memcpy(&f, &integer, sizeof(f));
+	return f;
 }
 
 /* De-interleave an array of interleaved 32 bit values */
-void unmix_32_array(uint8_t *ptr, size_t length) {
+void unmix_32_array(struct rbx_reader *reader, uint8_t *ptr, size_t length) {
 	unsigned int count = length / 4;
 
 	// Allocate space to write the unmixed elements into
-	uint8_t *tmp = (uint8_t*)malloc(length);
+	uint8_t *tmp = (uint8_t*)reader_alloc(reader, length);
 
 	// De-interleave into the buffer
 	for (int i = 0; i < count; ++i) {
@@ -117,7 +222,7 @@ void unmix_32_array(uint8_t *ptr, size_t length) {
 	memcpy(ptr, tmp, length);
 
 	// Free the buffer
-	free(tmp);
+	reader_free(reader, tmp, length);
 }
 
 /* Read in bytes of padding */
@@ -135,21 +240,21 @@ int read_const(uint8_t **ptr, const char *text) {
 }
 
 /* Free an rbx_string */
-void free_string(struct rbx_string *string) {
+void free_string(const struct rbx_allocator *allocator, struct rbx_string *string) {
 	// string->data may be null, but that's okay
-	free(string->data);
+	rbx_free(allocator, string->data);
 	string->data = NULL;
 }
 
 /* Free a compression record chunk */
-void free_compressed(struct lz4_data *chunk) {
+void free_compressed(struct rbx_reader *reader, struct lz4_data *chunk) {
 	// chunk->data may be NULL but that's okay
-	free(chunk->data);
+	reader_free(reader, chunk->data, chunk->length);
 	chunk->data = NULL;
 }
 
 /* Read in compressed data */
-int read_compressed(uint8_t **ptr, struct lz4_data *output) {
+int read_compressed(struct rbx_reader *reader, uint8_t **ptr, struct lz4_data *output) {
 	// Read in the compression header
 	uint32_t compressed_length = read_uint32(ptr);
 	uint32_t decompressed_length = read_uint32(ptr);
@@ -157,7 +262,7 @@ int read_compressed(uint8_t **ptr, struct lz4_data *output) {
 	assert(padding == 0x0);
 
 	// Try to decompress
-	uint8_t *buffer = (uint8_t*)malloc(decompressed_length);
+	uint8_t *buffer = (uint8_t*)reader_alloc(reader, decompressed_length);
 	int res = LZ4_decompress_safe((char*)(*ptr), (char*)buffer, 
 		compressed_length, decompressed_length);
 
@@ -168,7 +273,7 @@ int read_compressed(uint8_t **ptr, struct lz4_data *output) {
 		// Write out a failure and free the temp buffer
 		output->data = NULL;
 		output->length = 0;
-		free(buffer);
+		reader_free(reader, buffer, decompressed_length);
 
 		return 0;
 	} else {
@@ -181,28 +286,49 @@ int read_compressed(uint8_t **ptr, struct lz4_data *output) {
 }
 
 /* Read in a file record */
-int read_file_record(uint8_t **ptr, const char *tag, struct lz4_data *output) {
+int read_file_record(struct rbx_reader *reader, uint8_t **ptr, const char *tag,
+                     struct lz4_data *output) {
 	// Read / check the tag
 	if (!read_const(ptr, tag)) {
 		return 0;
 	}
 
 	// Decompress the stuff
-	if (!read_compressed(ptr, output)) {
+	uint8_t *start = *ptr;
+	TRACE_BEGIN("decompress", tag);
+	int ok = read_compressed(reader, ptr, output);
+	TRACE_END();
+	if (!ok) {
 		return 0;
 	}
 
+	// Count it under its tag
+	if (reader->stats != NULL) {
+		int record = RBX_RECORD_INST;
+		if (0 == strcmp(tag, "PROP")) {
+			record = RBX_RECORD_PROP;
+		} else if (0 == strcmp(tag, "PRNT")) {
+			record = RBX_RECORD_PRNT;
+		}
+		++reader->stats->record_count[record];
+		reader->stats->compressed_bytes[record] += (*ptr - start) - 12;
+		reader->stats->decompressed_bytes[record] += output->length;
+	}
+
 	return 1;
 }
 
 /* Read a type record */
-int read_type_record(uint8_t **ptr, struct rbx_object_class *type_info) {
+int read_type_record(struct rbx_reader *reader, uint8_t **ptr, struct rbx_object_class *type_info) {
 	// Get the record
 	struct lz4_data record;
-	if (!read_file_record(ptr, "INST", &record)) {
+	uint8_t *start = *ptr;
+	if (!read_file_record(reader, ptr, "INST", &record)) {
 		return 0;
 	}
 	uint8_t *recordptr = record.data;
+	type_info->compressed_bytes = (*ptr - start) - 16;
+	type_info->decompressed_bytes = record.length;
 
 	// Get the type ID and type name
 	uint32_t type_id = read_uint32(&recordptr);
@@ -214,7 +340,7 @@ int read_type_record(uint8_t **ptr, struct rbx_object_class *type_info) {
 	type_info->type_id = type_id;
 
 	// Write out the name
-	type_info->name.data = (uint8_t*)malloc(name_length + 1);
+	type_info->name.data = (uint8_t*)reader_alloc(reader, name_length + 1);
 	memcpy(type_info->name.data, name, name_length);
 	type_info->name.data[name_length] = '\0';
 	type_info->name.length = name_length;
@@ -226,12 +352,12 @@ int read_type_record(uint8_t **ptr, struct rbx_object_class *type_info) {
 	uint32_t instance_count = read_uint32(&recordptr);
 
 	// Unmix the referent array
-	unmix_32_array(recordptr, instance_count*4);
+	unmix_32_array(reader, recordptr, instance_count*4);
 
 	// Prepare the referent array output
 	type_info->object_count = instance_count;
 	type_info->object_referent_array = 
-		(uint32_t*)malloc(sizeof(uint32_t)*instance_count);
+		(uint32_t*)reader_alloc(reader, sizeof(uint32_t)*instance_count);
 
 	// Referent array
 	int32_t referent = 0;
@@ -253,95 +379,165 @@ int read_type_record(uint8_t **ptr, struct rbx_object_class *type_info) {
 	type_info->prop_list = NULL;
 
 	// Free compression record
-	free_compressed(&record);
+	free_compressed(reader, &record);
+
+	return 1;
+}
+
+/* Expand an axis aligned CFrame rotation ID
+ * - The ID is 6*a + b + 1 where a and b are the NormalIds (Right, Top, Back,
+ *   Left, Bottom, Front) of the first and second columns of the matrix, the
+ *   third column is their cross product.
+ */
+void read_rotation_id(uint8_t tag, float *rotation) {
+	static const float normals[6][3] = {
+		{ 1, 0, 0}, {0,  1, 0}, {0, 0,  1},
+		{-1, 0, 0}, {0, -1, 0}, {0, 0, -1},
+	};
+	const float *x = normals[((tag - 1) / 6) % 6];
+	const float *y = normals[(tag - 1) % 6];
+	for (int i = 0; i < 3; ++i) {
+		rotation[i*3 + 0] = x[i];
+		rotation[i*3 + 1] = y[i];
+	}
+	// (Adding 0 turns the -0s from the cross product into 0s)
+	rotation[0*3 + 2] = x[1]*y[2] - x[2]*y[1] + 0.0f;
+	rotation[1*3 + 2] = x[2]*y[0] - x[0]*y[2] + 0.0f;
+	rotation[2*3 + 2] = x[0]*y[1] - x[1]*y[0] + 0.0f;
+}
+
+/* Read in a column of booleans, a byte each, as a bitset. The values are
+ * packed 16 at a time when SSE is available. */
+int read_booleans(struct rbx_reader *reader, struct rbx_object_prop *prop, uint8_t **ptr,
+                  size_t length, uint32_t value_count) {
+	uint32_t count = length < value_count ? length : value_count;
+	size_t words = RBX_SELECTION_WORDS(value_count);
+	uint64_t *bits = (uint64_t*)reader_calloc(reader, words + 1, sizeof(uint64_t));
+	union rbx_slot *slots =
+		(union rbx_slot*)reader_calloc(reader, 2, sizeof(union rbx_slot));
+	if (!bits || !slots) {
+		reader_free(reader, bits, sizeof(uint64_t)*(words + 1));
+		reader_free(reader, slots, sizeof(union rbx_slot)*2);
+		return 0;
+	}
+	uint8_t *data = *ptr;
+	*ptr += count;
+
+	uint32_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 64 <= count; i += 64) {
+		uint64_t word = 0;
+		for (int k = 0; k < 4; ++k) {
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(data + i + 16*k));
+			uint32_t is_zero = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero));
+			word |= (uint64_t)(~is_zero & 0xFFFF) << (16*k);
+		}
+		bits[i/64] = word;
+	}
+#endif
+	for (; i < count; ++i) {
+		bits[i/64] |= (uint64_t)(data[i] != 0) << (i % 64);
+	}
 
+	// Slot 0 is false and slot 1 true, a value's bit is its slot
+	slots[1].boolean_value.data = 1;
+	prop->value_count = count;
+	prop->slot_array = slots;
+	prop->slot_count = 2;
+	prop->encoding = RBX_ENCODING_BITS;
+	prop->bit_array = bits;
+
+	// All one value is stored as a constant
+	uint32_t true_count = rbx_selection_count(bits, count);
+	if (count > 0 && (true_count == 0 || true_count == count)) {
+		slots[0] = slots[true_count != 0];
+		prop->slot_count = 1;
+		prop->encoding = RBX_ENCODING_CONSTANT;
+		prop->bit_array = NULL;
+		reader_free(reader, bits, sizeof(uint64_t)*(words + 1));
+	}
 	return 1;
 }
 
-/* Read in a values of a given property type */
-struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint32_t value_count) {
+/* Read in the values of a property into its slots and pool, the values
+ * are of type prop->value_type. Returns 0 on allocation failure. */
+int read_values(struct rbx_reader *reader, struct rbx_object_prop *prop, uint8_t **ptr,
+                size_t length, uint32_t value_count) {
+	uint8_t type = prop->value_type;
 	uint8_t *after = (*ptr) + length;
 
-	// Allocate space to store the translated values in
-	struct rbx_value **values = (struct rbx_value**)malloc(value_count*sizeof(void*));
-	struct rbx_value **output = values;
-	memset(values, 0x0, value_count*sizeof(void*));
+	prop->value_count = 0;
+	prop->encoding = RBX_ENCODING_PLAIN;
+	prop->slot_count = 0;
+	prop->slot_array = NULL;
+	prop->pool = NULL;
+	prop->string_data = NULL;
+	prop->run_end_array = NULL;
+	prop->code_array = NULL;
+	prop->bit_array = NULL;
+	if (type == RBX_TYPE_BOOLEAN) {
+		return read_booleans(reader, prop, ptr, length, value_count);
+	}
+
+	// Allocate space to store the translated values in, one slot each plus
+	// a pool entry each for the types that don't fit in a slot
+	size_t stride = rbx_pool_stride(type);
+	union rbx_slot *slots =
+		(union rbx_slot*)reader_calloc(reader, value_count + 1, sizeof(union rbx_slot));
+	uint8_t *pool = stride ? (uint8_t*)reader_alloc(reader, stride*(value_count + 1)) : NULL;
+	prop->slot_array = slots;
+	prop->pool = pool;
+	if (!slots || (stride && !pool)) {
+		return 0;
+	}
+	uint32_t count = 0;
 
 	if (type == RBX_TYPE_STRING) {
+		// The characters of every string go in one block. Each string has a
+		// 4 byte length in the record, which leaves room for its terminator.
+		uint8_t *str_storage = (uint8_t*)reader_alloc(reader, length + 1);
+		if (!str_storage) {
+			return 0;
+		}
+		prop->string_data = str_storage;
+		struct rbx_string *strings = (struct rbx_string*)pool;
+
 		// Read list of strings
-		while (*ptr < after) {
+		while (*ptr < after && count < value_count) {
 			// Read a string
 			size_t length = read_uint32(ptr);
 			uint8_t *data = *ptr;
 			*ptr += length;
 
-			// Write into a value
-			// (Allocate space for both the value and the string data in the same
-			//  memory chunk, that way the string value can be freed with a
-			//  single free call rather than requiring multiple ones.)
-			struct rbx_value *value = 
-				(struct rbx_value*)malloc(sizeof(struct rbx_value) + length + 1);
-			uint8_t *str_storage = (uint8_t*)(value + 1);
-
-			// Copy the string data into the chunk and null terminate it
+			// Copy the string data into the block and null terminate it
 			memcpy(str_storage, data, length);
 			str_storage[length] = '\0';
 
-			// Write to the chunk fields
-			value->type = RBX_TYPE_STRING;
-			value->string_value.data = str_storage;
-			value->string_value.length = length;
-
-			// Store back
-			*(output++) = value;
-		}
-	} else if (type == RBX_TYPE_BOOLEAN) {
-		// Array of booleans
-		while (*ptr < after) {
-			// Read the bool
-			uint8_t bvalue = read_uint8(ptr);
-
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_BOOLEAN;
-			value->boolean_value.data = bvalue;
-			*(output++) = value;
+			// Write to the pool
+			strings[count].data = str_storage;
+			strings[count].length = length;
+			slots[count].pool_index = count;
+			str_storage += length + 1;
+			++count;
 		}
 	} else if (type == RBX_TYPE_INT32) {
 		// Integer values
-		unmix_32_array(*ptr, length);
-		for (int i = 0; i < value_count; ++i) {
-			int32_t ivalue = read_folded_int(ptr);
-			
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_INT32;
-			value->int32_value.data = ivalue;
-			*(output++) = value;
+		unmix_32_array(reader, *ptr, length);
+		for (; count < value_count; ++count) {
+			slots[count].int32_value.data = read_folded_int(ptr);
 		}
 	} else if (type == RBX_TYPE_FLOAT) {
 		// Float values
-		unmix_32_array(*ptr, length);
-		for (int i = 0; i < value_count; ++i) {
-			float fvalue = read_roblox_float(ptr);
-			
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_FLOAT;
-			value->float_value.data = fvalue;
-			*(output++) = value;
+		unmix_32_array(reader, *ptr, length);
+		for (; count < value_count; ++count) {
+			slots[count].float_value.data = read_roblox_float(ptr);
 		}
 	} else if (type == RBX_TYPE_REAL) {
 		// Lua_Number values
-		for (int i = 0; i < value_count; ++i) {
+		for (; count < value_count; ++count) {
 			uint64_t ivalue = read_uint64(ptr);
-			double d = *(double*)&ivalue;
-			
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_REAL;
-			value->real_value.data = d;
-			*(output++) = value;
+			memcpy(&slots[count].real_value.data, &ivalue, sizeof(double));
 		}
 	} else if (type == 0x6) {
 		// Vector2int16, format unknown
@@ -357,26 +553,19 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 		*ptr += length;
 
 		// Unmix the arrays for each of the components
-		unmix_32_array(scalexptr, block_length);
-		unmix_32_array(scaleyptr, block_length);
-		unmix_32_array(offsetxptr, block_length);
-		unmix_32_array(offsetyptr, block_length);
+		unmix_32_array(reader, scalexptr, block_length);
+		unmix_32_array(reader, scaleyptr, block_length);
+		unmix_32_array(reader, offsetxptr, block_length);
+		unmix_32_array(reader, offsetyptr, block_length);
 
 		// Get the values
-		for (int i = 0; i < value_count; ++i) {
-			float scalex = read_roblox_float(&scalexptr);
-			float scaley = read_roblox_float(&scaleyptr);
-			int32_t offsetx = read_folded_int(&offsetxptr);
-			int32_t offsety = read_folded_int(&offsetyptr);
-			
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_UDIM2;
-			value->udim2_value.x.scale = scalex;
-			value->udim2_value.x.offset = offsetx;
-			value->udim2_value.y.scale = scaley;
-			value->udim2_value.y.offset = offsety;
-			*(output++) = value;
+		struct rbx_udim2 *udims = (struct rbx_udim2*)pool;
+		for (; count < value_count; ++count) {
+			udims[count].x.scale = read_roblox_float(&scalexptr);
+			udims[count].y.scale = read_roblox_float(&scaleyptr);
+			udims[count].x.offset = read_folded_int(&offsetxptr);
+			udims[count].y.offset = read_folded_int(&offsetyptr);
+			slots[count].pool_index = count;
 		}
 	} else if (type == RBX_TYPE_RAY) {
 		// Ray value
@@ -389,15 +578,9 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 		// TODO:
 	} else if (type == RBX_TYPE_BRICKCOLOR) {
 		// BrickColor
-		unmix_32_array(*ptr, length);
-		for (int i = 0; i < value_count; ++i) {
-			uint32_t color_code = reverse_endianness(read_uint32(ptr));
-
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_BRICKCOLOR;
-			value->brickcolor_value.data = color_code;
-			*(output++) = value;
+		unmix_32_array(reader, *ptr, length);
+		for (; count < value_count; ++count) {
+			slots[count].brickcolor_value.data = reverse_endianness(read_uint32(ptr));
 		}
 	} else if (type == RBX_TYPE_COLOR3) {
 		// Color3
@@ -410,23 +593,17 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 		*ptr += length;
 
 		// Unmix
-		unmix_32_array(rptr, block_length);
-		unmix_32_array(gptr, block_length);
-		unmix_32_array(bptr, block_length);
+		unmix_32_array(reader, rptr, block_length);
+		unmix_32_array(reader, gptr, block_length);
+		unmix_32_array(reader, bptr, block_length);
 
 		// Read
-		for (int i = 0; i < value_count; ++i) {
-			float r = read_roblox_float(&rptr);
-			float g = read_roblox_float(&gptr);
-			float b = read_roblox_float(&bptr);
-
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_COLOR3;
-			value->color3_value.r = r;
-			value->color3_value.g = g;
-			value->color3_value.b = b;
-			*(output++) = value;			
+		struct rbx_color3 *colors = (struct rbx_color3*)pool;
+		for (; count < value_count; ++count) {
+			colors[count].r = read_roblox_float(&rptr);
+			colors[count].g = read_roblox_float(&gptr);
+			colors[count].b = read_roblox_float(&bptr);
+			slots[count].pool_index = count;
 		}
 
 	} else if (type == RBX_TYPE_VECTOR2) {
@@ -438,20 +615,13 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 		uint8_t *y_ptr = *ptr + 1*block_length;
 
 		// Unmix
-		unmix_32_array(x_ptr, block_length);
-		unmix_32_array(y_ptr, block_length);
+		unmix_32_array(reader, x_ptr, block_length);
+		unmix_32_array(reader, y_ptr, block_length);
 
 		// Read
-		for (int i = 0; i < value_count; ++i) {
-			float x = read_roblox_float(&x_ptr);
-			float y = read_roblox_float(&y_ptr);
-
-			// Create value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_VECTOR2;
-			value->vector2_value.x = x;
-			value->vector2_value.y = y;
-			*(output++) = value;	
+		for (; count < value_count; ++count) {
+			slots[count].vector2_value.x = read_roblox_float(&x_ptr);
+			slots[count].vector2_value.y = read_roblox_float(&y_ptr);
 		}
 
 	} else if (type == RBX_TYPE_VECTOR3) {
@@ -464,23 +634,17 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 		uint8_t *z_ptr = *ptr + 2*block_length;
 
 		// Unmix
-		unmix_32_array(x_ptr, block_length);
-		unmix_32_array(y_ptr, block_length);
-		unmix_32_array(z_ptr, block_length);
+		unmix_32_array(reader, x_ptr, block_length);
+		unmix_32_array(reader, y_ptr, block_length);
+		unmix_32_array(reader, z_ptr, block_length);
 
 		// Read
-		for (int i = 0; i < value_count; ++i) {
-			float x = read_roblox_float(&x_ptr);
-			float y = read_roblox_float(&y_ptr);
-			float z = read_roblox_float(&z_ptr);
-
-			// Create value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_VECTOR3;
-			value->vector3_value.x = x;
-			value->vector3_value.y = y;
-			value->vector3_value.z = z;
-			*(output++) = value;	
+		struct rbx_vector3 *vectors = (struct rbx_vector3*)pool;
+		for (; count < value_count; ++count) {
+			vectors[count].x = read_roblox_float(&x_ptr);
+			vectors[count].y = read_roblox_float(&y_ptr);
+			vectors[count].z = read_roblox_float(&z_ptr);
+			slots[count].pool_index = count;
 		}
 
 	} else if (type == 0xF) {
@@ -493,63 +657,51 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 		uint8_t *x_ptr = pos_ptr + 0*value_count;
 		uint8_t *y_ptr = pos_ptr + 4*value_count;
 		uint8_t *z_ptr = pos_ptr + 8*value_count;
-		unmix_32_array(x_ptr, value_count*4);
-		unmix_32_array(y_ptr, value_count*4);
-		unmix_32_array(z_ptr, value_count*4);
+		unmix_32_array(reader, x_ptr, value_count*4);
+		unmix_32_array(reader, y_ptr, value_count*4);
+		unmix_32_array(reader, z_ptr, value_count*4);
 
 		// Loop over main data
-		for (int i = 0; i < value_count; ++i) {
+		struct rbx_cframe *cframes = (struct rbx_cframe*)pool;
+		for (; count < value_count; ++count) {
 			uint8_t tag = read_uint8(ptr);
-
-			// Create value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_CFRAME;
-			*(output++) = value;				
+			struct rbx_cframe *cframe = &cframes[count];
+			slots[count].pool_index = count;
 
 			// Rotation part
 			if (tag == 0x0) {
 				// Whole rotation matrix
 				for (int j = 0; j < 9; ++j) {
-					value->cframe_value.rotation[j] = read_float32(ptr);
+					cframe->rotation[j] = read_float32(ptr);
 				}
 			} else if (tag == 0x1) {
 				assert(0); // Unknown tag
 			} else if (tag >= 0x2 && tag <= 0x23) {
-				// Read special combinations
-				// TODO: Implement
-				for (int j = 0; j < 9; ++j) {
-					value->cframe_value.rotation[j] = 0;
-				}
+				// Axis aligned rotation
+				read_rotation_id(tag, cframe->rotation);
 			} else {
 				assert(0); // Unknown tag
 			}
 
 			// Position part
-			value->cframe_value.position.x = read_roblox_float(&x_ptr);
-			value->cframe_value.position.y = read_roblox_float(&y_ptr);
-			value->cframe_value.position.z = read_roblox_float(&z_ptr);
+			cframe->position.x = read_roblox_float(&x_ptr);
+			cframe->position.y = read_roblox_float(&y_ptr);
+			cframe->position.z = read_roblox_float(&z_ptr);
 		}
 	} else if (type == 0x11) {
 		// ???
 	} else if (type == RBX_TYPE_TOKEN) {
 		// Token
-		unmix_32_array(*ptr, length);
-
-		for (int i = 0; i < value_count; ++i) {
-			uint32_t tvalue = reverse_endianness(read_uint32(ptr));
-
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_TOKEN;
-			value->token_value.data = tvalue;
-			*(output++) = value;		
+		unmix_32_array(reader, *ptr, length);
+		for (; count < value_count; ++count) {
+			slots[count].token_value.data = reverse_endianness(read_uint32(ptr));
 		}
 	} else if (type == RBX_TYPE_REFERENT) {
 		// Referent
-		unmix_32_array(*ptr, length);
+		unmix_32_array(reader, *ptr, length);
 
 		int32_t rvalue = 0;
-		for (int i = 0; i < value_count; ++i) {
+		for (; count < value_count; ++count) {
 			int32_t my_value;
 			int32_t diff = read_folded_int(ptr);
 			if (diff != 0) {
@@ -558,27 +710,270 @@ struct rbx_value **read_values(uint8_t type, uint8_t **ptr, size_t length, uint3
 			} else {
 				my_value = 0;
 			}
-
-			// Create the value
-			struct rbx_value *value = malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_REFERENT;
-			value->referent_value.data = my_value;
-			*(output++) = value;	
+			slots[count].referent_value.data = my_value;
 		}
 	} else {
 		// ??
 	}
 
-	return values;
+	prop->value_count = count;
+	return encode_values(reader, prop, value_count + 1,
+		type == RBX_TYPE_STRING ? length + 1 : 0);
+}
+
+/* Columns shorter than this are left plain */
+#define ENCODE_MIN_VALUES 16
+
+/* Runs aren't looked for past this many values if they average shorter
+ * than ENCODE_MIN_RUN_LENGTH so far */
+#define ENCODE_RUN_SAMPLE     1024
+#define ENCODE_MIN_RUN_LENGTH 4
+
+/* String columns averaging more bytes a value than this, mostly script
+ * sources, don't get a dictionary */
+#define ENCODE_MAX_STRING_BYTES 64
+
+/* Bytes hashed from each end of a string */
+#define ENCODE_HASH_BYTES 16
+
+/* Whether two values of a plain column are the same, bit for bit */
+int same_value(struct rbx_object_prop *prop, uint32_t a, uint32_t b) {
+	union rbx_slot *slots = prop->slot_array;
+	size_t stride = rbx_pool_stride(prop->value_type);
+	if (stride == 0) {
+		return slots[a].bits == slots[b].bits;
+	}
+	uint8_t *x = (uint8_t*)prop->pool + stride*slots[a].pool_index;
+	uint8_t *y = (uint8_t*)prop->pool + stride*slots[b].pool_index;
+	if (prop->value_type == RBX_TYPE_STRING) {
+		struct rbx_string *s = (struct rbx_string*)x;
+		struct rbx_string *t = (struct rbx_string*)y;
+		return s->length == t->length && memcmp(s->data, t->data, s->length) == 0;
+	}
+	return memcmp(x, y, stride) == 0;
+}
+
+/* Hash of a fixed width value */
+uint32_t hash_bits(uint64_t bits) {
+	return (uint32_t)((bits*0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/* Hash bytes into a hash, 8 at a time */
+uint32_t hash_bytes(uint32_t hash, const uint8_t *data, size_t length) {
+	uint64_t h = hash;
+	for (; length > 0; data += 8, length -= length < 8 ? length : 8) {
+		uint64_t word = 0;
+		memcpy(&word, data, length < 8 ? length : 8);
+		h = (h ^ word)*0x9E3779B97F4A7C15ull;
+		h ^= h >> 29;
+	}
+	return (uint32_t)(h >> 32);
+}
+
+/* Hash of a pooled value of a plain column. Strings only hash their length
+ * and ENCODE_HASH_BYTES from each end, so a long one costs no more than a
+ * short one, and strings that only differ in the middle just probe more. */
+uint32_t hash_pooled(struct rbx_object_prop *prop, size_t stride, uint32_t index) {
+	uint8_t *data = (uint8_t*)prop->pool + stride*prop->slot_array[index].pool_index;
+	if (prop->value_type != RBX_TYPE_STRING) {
+		return hash_bytes(0, data, stride);
+	}
+	struct rbx_string *str = (struct rbx_string*)data;
+	uint32_t hash = hash_bits(str->length);
+	if (str->length <= 2*ENCODE_HASH_BYTES) {
+		return hash_bytes(hash, str->data, str->length);
+	}
+	hash = hash_bytes(hash, str->data, ENCODE_HASH_BYTES);
+	return hash_bytes(hash, str->data + str->length - ENCODE_HASH_BYTES, ENCODE_HASH_BYTES);
+}
+
+/* Replace the slots and pool of a plain column with copies of the values
+ * at rep_array, one slot each. capacity and string_bytes are the sizes the
+ * plain column was allocated with. Returns 0 on allocation failure, with
+ * the column left as it was. */
+int store_slots(struct rbx_reader *reader, struct rbx_object_prop *prop, uint32_t *rep_array,
+                uint32_t slot_count, uint32_t capacity, size_t string_bytes) {
+	size_t stride = rbx_pool_stride(prop->value_type);
+	union rbx_slot *slots =
+		(union rbx_slot*)reader_alloc(reader, sizeof(union rbx_slot)*slot_count);
+	uint8_t *pool = stride ? (uint8_t*)reader_alloc(reader, stride*slot_count) : NULL;
+
+	// The distinct strings get a block of their own
+	size_t string_length = 0;
+	uint8_t *string_data = NULL;
+	if (prop->value_type == RBX_TYPE_STRING) {
+		for (uint32_t k = 0; k < slot_count; ++k) {
+			uint32_t index = prop->slot_array[rep_array[k]].pool_index;
+			string_length += ((struct rbx_string*)prop->pool)[index].length + 1;
+		}
+		string_data = (uint8_t*)reader_alloc(reader, string_length);
+	}
+	if (!slots || (stride && !pool) || (string_length && !string_data)) {
+		reader_free(reader, slots, sizeof(union rbx_slot)*slot_count);
+		reader_free(reader, pool, stride*slot_count);
+		reader_free(reader, string_data, string_length);
+		return 0;
+	}
+
+	uint8_t *str_storage = string_data;
+	for (uint32_t k = 0; k < slot_count; ++k) {
+		union rbx_slot *old = &prop->slot_array[rep_array[k]];
+		slots[k] = *old;
+		if (stride != 0) {
+			slots[k].pool_index = k;
+			memcpy(pool + stride*k, (uint8_t*)prop->pool + stride*old->pool_index, stride);
+		}
+		if (string_data != NULL) {
+			struct rbx_string *str = (struct rbx_string*)(pool + stride*k);
+			memcpy(str_storage, str->data, str->length + 1);
+			str->data = str_storage;
+			str_storage += str->length + 1;
+		}
+	}
+
+	reader_free(reader, prop->slot_array, sizeof(union rbx_slot)*capacity);
+	reader_free(reader, prop->pool, stride*capacity);
+	reader_free(reader, prop->string_data, string_bytes);
+	prop->slot_count = slot_count;
+	prop->slot_array = slots;
+	prop->pool = pool;
+	prop->string_data = string_data;
+	return 1;
+}
+
+int encode_values(struct rbx_reader *reader, struct rbx_object_prop *prop,
+                  uint32_t capacity, size_t string_bytes) {
+	uint32_t count = prop->value_count;
+	prop->encoding = RBX_ENCODING_PLAIN;
+	prop->slot_count = count;
+	if (count < ENCODE_MIN_VALUES) {
+		return 1;
+	}
+
+	// Bytes taken up by a slot and by an index into the slots
+	union rbx_slot *slots = prop->slot_array;
+	size_t stride = rbx_pool_stride(prop->value_type);
+	size_t slot_bytes = sizeof(union rbx_slot) + stride;
+	size_t plain_bytes = slot_bytes*count;
+
+	// Count the runs of equal values, giving up once they can't beat plain
+	// or don't look like they will. Values that fit a slot are compared in
+	// place, this runs over every column that is read.
+	uint32_t run_count = 1;
+	uint32_t max_runs = plain_bytes / (slot_bytes + sizeof(uint32_t));
+	for (uint32_t i = 1; i < count && run_count <= max_runs; ++i) {
+		if (stride == 0) {
+			run_count += slots[i - 1].bits != slots[i].bits;
+		} else {
+			run_count += !same_value(prop, i - 1, i);
+		}
+		if (i == ENCODE_RUN_SAMPLE && run_count > i / ENCODE_MIN_RUN_LENGTH) {
+			run_count = max_runs + 1;
+		}
+	}
+	size_t run_bytes = (slot_bytes + sizeof(uint32_t))*run_count;
+
+	// A dictionary can't beat runs that take fewer bytes than its codes,
+	// and isn't worth hashing long strings for
+	int try_dictionary = !(run_count <= max_runs && run_bytes <= count) &&
+		!(prop->value_type == RBX_TYPE_STRING && string_bytes > ENCODE_MAX_STRING_BYTES*(size_t)count);
+
+	// Give each distinct value a code, giving up past RBX_DICTIONARY_SIZE.
+	// The table is a power of two at least twice the most codes there can
+	// be.
+	uint8_t *codes = try_dictionary ? (uint8_t*)reader_alloc(reader, count) : NULL;
+	uint32_t first[RBX_DICTIONARY_SIZE];
+	uint16_t table[2*RBX_DICTIONARY_SIZE]; // Code + 1 of each bucket, 0 if empty
+	uint32_t mask = 2*RBX_DICTIONARY_SIZE - 1;
+	while (mask > 31 && (mask + 1) / 4 >= count) {
+		mask /= 2;
+	}
+	uint32_t distinct_count = 0;
+	memset(table, 0x0, sizeof(uint16_t)*(mask + 1));
+	for (uint32_t i = 0; codes && i < count && distinct_count <= RBX_DICTIONARY_SIZE; ++i) {
+		uint32_t bucket;
+		if (stride == 0) {
+			bucket = hash_bits(slots[i].bits) & mask;
+			while (table[bucket] != 0 && slots[first[table[bucket] - 1]].bits != slots[i].bits) {
+				bucket = (bucket + 1) & mask;
+			}
+		} else {
+			bucket = hash_pooled(prop, stride, i) & mask;
+			while (table[bucket] != 0 && !same_value(prop, first[table[bucket] - 1], i)) {
+				bucket = (bucket + 1) & mask;
+			}
+		}
+		if (table[bucket] == 0) {
+			if (distinct_count == RBX_DICTIONARY_SIZE) {
+				++distinct_count;
+				break;
+			}
+			first[distinct_count++] = i;
+			table[bucket] = distinct_count;
+		}
+		codes[i] = table[bucket] - 1;
+	}
+
+	// Pick the smallest encoding
+	size_t dictionary_bytes = count + slot_bytes*distinct_count;
+	int use_runs = run_count <= max_runs;
+	int use_dictionary = codes && distinct_count <= RBX_DICTIONARY_SIZE &&
+		dictionary_bytes < plain_bytes;
+	if (use_runs && use_dictionary) {
+		use_runs = run_bytes <= dictionary_bytes;
+		use_dictionary = !use_runs;
+	}
+
+	int ok = 1;
+	if (use_runs && run_count == 1) {
+		uint32_t rep = 0;
+		ok = store_slots(reader, prop, &rep, 1, capacity, string_bytes);
+		prop->encoding = ok ? RBX_ENCODING_CONSTANT : RBX_ENCODING_PLAIN;
+	} else if (use_runs) {
+		// The last value of each run stands in for the run
+		uint32_t *run_ends = (uint32_t*)reader_alloc(reader, sizeof(uint32_t)*run_count);
+		uint32_t *reps = (uint32_t*)reader_alloc(reader, sizeof(uint32_t)*run_count);
+		ok = run_ends && reps;
+		if (ok) {
+			for (uint32_t i = 1, k = 0; i <= count; ++i) {
+				if (i == count || !same_value(prop, i - 1, i)) {
+					run_ends[k] = i;
+					reps[k++] = i - 1;
+				}
+			}
+			ok = store_slots(reader, prop, reps, run_count, capacity, string_bytes);
+		}
+		reader_free(reader, reps, sizeof(uint32_t)*run_count);
+		if (ok) {
+			prop->encoding = RBX_ENCODING_RUNS;
+			prop->run_end_array = run_ends;
+		} else {
+			reader_free(reader, run_ends, sizeof(uint32_t)*run_count);
+		}
+	} else if (use_dictionary) {
+		ok = store_slots(reader, prop, first, distinct_count, capacity, string_bytes);
+		if (ok) {
+			prop->encoding = RBX_ENCODING_DICTIONARY;
+			prop->code_array = codes;
+			codes = NULL;
+		}
+	}
+	reader_free(reader, codes, count);
+	return ok;
 }
 
 /* Read a property record */
-int read_prop_record(uint8_t **ptr, struct rbx_object_class *type_array) {
+int read_prop_record(struct rbx_reader *reader, uint8_t **ptr, struct rbx_object_class *type_array) {
 	// Get the record
+	struct phase_timer timer;
+	start_timer(reader, &timer);
 	struct lz4_data record;
-	if (!read_file_record(ptr, "PROP", &record)) {
+	uint8_t *start = *ptr;
+	if (!read_file_record(reader, ptr, "PROP", &record)) {
 		return 0;
 	}
+	stop_phase(reader, &timer, RBX_PHASE_PROP_DECOMPRESS);
+	uint32_t compressed_bytes = (*ptr - start) - 16;
 	uint8_t *recordptr = record.data;
 
 	// Object belonging to
@@ -588,14 +983,23 @@ int read_prop_record(uint8_t **ptr, struct rbx_object_class *type_array) {
 	struct rbx_object_class *parent_type = type_array + type_containing_id;
 	assert(parent_type != NULL);
 	if (parent_type == NULL) {
-		free_compressed(&record);
+		free_compressed(reader, &record);
 		return 0;
 	}
 
 	// Create a property in it
 	struct rbx_object_prop *prop = 
-		(struct rbx_object_prop*)malloc(sizeof(struct rbx_object_prop));
+		(struct rbx_object_prop*)reader_alloc(reader, sizeof(struct rbx_object_prop));
 	prop->parent_type = parent_type;
+	prop->value_count = 0;
+	prop->encoding = RBX_ENCODING_PLAIN;
+	prop->slot_count = 0;
+	prop->slot_array = NULL;
+	prop->pool = NULL;
+	prop->string_data = NULL;
+	prop->run_end_array = NULL;
+	prop->code_array = NULL;
+	prop->bit_array = NULL;
 	++parent_type->prop_count;
 	prop->next = parent_type->prop_list;
 	parent_type->prop_list = prop;
@@ -606,7 +1010,7 @@ int read_prop_record(uint8_t **ptr, struct rbx_object_class *type_array) {
 	recordptr += name_length;
 
 	// Write out the name
-	prop->name.data = (uint8_t*)malloc(name_length + 1);
+	prop->name.data = (uint8_t*)reader_alloc(reader, name_length + 1);
 	prop->name.data[name_length] = '\0';
 	memcpy(prop->name.data, name, name_length);
 	prop->name.length = name_length;
@@ -616,30 +1020,47 @@ int read_prop_record(uint8_t **ptr, struct rbx_object_class *type_array) {
 
 	// Write out the property type
 	prop->value_type = prop_type;
+	prop->compressed_bytes = compressed_bytes;
+	prop->decompressed_bytes = record.length;
+	prop->decode_ns = 0;
 
 	// Read in values
 	uint8_t *after = record.data + record.length;
 	size_t space_left = after - recordptr;
-	prop->value_array =
-		read_values(prop_type, &recordptr, space_left, parent_type->object_count);
+	start_timer(reader, &timer);
+	TRACE_BEGIN("decode column", (char*)prop->name.data);
+	int ok = read_values(reader, prop, &recordptr, space_left, parent_type->object_count);
+	TRACE_END();
+	if (!ok) {
+		free_compressed(reader, &record);
+		return 0;
+	}
+	if (reader->stats != NULL) {
+		struct rbx_load_stats *stats = reader->stats;
+		double wall = 0, cpu = 0;
+		stop_timer(reader, &timer, &wall, &cpu);
+		prop->decode_ns = wall;
+		stats->wall_ns[RBX_PHASE_PROP_DECODE] += wall;
+		stats->cpu_ns[RBX_PHASE_PROP_DECODE] += cpu;
+		stats->decode_wall_ns[prop_type] += wall;
+		stats->decode_cpu_ns[prop_type] += cpu;
+		stats->decode_value_count[prop_type] += parent_type->object_count;
+	}
 
 	// Free the compression record
-	free_compressed(&record);
+	free_compressed(reader, &record);
 
 	return 1;
 }
 
-// Parent records
-struct prnt_record {
-	int32_t object;
-	int32_t parent;
-};
-
-/* Read the PRNT record */
-int read_parent_record(uint8_t **ptr, struct prnt_record *parents) {
+/* Read the PRNT record
+ * - parents must have space for capacity records, the number of records
+ *   actually read is written to count. */
+int read_parent_record(struct rbx_reader *reader, uint8_t **ptr, struct prnt_record *parents,
+                       uint32_t capacity, uint32_t *count) {
 	// Get the record
 	struct lz4_data record;
-	if (!read_file_record(ptr, "PRNT", &record)) {
+	if (!read_file_record(reader, ptr, "PRNT", &record)) {
 		return 0;
 	}
 	uint8_t *recordptr = record.data;
@@ -650,14 +1071,19 @@ int read_parent_record(uint8_t **ptr, struct prnt_record *parents) {
 
 	// Get the object count
 	uint32_t obj_count = read_uint32(&recordptr);
+	if (obj_count > capacity) {
+		free_compressed(reader, &record);
+		return 0;
+	}
+	*count = obj_count;
 
 	size_t block_length = 4*obj_count;
 
 	// Get pointers into data blocks, and unmix the data blocks
 	uint8_t *refarray = recordptr + 0*block_length;
 	uint8_t *pararray = recordptr + 1*block_length;
-	unmix_32_array(refarray, block_length);
-	unmix_32_array(pararray, block_length);
+	unmix_32_array(reader, refarray, block_length);
+	unmix_32_array(reader, pararray, block_length);
 
 	// Read in the object, parent pairs (Stored differentially)
 	int32_t object_ref = 0;
@@ -670,15 +1096,481 @@ int read_parent_record(uint8_t **ptr, struct prnt_record *parents) {
 	}
 
 	// Free the compression record
-	free_compressed(&record);
+	free_compressed(reader, &record);
 	
 	return 1;
 }
 
+/* Link each object to its parent object using the PRNT records */
+void link_parents(struct rbx_object *object_array, uint32_t object_count,
+                  struct prnt_record *parents, uint32_t parent_count) {
+	// Objects without a record are top level objects
+	for (uint32_t i = 0; i < object_count; ++i) {
+		object_array[i].parent = NULL;
+	}
+
+	for (uint32_t i = 0; i < parent_count; ++i) {
+		int32_t object_ref = parents[i].object;
+		int32_t parent_ref = parents[i].parent;
+		if (object_ref < 0 || (uint32_t)object_ref >= object_count) {
+			continue;
+		}
+
+		// -1 => No parent, anything else out of range is treated the same
+		if (parent_ref >= 0 && (uint32_t)parent_ref < object_count) {
+			object_array[object_ref].parent = &object_array[parent_ref];
+		}
+	}
+}
+
+/* Create the objects of a file from its types, with their property values
+ * taken from the columns of the types. Referent values are translated into
+ * object values pointing into the returned array. */
+struct rbx_object *build_objects(struct rbx_reader *reader, struct rbx_object_class *type_array,
+                                 uint32_t type_count, uint32_t object_count) {
+	struct rbx_object *object_array =
+		reader_alloc(reader, sizeof(struct rbx_object)*object_count);
+
+	// For each type
+	for (int i = 0; i < type_count; ++i) {
+		struct rbx_object_class *type_info = (type_array + i);
+
+		// For each object of this type create the object
+		for (uint32_t j = 0; j < type_info->object_count; ++j) {
+			uint32_t referent = type_info->object_referent_array[j];
+
+			// Get and set up the object
+			struct rbx_object *object = (object_array + referent);
+			object->type = type_info;
+			object->referent = referent;
+			object->prop_value_count = type_info->prop_count;
+			// Note, here we make the length of the property value array equal
+			// to the type's prop count + 1, since we are going to add a parent
+			// property later.
+			object->prop_value_array = 
+				(struct rbx_object_propentry*)
+					reader_alloc(reader,
+						sizeof(struct rbx_object_propentry)*(type_info->prop_count + 1));
+
+			// Write in the props
+			struct rbx_object_prop *prop = type_info->prop_list;
+			for (uint32_t k = 0; prop != NULL; prop = prop->next, ++k) {
+				struct rbx_object_propentry *prop_entry = 
+					&object->prop_value_array[k];	
+
+				// Fill in the property entry on this object
+				prop_entry->prop = prop;
+				prop_entry->index = j;
+			}
+		}
+
+		// Referent translation
+		//  Turn referent props into object props with pointers to the
+		//  actual objects. Each slot is translated once, however many
+		//  objects share it.
+		struct rbx_object_prop *prop = type_info->prop_list;
+		for (; prop != NULL; prop = prop->next) {
+			if (prop->value_type != RBX_TYPE_REFERENT) {
+				continue;
+			}
+			for (uint32_t k = 0; k < prop->slot_count; ++k) {
+				// Translate the thing that it's referring to
+				union rbx_slot *slot = &prop->slot_array[k];
+				int32_t other_referent = slot->referent_value.data;
+				if (other_referent == -1) {
+					// -1 => No object
+					slot->object_value.data = NULL;
+				} else {
+					// Otherwise, translate object
+					slot->object_value.data = &object_array[other_referent];
+				}
+			}
+			prop->value_type = RBX_TYPE_OBJECT;
+		}
+	}
+
+	return object_array;
+}
+
+/* Add a Parent property to each type, after the other properties of its
+ * objects, holding the parents set up by link_parents. */
+void add_parent_props(struct rbx_reader *reader, struct rbx_object_class *type_array,
+                      uint32_t type_count, struct rbx_object *object_array) {
+	// For each type, we should add a parent property to it
+	for (int i = 0; i < type_count; ++i) {
+		struct rbx_object_class *type_info = (type_array + i);
+
+		// Create parent property
+		struct rbx_object_prop *parent_prop =
+			reader_alloc(reader, sizeof(struct rbx_object_prop));
+		parent_prop->value_type = RBX_TYPE_OBJECT;
+		parent_prop->parent_type = type_info;
+		parent_prop->compressed_bytes = 0;
+		parent_prop->decompressed_bytes = 0;
+		parent_prop->decode_ns = 0;
+		parent_prop->value_count = type_info->object_count;
+		parent_prop->encoding = RBX_ENCODING_PLAIN;
+		parent_prop->slot_count = type_info->object_count;
+		parent_prop->slot_array = (union rbx_slot*)
+			reader_alloc(reader, sizeof(union rbx_slot)*(type_info->object_count + 1));
+		parent_prop->pool = NULL;
+		parent_prop->string_data = NULL;
+		parent_prop->run_end_array = NULL;
+		parent_prop->code_array = NULL;
+		parent_prop->bit_array = NULL;
+
+		// Name
+		static const char *parent_name = "Parent";
+		parent_prop->name.data = (uint8_t*)reader_alloc(reader, strlen(parent_name) + 1);
+		memcpy(parent_prop->name.data, parent_name, strlen(parent_name));
+		parent_prop->name.data[strlen(parent_name)] = '\0';
+		parent_prop->name.length = strlen(parent_name);
+
+		// Add to list
+		parent_prop->next = type_info->prop_list;
+		type_info->prop_list = parent_prop;
+
+		// For each object, add the parent prop
+		for (uint32_t j = 0; j < type_info->object_count; ++j) {
+			int32_t referent = type_info->object_referent_array[j];
+			struct rbx_object *object = (object_array + referent);
+
+			// Add parent prop to count
+			++object->prop_value_count;
+
+			// Write the value
+			parent_prop->slot_array[j].object_value.data = object->parent;
+
+			// Set up the last property as the parent property
+			// (Note: We have one extra space allocated after the
+			//        normal prop_value_array for this property)
+			struct rbx_object_propentry *entry = 
+				(object->prop_value_array + type_info->prop_count);
+			entry->prop = parent_prop;
+			entry->index = j;
+		}
+
+		// Siblings are mostly stored together, so parents come in runs. If
+		// there isn't memory to encode them the column stays plain.
+		encode_values(reader, parent_prop, type_info->object_count + 1, 0);
+
+		// Increment the prop count on the type
+		++type_info->prop_count;
+	}
+}
+
+/* Build the child index and depth first order of the objects in a file
+ * - The children are bucketed by parent with a counting sort, which keeps
+ *   them in the order of the PRNT records within each parent.
+ * - Slot 0 of the offsets is used for the top level objects.
+ */
+int build_hierarchy(struct rbx_reader *reader, struct rbx_file *file) {
+	uint32_t object_count = file->object_count;
+	struct rbx_object *object_array = file->object_array;
+
+	size_t offsets_size = sizeof(uint32_t)*(object_count + 2);
+	size_t array_size = sizeof(struct rbx_object*)*object_count;
+	size_t cursors_size = sizeof(uint32_t)*object_count;
+	uint32_t *offsets = (uint32_t*)reader_calloc(reader, object_count + 2, sizeof(uint32_t));
+	struct rbx_object **child_index = (struct rbx_object**)reader_alloc(reader, array_size);
+	struct rbx_object **tree_order = (struct rbx_object**)reader_alloc(reader, array_size);
+	struct rbx_object **stack = (struct rbx_object**)reader_alloc(reader, array_size);
+	uint32_t *cursors = (uint32_t*)reader_alloc(reader, cursors_size);
+	if (!offsets || (object_count && 
+	    (!child_index || !tree_order || !stack || !cursors))) {
+		reader_free(reader, offsets, offsets_size);
+		reader_free(reader, child_index, array_size);
+		reader_free(reader, tree_order, array_size);
+		reader_free(reader, stack, array_size);
+		reader_free(reader, cursors, cursors_size);
+		return 0;
+	}
+
+	// Count the children of each parent (slot = parent referent + 1)
+	for (uint32_t i = 0; i < object_count; ++i) {
+		struct rbx_object *parent = object_array[i].parent;
+		uint32_t slot = parent ? (uint32_t)(parent - object_array) + 1 : 0;
+		++offsets[slot + 1];
+	}
+
+	// Prefix sum into start offsets
+	for (uint32_t i = 0; i <= object_count; ++i) {
+		offsets[i + 1] += offsets[i];
+	}
+
+	// Point each object at it's range of the index
+	for (uint32_t i = 0; i < object_count; ++i) {
+		object_array[i].child_array = child_index + offsets[i + 1];
+		object_array[i].child_count = offsets[i + 2] - offsets[i + 1];
+	}
+	file->root_array = child_index;
+	file->root_count = offsets[1];
+
+	// Scatter the objects into their parent's range
+	for (uint32_t i = 0; i < object_count; ++i) {
+		struct rbx_object *parent = object_array[i].parent;
+		uint32_t slot = parent ? (uint32_t)(parent - object_array) + 1 : 0;
+		child_index[offsets[slot]++] = &object_array[i];
+	}
+	reader_free(reader, offsets, offsets_size);
+
+	// Objects that aren't reachable from the roots (broken parent cycles)
+	// never get a range in the tree order.
+	for (uint32_t i = 0; i < object_count; ++i) {
+		object_array[i].tree_enter = UINT32_MAX;
+		object_array[i].tree_exit = UINT32_MAX;
+	}
+
+	// Iterative depth first walk, the stack holds the path to the current
+	// object, and cursors the next child to visit at each level.
+	uint32_t order = 0;
+	for (uint32_t r = 0; r < file->root_count; ++r) {
+		uint32_t depth = 0;
+		stack[depth] = file->root_array[r];
+		cursors[depth] = 0;
+		stack[depth]->tree_enter = order;
+		tree_order[order++] = stack[depth];
+
+		for (;;) {
+			struct rbx_object *top = stack[depth];
+			if (cursors[depth] < top->child_count) {
+				// Descend into the next child
+				struct rbx_object *child = top->child_array[cursors[depth]++];
+				++depth;
+				stack[depth] = child;
+				cursors[depth] = 0;
+				child->tree_enter = order;
+				tree_order[order++] = child;
+			} else {
+				// Done with this subtree
+				top->tree_exit = order;
+				if (depth == 0) {
+					break;
+				}
+				--depth;
+			}
+		}
+	}
+	reader_free(reader, stack, array_size);
+	reader_free(reader, cursors, cursors_size);
+
+	file->child_index = child_index;
+	file->tree_order = tree_order;
+	file->tree_count = order;
+
+	return 1;
+}
+
+struct rbx_object **rbx_get_children(struct rbx_file *file,
+	struct rbx_object *object, uint32_t *count) {
+	if (object == NULL) {
+		*count = file->root_count;
+		return file->root_array;
+	}
+	*count = object->child_count;
+	return object->child_array;
+}
+
+struct rbx_object **rbx_get_descendants(struct rbx_file *file,
+	struct rbx_object *object, uint32_t *count) {
+	if (object == NULL) {
+		*count = file->tree_count;
+		return file->tree_order;
+	}
+	if (object->tree_enter == UINT32_MAX) {
+		*count = 0;
+		return NULL;
+	}
+	*count = object->tree_exit - object->tree_enter - 1;
+	return file->tree_order + object->tree_enter + 1;
+}
+
+int rbx_is_descendant_of(struct rbx_object *object, struct rbx_object *ancestor) {
+	return ancestor->tree_enter < object->tree_enter &&
+	       object->tree_enter < ancestor->tree_exit;
+}
+
+/* Name index
+ * - An open addressing hash table of objects keyed by (parent, Name). Only
+ *   the first child with a given name under each parent is stored, so that
+ *   a lookup gives the same answer as a FindFirstChild walk would.
+ */
+struct rbx_name_entry {
+	struct rbx_object *object; /* NULL => empty slot */
+	const uint8_t *name;
+	size_t length;
+	uint32_t hash;
+};
+struct rbx_name_index {
+	uint32_t capacity; /* Power of two */
+	struct rbx_name_entry *entry_array;
+};
+
+/* Hash a (parent, name) pair, FNV-1a over the parent's referent and name */
+uint32_t hash_child_name(struct rbx_object *parent, const uint8_t *name, size_t length) {
+	uint32_t hash = 2166136261u;
+	uint32_t key = parent ? parent->referent + 1 : 0;
+	for (int i = 0; i < 4; ++i) {
+		hash = (hash ^ ((key >> (i*8)) & 0xFF)) * 16777619u;
+	}
+	for (size_t i = 0; i < length; ++i) {
+		hash = (hash ^ name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* Find the slot for a (parent, name) pair, either the slot holding it or
+ * the empty slot where it would go. */
+struct rbx_name_entry *find_name_slot(struct rbx_name_index *index, uint32_t hash,
+	struct rbx_object *parent, const uint8_t *name, size_t length) {
+	uint32_t mask = index->capacity - 1;
+	for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+		struct rbx_name_entry *entry = &index->entry_array[i];
+		if (entry->object == NULL) {
+			return entry;
+		}
+		if (entry->hash == hash && entry->object->parent == parent &&
+		    entry->length == length && 0 == memcmp(entry->name, name, length)) {
+			return entry;
+		}
+	}
+}
+
+struct rbx_string **rbx_collect_names(struct rbx_file *file) {
+	struct rbx_string **names = (struct rbx_string**)
+		rbx_calloc(file->allocator, file->object_count + 1, sizeof(struct rbx_string*));
+	if (!names) {
+		return NULL;
+	}
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type_info = (file->type_array + i);
+		struct rbx_object_prop *prop = type_info->prop_list;
+		for (; prop != NULL; prop = prop->next) {
+			if (prop->value_type == RBX_TYPE_STRING &&
+			    0 == strcmp("Name", (char*)prop->name.data)) {
+				break;
+			}
+		}
+		if (prop == NULL) {
+			continue;
+		}
+		for (uint32_t j = 0; j < type_info->object_count; ++j) {
+			struct rbx_string *name = rbx_prop_string(prop, j);
+			if (name != NULL) {
+				names[type_info->object_referent_array[j]] = name;
+			}
+		}
+	}
+	return names;
+}
+
+void free_names(struct rbx_file *file, struct rbx_string **names) {
+	rbx_free(file->allocator, names);
+}
+
+/* Build the name index from the Name column of each type */
+struct rbx_name_index *build_name_index(struct rbx_file *file) {
+	// Gather the name of each object
+	struct rbx_string **names = rbx_collect_names(file);
+	if (!names) {
+		return NULL;
+	}
+
+	// Size the table for a load factor of at most 1/2
+	uint32_t capacity = 16;
+	while (capacity < 2*(uint64_t)file->object_count) {
+		capacity *= 2;
+	}
+	struct rbx_name_index *index = (struct rbx_name_index*)
+		rbx_alloc(file->allocator, sizeof(struct rbx_name_index));
+	struct rbx_name_entry *entry_array = (struct rbx_name_entry*)
+		rbx_calloc(file->allocator, capacity, sizeof(struct rbx_name_entry));
+	if (!index || !entry_array) {
+		rbx_free(file->allocator, index);
+		rbx_free(file->allocator, entry_array);
+		free_names(file, names);
+		return NULL;
+	}
+	index->capacity = capacity;
+	index->entry_array = entry_array;
+
+	// Insert in child index order, so that the first child with a given
+	// name under a parent is the one that ends up in the table.
+	for (uint32_t i = 0; i < file->object_count; ++i) {
+		struct rbx_object *object = file->child_index[i];
+		struct rbx_string *name = names[object->referent];
+		if (name == NULL) {
+			continue;
+		}
+		uint32_t hash = hash_child_name(object->parent, name->data, name->length);
+		struct rbx_name_entry *entry = 
+			find_name_slot(index, hash, object->parent, name->data, name->length);
+		if (entry->object == NULL) {
+			entry->object = object;
+			entry->name = name->data;
+			entry->length = name->length;
+			entry->hash = hash;
+		}
+	}
+	free_names(file, names);
+
+	return index;
+}
+
+/* Look up a child by name, building the name index if needed */
+struct rbx_object *find_first_child(struct rbx_file *file,
+	struct rbx_object *object, const uint8_t *name, size_t length) {
+	if (file->name_index == NULL) {
+		file->name_index = build_name_index(file);
+		if (file->name_index == NULL) {
+			return NULL;
+		}
+	}
+	uint32_t hash = hash_child_name(object, name, length);
+	return find_name_slot(file->name_index, hash, object, name, length)->object;
+}
+
+struct rbx_object *rbx_find_first_child(struct rbx_file *file,
+	struct rbx_object *object, const char *name) {
+	return find_first_child(file, object, (const uint8_t*)name, strlen(name));
+}
+
+struct rbx_object *rbx_find_path(struct rbx_file *file, const char *path) {
+	struct rbx_object *object = NULL;
+	const char *part = path;
+	for (;;) {
+		const char *end = strchr(part, '.');
+		size_t length = end ? (size_t)(end - part) : strlen(part);
+		object = find_first_child(file, object, (const uint8_t*)part, length);
+		if (object == NULL || end == NULL) {
+			return object;
+		}
+		part = end + 1;
+	}
+}
+
+/* Free a name index */
+void free_name_index(const struct rbx_allocator *allocator, struct rbx_name_index *index) {
+	// index may be NULL if it was never built
+	if (index != NULL) {
+		rbx_free(allocator, index->entry_array);
+		rbx_free(allocator, index);
+	}
+}
+
+void free_prop_values(const struct rbx_allocator *allocator, struct rbx_object_prop *prop) {
+	rbx_free(allocator, prop->slot_array);
+	rbx_free(allocator, prop->pool);
+	rbx_free(allocator, prop->string_data);
+	rbx_free(allocator, prop->run_end_array);
+	rbx_free(allocator, prop->code_array);
+	rbx_free(allocator, prop->bit_array);
+}
+
 /* Free an rbx_object_class */
-void free_type(struct rbx_object_class *type) {
+void free_type(const struct rbx_allocator *allocator, struct rbx_object_class *type) {
 	// Free name
-	free_string(&type->name);
+	free_string(allocator, &type->name);
 
 	// Free each of the properties
 	struct rbx_object_prop *prop = type->prop_list;
@@ -687,19 +1579,13 @@ void free_type(struct rbx_object_class *type) {
 		struct rbx_object_prop *next = prop->next;
 
 		// Free the name
-		free_string(&prop->name);
+		free_string(allocator, &prop->name);
 
-		// Don't free the property values here. Free them from the objects
-		// using the values when they are freed, as the objects may have added
-		// more properties that weren't parsed from a file, and aren't in the
-		// value array.
-
-		// But do free the property value array itself, all of it's data is
-		// referenced in objects.
-		free(prop->value_array);
+		// Free the values, the objects only refer to them
+		free_prop_values(allocator, prop);
 
 		// Free the prop itself
-		free(prop);
+		rbx_free(allocator, prop);
 
 		// Go to the saved next
 		prop = next;
@@ -708,59 +1594,75 @@ void free_type(struct rbx_object_class *type) {
 	type->prop_count = 0;
 
 	// Free the referent array (may be null)
-	free(type->object_referent_array);
+	rbx_free(allocator, type->object_referent_array);
 	type->object_referent_array = NULL;
 }
 
 /* Free an array of rbx_object_class-es */
-void free_type_array(struct rbx_object_class *types, uint32_t count) {
+void free_type_array(const struct rbx_allocator *allocator,
+                     struct rbx_object_class *types, uint32_t count) {
 	// Free each type
 	for (uint32_t i = 0; i < count; ++i) {
-		free_type(types + i);
+		free_type(allocator, types + i);
 	}
 
 	// Free the array
-	free(types);
+	rbx_free(allocator, types);
 }
 
 /* Free an rbx_object */
-void free_object(struct rbx_object *obj) {
-	// Free the values that we have
-	for (uint32_t i = 0; i < obj->prop_value_count; ++i) {
-		free(obj->prop_value_array[i].value);
-	}
-
-	// Free the prop_value array
-	free(obj->prop_value_array);
+void free_object(const struct rbx_allocator *allocator, struct rbx_object *obj) {
+	// Free the prop_value array, the values belong to the props
+	rbx_free(allocator, obj->prop_value_array);
 	obj->prop_value_array = NULL;
 }
 
 /* Free an array of rbx_object-s */
-void free_object_array(struct rbx_object *array, uint32_t count) {
+void free_object_array(const struct rbx_allocator *allocator,
+                       struct rbx_object *array, uint32_t count) {
 	// Free each type
 	for (uint32_t i = 0; i < count; ++i) {
-		free_object(array + i);
+		free_object(allocator, array + i);
 	}
 
 	// Free the array
-	free(array);	
+	rbx_free(allocator, array);	
 }
 
 /* Free an rbx_file struct */
 void free_rbx_file(struct rbx_file *file) {
-	// Free the arrays and clear out the data structure
-	free_object_array(file->object_array, file->object_count);
-	free_type_array(file->type_array, file->type_count);
-	file->object_array = NULL;
-	file->object_count = 0;
-	file->type_array = NULL;
-	file->type_count = 0;
+	// Free the arrays, then the file itself, through the allocator that
+	// they came from
+	const struct rbx_allocator *allocator = file->allocator;
+	free_object_array(allocator, file->object_array, file->object_count);
+	free_type_array(allocator, file->type_array, file->type_count);
+	rbx_free(allocator, file->child_index);
+	rbx_free(allocator, file->tree_order);
+	free_name_index(allocator, file->name_index);
+	rbx_free(allocator, file);
 }
 
 struct rbx_file *read_rbx_file(void *data, size_t length) {
+	return read_rbx_file_ex(data, length, NULL, NULL);
+}
+
+struct rbx_file *read_rbx_file_ex(void *data, size_t length, struct rbx_load_stats *stats,
+                                  const struct rbx_allocator *allocator) {
 	// Current position in data
 	uint8_t *ptr = (uchar*)data;
 
+	// Allocation and timing state
+	struct rbx_reader reader_state;
+	struct rbx_reader *reader = &reader_state;
+	reader->stats = stats;
+	reader->allocator = allocator;
+	reader->live_bytes = 0;
+	if (stats != NULL) {
+		memset(stats, 0x0, sizeof(struct rbx_load_stats));
+	}
+	struct phase_timer timer;
+	start_timer(reader, &timer);
+
 	// 16 byte header
 	uint8_t *header = ptr;
 	ptr += 16;
@@ -783,31 +1685,39 @@ struct rbx_file *read_rbx_file(void *data, size_t length) {
 
 	// Allocate space for the type info and zero it for debugging
 	struct rbx_object_class *type_array = 
-		malloc(sizeof(struct rbx_object_class) * typecount);
+		reader_alloc(reader, sizeof(struct rbx_object_class) * typecount);
 	memset(type_array, 0x0, sizeof(struct rbx_object_class*) * typecount);
+	stop_phase(reader, &timer, RBX_PHASE_HEADER);
 
 	// Read in type info
+	start_timer(reader, &timer);
 	for (int i = 0; i < typecount; ++i) {
-		if (!read_type_record(&ptr, type_array + i)) {
+		if (!read_type_record(reader, &ptr, type_array + i)) {
 			// Free the types we read in so far
-			free_type_array(type_array, i);
+			free_type_array(allocator, type_array, i);
 			return NULL;
 		}
 	}
 
+	stop_phase(reader, &timer, RBX_PHASE_INST);
+
 	// Property records
 	for (;;) {
-		if (!read_prop_record(&ptr, type_array)) {
+		if (!read_prop_record(reader, &ptr, type_array)) {
 			break;
 		}
 	}
 
 	// Parent records
-	struct prnt_record *parents = 
-		(struct prnt_record*)malloc(sizeof(struct prnt_record)*objectcount);
-	if (!read_parent_record(&ptr, parents)) {
+	start_timer(reader, &timer);
+	size_t parents_size = sizeof(struct prnt_record)*objectcount;
+	struct prnt_record *parents = (struct prnt_record*)reader_alloc(reader, parents_size);
+	uint32_t parent_count = 0;
+	if (!read_parent_record(reader, &ptr, parents, objectcount, &parent_count)) {
+		reader_free(reader, parents, parents_size);
 		return NULL;
 	}
+	stop_phase(reader, &timer, RBX_PHASE_PRNT);
 
 	// // End block
 	// struct lz4_data record;
@@ -816,142 +1726,49 @@ struct rbx_file *read_rbx_file(void *data, size_t length) {
 	// }
 
 	// Objects
-	struct rbx_object *object_array = malloc(sizeof(struct rbx_object)*objectcount);
-
-	// For each type
-	for (int i = 0; i < typecount; ++i) {
-		struct rbx_object_class *type_info = (type_array + i);
-
-		// For each object of this type create the object
-		for (uint32_t j = 0; j < type_info->object_count; ++j) {
-			uint32_t referent = type_info->object_referent_array[j];
-
-			// Get and set up the object
-			struct rbx_object *object = (object_array + referent);
-			object->type = type_info;
-			object->referent = referent;
-			object->prop_value_count = type_info->prop_count;
-			// Note, here we make the length of the property value array equal
-			// to the type's prop count + 1, since we are going to add a parent
-			// property later.
-			object->prop_value_array = 
-				(struct rbx_object_propentry*)
-					malloc(sizeof(struct rbx_object_propentry)*(type_info->prop_count + 1));
-
-			// Write in the props
-			struct rbx_object_prop *prop = type_info->prop_list;
-			for (uint32_t k = 0; prop != NULL; prop = prop->next, ++k) {
-				struct rbx_object_propentry *prop_entry = 
-					&object->prop_value_array[k];	
-
-				// Fill in the property entry on this object
-				prop_entry->prop = prop;
-				prop_entry->value = prop->value_array[j];
-
-				// Referent translation
-				//  Turn referent props into object props with pointers to the
-				//  actual objects.
-				if (prop->value_type == RBX_TYPE_REFERENT) {
-					// Set to an object value type
-					prop_entry->value->type = RBX_TYPE_OBJECT;
-
-					// Translate the thing that it's referring to
-					int32_t other_referent = prop_entry->value->referent_value.data;
-					if (other_referent == -1) {
-						// -1 => No object
-						prop_entry->value->object_value.data = NULL;
-					} else {
-						// Otherwise, translate object
-						prop_entry->value->object_value.data = &object_array[other_referent];
-					}
-				}
-			}
-		}
-
-		// We already translated the referent values, but we haven't actually
-		// changed the referent property definitions' types, do that now.
-		//  For each TYPE_REFERENT property rewrite -> TYPE_OBJECT
-		struct rbx_object_prop *prop = type_info->prop_list;
-		for (; prop != NULL; prop = prop->next) {
-			if (prop->value_type == RBX_TYPE_REFERENT) {
-				prop->value_type = RBX_TYPE_OBJECT;
-			}
-		}
-	}
-
-	// For each type, we should add a parent property to it, and decode
-	// the PRNT references.
-	for (int i = 0; i < typecount; ++i) {
-		struct rbx_object_class *type_info = (type_array + i);
-
-		// Create parent property
-		struct rbx_object_prop *parent_prop = malloc(sizeof(struct rbx_object_prop));
-		parent_prop->value_type = RBX_TYPE_OBJECT;
-		parent_prop->parent_type = type_info;
-		parent_prop->value_array = NULL;
-
-		// Name
-		static const char *parent_name = "Parent";
-		parent_prop->name.data = (uint8_t*)malloc(strlen(parent_name) + 1);
-		memcpy(parent_prop->name.data, parent_name, strlen(parent_name));
-		parent_prop->name.data[strlen(parent_name)] = '\0';
-		parent_prop->name.length = strlen(parent_name);
-
-		// Add to list
-		parent_prop->next = type_info->prop_list;
-		type_info->prop_list = parent_prop;
-
-		// For each object, add the parent prop
-		for (uint32_t j = 0; j < type_info->object_count; ++j) {
-			int32_t referent = type_info->object_referent_array[j];
-			struct rbx_object *object = (object_array + referent);
-
-			// Add parent prop to count
-			++object->prop_value_count;
-
-			// Find the parent
-			int32_t parent_referent;
-			for (int k = 0; k < objectcount; ++k) {
-				if (parents[k].object == referent) {
-					parent_referent = parents[k].parent;
-					break;
-				}
-			}
-
-			// Get the parent object
-			struct rbx_object *parent_object;
-			if (parent_referent == -1) {
-				parent_object = NULL;
-			} else {
-				parent_object = (object_array + parent_referent);
-			}
-
-			// Create the value
-			struct rbx_value *value = 
-				(struct rbx_value*)malloc(sizeof(struct rbx_value));
-			value->type = RBX_TYPE_OBJECT;
-			value->object_value.data = parent_object;
-
-			// Set up the last property as the parent property
-			// (Note: We have one extra space allocated after the
-			//        normal prop_value_array for this property)
-			struct rbx_object_propentry *entry = 
-				(object->prop_value_array + type_info->prop_count);
-			entry->prop = parent_prop;
-			entry->value = value;
-		}
-
-		// Increment the prop count on the type
-		++type_info->prop_count;
-	}	 
+	start_timer(reader, &timer);
+	TRACE_BEGIN("assembly", NULL);
+	struct rbx_object *object_array =
+		build_objects(reader, type_array, typecount, objectcount);
+	TRACE_END();
+	stop_phase(reader, &timer, RBX_PHASE_ASSEMBLY);
+
+	// Decode the PRNT references, then we're done with them
+	start_timer(reader, &timer);
+	TRACE_BEGIN("parent linking", NULL);
+	link_parents(object_array, objectcount, parents, parent_count);
+	reader_free(reader, parents, parents_size);
+
+	// Expose the parents as a property
+	add_parent_props(reader, type_array, typecount, object_array);
+	TRACE_END();
+	stop_phase(reader, &timer, RBX_PHASE_PARENTS);
 
 	struct rbx_file *output = 
-		(struct rbx_file*)malloc(sizeof(struct rbx_file));
+		(struct rbx_file*)reader_alloc(reader, sizeof(struct rbx_file));
 
 	output->type_count = typecount;
 	output->type_array = type_array;
 	output->object_count = objectcount;
 	output->object_array = object_array;
+	output->root_count = 0;
+	output->root_array = NULL;
+	output->child_index = NULL;
+	output->tree_count = 0;
+	output->tree_order = NULL;
+	output->name_index = NULL;
+	output->allocator = allocator;
+
+	// Index the hierarchy
+	start_timer(reader, &timer);
+	TRACE_BEGIN("hierarchy", NULL);
+	int indexed = build_hierarchy(reader, output);
+	TRACE_END();
+	if (!indexed) {
+		free_rbx_file(output);
+		return NULL;
+	}
+	stop_phase(reader, &timer, RBX_PHASE_HIERARCHY);
 
 	return output;
 }
\ No newline at end of file
@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <stdlib.h>
@@ -6,13 +5,172 @@
 
 #include "rbx_types.h"
 
+/* Where a read gets its memory from. Every allocation made by the reader
+ * and for the file it returns goes through alloc, and free_rbx_file gives
+ * it all back through free. free is never passed NULL. */
+struct rbx_allocator {
+	void *(*alloc)(void *user, size_t size);
+	void (*free)(void *user, void *ptr);
+	void *user;
+};
+
 struct rbx_file {
 	uint32_t type_count;
 	struct rbx_object_class *type_array;
 	uint32_t object_count;
 	struct rbx_object *object_array;
+
+	/* Hierarchy index
+	 * - child_index holds every object exactly once, grouped by parent (CSR
+	 *   layout), the top level objects come first as the children of nil.
+	 * - tree_order holds the objects in depth first pre-order, so that the
+	 *   descendants of an object are the contiguous range
+	 *   (tree_enter, tree_exit) of that object.
+	 */
+	uint32_t root_count;
+	struct rbx_object **root_array;  /* Points into child_index */
+	struct rbx_object **child_index; /* length = object_count */
+	uint32_t tree_count;             /* Objects reachable from the roots */
+	struct rbx_object **tree_order;  /* length = tree_count */
+
+	/* (parent, Name) -> object hash, built on first use */
+	struct rbx_name_index *name_index;
+
+	/* What the file was allocated with, NULL for malloc and free */
+	const struct rbx_allocator *allocator;
 };
 
 struct rbx_file *read_rbx_file(void *data, size_t length);
 
-void free_rbx_file(struct rbx_file *file);
\ No newline at end of file
+/* Phases of a read */
+#define RBX_PHASE_HEADER          0
+#define RBX_PHASE_INST            1
+#define RBX_PHASE_PROP_DECOMPRESS 2
+#define RBX_PHASE_PROP_DECODE     3
+#define RBX_PHASE_PRNT            4
+#define RBX_PHASE_ASSEMBLY        5
+#define RBX_PHASE_PARENTS         6
+#define RBX_PHASE_HIERARCHY       7
+#define RBX_PHASE_COUNT           8
+
+/* Record types */
+#define RBX_RECORD_INST  0
+#define RBX_RECORD_PROP  1
+#define RBX_RECORD_PRNT  2
+#define RBX_RECORD_COUNT 3
+
+/* Where the time and memory of a read went */
+struct rbx_load_stats {
+	double wall_ns[RBX_PHASE_COUNT];
+	double cpu_ns[RBX_PHASE_COUNT]; /* CPU time of the reading thread */
+
+	/* RBX_PHASE_PROP_DECODE broken down by value type */
+	double decode_wall_ns[256];
+	double decode_cpu_ns[256];
+	uint64_t decode_value_count[256];
+
+	uint64_t record_count[RBX_RECORD_COUNT];
+	uint64_t compressed_bytes[RBX_RECORD_COUNT];
+	uint64_t decompressed_bytes[RBX_RECORD_COUNT];
+
+	uint64_t alloc_count;
+	uint64_t alloc_bytes; /* Total over all allocations */
+	uint64_t peak_bytes;  /* Most bytes allocated by the read at once */
+};
+
+/* read_rbx_file, filling in stats if it isn't NULL and allocating through
+ * allocator if it isn't NULL. The allocator must outlive the file. */
+struct rbx_file *read_rbx_file_ex(void *data, size_t length, struct rbx_load_stats *stats,
+                                  const struct rbx_allocator *allocator);
+
+const char *rbx_phase_name(int phase);
+
+/* Free a file and everything in it */
+void free_rbx_file(struct rbx_file *file);
+
+/* Stages of read_rbx_file, exposed for the benchmarks in bench.c */
+
+/* State of a read, passed down to every stage. A zeroed reader doesn't
+ * collect stats and allocates with malloc. */
+struct rbx_reader {
+	struct rbx_load_stats *stats; /* NULL if not collecting them */
+	const struct rbx_allocator *allocator; /* NULL for malloc and free */
+	uint64_t live_bytes;
+};
+
+/* A decompressed record */
+struct lz4_data {
+	uint8_t *data;
+	size_t length;
+};
+
+/* An object, parent pair from the PRNT record */
+struct prnt_record {
+	int32_t object;
+	int32_t parent;
+};
+
+/* De-interleave an array of interleaved 32 bit values in place */
+void unmix_32_array(struct rbx_reader *reader, uint8_t *ptr, size_t length);
+
+/* Decompress the record at ptr and advance past it, returns 0 on failure */
+int read_compressed(struct rbx_reader *reader, uint8_t **ptr, struct lz4_data *output);
+
+int read_type_record(struct rbx_reader *reader, uint8_t **ptr, struct rbx_object_class *type_info);
+int read_prop_record(struct rbx_reader *reader, uint8_t **ptr, struct rbx_object_class *type_array);
+int read_parent_record(struct rbx_reader *reader, uint8_t **ptr, struct prnt_record *parents,
+                       uint32_t capacity, uint32_t *count);
+
+/* Decode a column of value_count values of type prop->value_type from
+ * length bytes into the slots and pool of prop and encode it, the data is
+ * unmixed in place. Returns 0 on allocation failure. */
+int read_values(struct rbx_reader *reader, struct rbx_object_prop *prop, uint8_t **ptr,
+                size_t length, uint32_t value_count);
+
+/* Pick the encoding of a plain column read by read_values and re-store it
+ * that way, see RBX_ENCODING_*. capacity and string_bytes are the sizes of
+ * its slot array and string data. Returns 0 on allocation failure, leaving
+ * the column plain. */
+int encode_values(struct rbx_reader *reader, struct rbx_object_prop *prop,
+                  uint32_t capacity, size_t string_bytes);
+
+struct rbx_object *build_objects(struct rbx_reader *reader, struct rbx_object_class *type_array,
+                                 uint32_t type_count, uint32_t object_count);
+void link_parents(struct rbx_object *object_array, uint32_t object_count,
+                  struct prnt_record *parents, uint32_t parent_count);
+void add_parent_props(struct rbx_reader *reader, struct rbx_object_class *type_array,
+                      uint32_t type_count, struct rbx_object *object_array);
+
+/* Free the values of a property, not the property itself */
+void free_prop_values(const struct rbx_allocator *allocator, struct rbx_object_prop *prop);
+void free_type_array(const struct rbx_allocator *allocator,
+                     struct rbx_object_class *types, uint32_t count);
+void free_object_array(const struct rbx_allocator *allocator,
+                       struct rbx_object *array, uint32_t count);
+
+/* Get the children of an object, or the top level objects if object is NULL */
+struct rbx_object **rbx_get_children(struct rbx_file *file,
+	struct rbx_object *object, uint32_t *count);
+
+/* Get all of the descendants of an object (or every object if object is NULL)
+ * in depth first order, as a slice of the file's tree_order. */
+struct rbx_object **rbx_get_descendants(struct rbx_file *file,
+	struct rbx_object *object, uint32_t *count);
+
+/* Is object a (strict) descendant of ancestor */
+int rbx_is_descendant_of(struct rbx_object *object, struct rbx_object *ancestor);
+
+/* Gather the Name of every object from the Name columns, indexed by
+ * referent (NULL for objects without a Name). The array comes from the
+ * file's allocator, free it with free_names. */
+struct rbx_string **rbx_collect_names(struct rbx_file *file);
+void free_names(struct rbx_file *file, struct rbx_string **names);
+
+/* Find the first child of object (or top level object if object is NULL)
+ * with a given Name, NULL if there isn't one. */
+struct rbx_object *rbx_find_first_child(struct rbx_file *file,
+	struct rbx_object *object, const char *name);
+
+/* Resolve a dot separated path of Names such as "Workspace.Lobby.Spawn",
+ * starting from the top level objects. NULL if any part is missing. */
+struct rbx_object *rbx_find_path(struct rbx_file *file, const char *path);
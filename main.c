@@ -9,12 +9,18 @@
 
 #include "fmt_rbx.h"
 #include "terrain.h"
+#include "diff.h"
+#include "analyze.h"
+#include "query.h"
+#include "aggregate.h"
+#include "trace.h"
 
 const char *get_name(struct rbx_object *object) {
 	for (int i = 0; i < object->prop_value_count; ++i) {
 		struct rbx_object_propentry *prop_entry = (object->prop_value_array + i);
 		if (0 == strcmp("Name", (char*)prop_entry->prop->name.data)) {
-			return (char*)prop_entry->value->string_value.data;
+			struct rbx_string *name = rbx_prop_string(prop_entry->prop, prop_entry->index);
+			return name ? (char*)name->data : NULL;
 		}
 	}
 	return NULL;
@@ -24,15 +30,20 @@ const char *get_classname(struct rbx_object *object) {
 	return (char*)object->type->name.data;
 }
 
-int main(int argc, char *argv[]) {
-	/* Check args */
-	if (argc != 2) {
-		printf("Bad arguments, usage: main filename\n");
-		exit(EXIT_FAILURE);
+/* Print the dot separated path of Names to an object */
+void print_path(struct rbx_object *object) {
+	if (object->parent != NULL) {
+		print_path(object->parent);
+		printf(".");
 	}
+	const char *name = get_name(object);
+	printf("%s", name ? name : "?");
+}
 
+/* Map a file into memory, exits on failure */
+void *map_file(const char *filename, size_t *length) {
 	/* Open input file */
-	int fd = open(argv[1], O_RDONLY);
+	int fd = open(filename, O_RDONLY);
 	if (fd < 0) {
 		printf("Could not open the file.\n");
 		exit(EXIT_FAILURE);
@@ -50,6 +61,381 @@ int main(int argc, char *argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
+	*length = file_length;
+	return data;
+}
+
+/* Map and read a file, exits on failure */
+struct rbx_file *load_file(const char *filename) {
+	size_t length;
+	void *data = map_file(filename, &length);
+	struct rbx_file *file = read_rbx_file(data, length);
+	if (file == NULL) {
+		printf("Failed to read %s, exiting.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	return file;
+}
+
+/* --diff mode, print the differences between two files */
+int diff_main(const char *filename_a, const char *filename_b) {
+	struct rbx_file *file_a = load_file(filename_a);
+	struct rbx_file *file_b = load_file(filename_b);
+
+	struct rbx_diff *diff = rbx_diff(file_a, file_b);
+	if (diff == NULL) {
+		printf("Failed to diff the files.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (uint32_t i = 0; i < diff->entry_count; ++i) {
+		struct rbx_diff_entry *entry = &diff->entry_array[i];
+		char mark = entry->change == RBX_DIFF_ADDED ? '+' :
+		            entry->change == RBX_DIFF_REMOVED ? '-' : '~';
+		if (entry->prop_name != NULL) {
+			printf("   %c %s\n", mark, entry->prop_name);
+		} else {
+			struct rbx_object *object = entry->object_a ? entry->object_a : entry->object_b;
+			printf("%c %s ", mark, get_classname(object));
+			print_path(object);
+			printf("\n");
+		}
+	}
+	printf("%u differences\n", diff->entry_count);
+
+	free_rbx_diff(diff);
+	free_rbx_file(file_a);
+	free_rbx_file(file_b);
+	return EXIT_SUCCESS;
+}
+
+/* --duplicates mode, print the models that are copied the most */
+int duplicates_main(const char *filename) {
+	struct rbx_file *file = load_file(filename);
+
+	struct rbx_duplicate_report *report = find_duplicates(file);
+	if (report == NULL) {
+		printf("Failed to find duplicates.\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%u groups of duplicated subtrees, most wasted bytes first:\n",
+		report->group_count);
+	for (uint32_t i = 0; i < report->group_count && i < 50; ++i) {
+		struct rbx_duplicate_group *group = &report->group_array[i];
+		printf("%6u copies x %6u instances, %8llu bytes each: %s ",
+			group->copy_count,
+			group->instance_count,
+			(unsigned long long)group->byte_count,
+			get_classname(group->copy_array[0]));
+		print_path(group->copy_array[0]);
+		printf("\n");
+	}
+
+	free_duplicate_report(report);
+	free_rbx_file(file);
+	return EXIT_SUCCESS;
+}
+
+double compression_ratio(uint64_t compressed, uint64_t decompressed) {
+	return compressed ? (double)decompressed / compressed : 0;
+}
+
+/* --analyze mode, print where the bytes and load time of a file go */
+int analyze_main(const char *filename) {
+	size_t length;
+	void *data = map_file(filename, &length);
+
+	// Read with stats to get the decode time of each column
+	struct rbx_load_stats stats;
+	struct rbx_file *file = read_rbx_file_ex(data, length, &stats, NULL);
+	if (file == NULL) {
+		printf("Failed to read %s.\n", filename);
+		return EXIT_FAILURE;
+	}
+	struct rbx_analysis *analysis = analyze_file(file);
+	if (analysis == NULL) {
+		printf("Failed to analyze %s.\n", filename);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-40s %12s %12s %7s %10s\n",
+		"Class", "compressed", "bytes", "ratio", "decode ms");
+	for (uint32_t i = 0; i < analysis->class_count; ++i) {
+		struct rbx_class_analysis *class_info = &analysis->class_array[i];
+		printf("%-40s %12llu %12llu %7.2f %10.3f\n",
+			class_info->type->name.data,
+			(unsigned long long)class_info->compressed_bytes,
+			(unsigned long long)class_info->decompressed_bytes,
+			compression_ratio(class_info->compressed_bytes, class_info->decompressed_bytes),
+			class_info->decode_ns*1e-6);
+	}
+
+	printf("\n%-40s %12s %12s %7s %9s %9s %10s\n", "Column", "compressed",
+		"bytes", "ratio", "values", "distinct", "decode ms");
+	for (uint32_t i = 0; i < analysis->column_count && i < 50; ++i) {
+		struct rbx_column_analysis *column = &analysis->column_array[i];
+		char name[256];
+		snprintf(name, sizeof(name), "%s.%s",
+			column->prop->parent_type->name.data, column->prop->name.data);
+		printf("%-40s %12llu %12llu %7.2f %9u %9u %10.3f\n", name,
+			(unsigned long long)column->compressed_bytes,
+			(unsigned long long)column->decompressed_bytes,
+			compression_ratio(column->compressed_bytes, column->decompressed_bytes),
+			column->value_count, column->distinct_count, column->decode_ns*1e-6);
+	}
+
+	printf("\n%12s %12s %10s %9s  %s\n", "compressed", "bytes", "decode ms",
+		"instances", "Top level subtree");
+	for (uint32_t i = 0; i < analysis->subtree_count && i < 50; ++i) {
+		struct rbx_subtree_analysis *subtree = &analysis->subtree_array[i];
+		printf("%12.0f %12.0f %10.3f %9u  %s ",
+			subtree->compressed_bytes, subtree->decompressed_bytes,
+			subtree->decode_ns*1e-6, subtree->instance_count,
+			get_classname(subtree->object));
+		print_path(subtree->object);
+		printf("\n");
+	}
+
+	free_analysis(analysis);
+	free_rbx_file(file);
+	return EXIT_SUCCESS;
+}
+
+/* --query mode, print the objects matching a query */
+int query_main(const char *text, const char *filename) {
+	char error[256];
+	struct rbx_query *query = parse_query(text, error, sizeof(error));
+	if (query == NULL) {
+		printf("Bad query, %s.\n", error);
+		return EXIT_FAILURE;
+	}
+	struct rbx_file *file = load_file(filename);
+
+	struct rbx_query_result *result = query_objects(file, query);
+	if (result == NULL) {
+		printf("Failed to run the query.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (uint32_t i = 0; i < result->object_count; ++i) {
+		struct rbx_object *object = result->object_array[i];
+		printf("%s ", get_classname(object));
+		print_path(object);
+		printf("\n");
+	}
+	printf("%u matches\n", result->object_count);
+
+	free_query_result(result);
+	free_query(query);
+	free_rbx_file(file);
+	return EXIT_SUCCESS;
+}
+
+/* --aggregate mode, print the sum, mean, min and max of a property per
+ * class, over the objects matching a query if there is one */
+int aggregate_main(const char *name, const char *filename, const char *text) {
+	char error[256];
+	struct rbx_query *query = NULL;
+	if (text != NULL) {
+		query = parse_query(text, error, sizeof(error));
+		if (query == NULL) {
+			printf("Bad query, %s.\n", error);
+			return EXIT_FAILURE;
+		}
+	}
+	struct rbx_file *file = load_file(filename);
+
+	struct rbx_query_result *result = NULL;
+	if (query != NULL) {
+		result = query_objects(file, query);
+		if (result == NULL) {
+			printf("Failed to run the query.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	struct rbx_aggregate *aggregate_array =
+		(struct rbx_aggregate*)malloc(sizeof(struct rbx_aggregate)*(file->type_count + 1));
+	struct rbx_aggregate total;
+	if (aggregate_array == NULL ||
+	    !aggregate_by_class(file, name, result ? result->selection_array : NULL,
+	                        aggregate_array, &total)) {
+		printf("Failed to aggregate %s.\n", name);
+		return EXIT_FAILURE;
+	}
+
+	// Classes whose property has another type than the first are left out
+	// of the total, and marked with a *
+	uint32_t left_out = 0;
+	printf("%-24s %10s %14s %14s %14s %14s\n", "Class", "Values", "Sum", "Mean", "Min", "Max");
+	for (uint32_t i = 0; i <= file->type_count; ++i) {
+		struct rbx_aggregate *aggregate = i < file->type_count ? &aggregate_array[i] : &total;
+		if (aggregate->count == 0) {
+			continue;
+		}
+		char label[64];
+		if (i == file->type_count) {
+			snprintf(label, sizeof(label), "Total");
+		} else if (aggregate->value_type != total.value_type) {
+			snprintf(label, sizeof(label), "%s *", (char*)file->type_array[i].name.data);
+			++left_out;
+		} else {
+			snprintf(label, sizeof(label), "%s", (char*)file->type_array[i].name.data);
+		}
+		for (uint32_t c = 0; c < aggregate->component_count; ++c) {
+			char count[16] = "";
+			if (c == 0) {
+				snprintf(count, sizeof(count), "%u", aggregate->count);
+			}
+			printf("%-24s %10s %14.4g %14.4g %14.4g %14.4g\n",
+			       c > 0 ? "" : label, count, aggregate->sum[c], aggregate_mean(aggregate, c),
+			       aggregate->min[c], aggregate->max[c]);
+		}
+	}
+	if (left_out > 0) {
+		printf("* Not in the total, %s isn't a %s there.\n", name,
+		       rbx_type_name(total.value_type));
+	}
+	// The volume of a Size column
+	if (total.value_type == RBX_TYPE_VECTOR3) {
+		printf("Sum of x*y*z: %.4g\n", total.product_sum);
+	}
+
+	free(aggregate_array);
+	if (result != NULL) {
+		free_query_result(result);
+		free_query(query);
+	}
+	free_rbx_file(file);
+	return EXIT_SUCCESS;
+}
+
+/* ClusterGridV3 data of the first object that has any, NULL if none do */
+struct rbx_string *find_cluster_grid(struct rbx_file *file) {
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type = &file->type_array[i];
+		for (struct rbx_object_prop *prop = type->prop_list; prop != NULL; prop = prop->next) {
+			if (prop->value_type != RBX_TYPE_STRING ||
+			    0 != strcmp((char*)prop->name.data, "ClusterGridV3")) {
+				continue;
+			}
+			for (uint32_t j = 0; j < type->object_count; ++j) {
+				struct rbx_string *data = rbx_prop_string(prop, j);
+				if (data != NULL) {
+					return data;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+/* --terrain mode, check that decoding and re-encoding the terrain of a file
+ * gives back its ClusterGridV3 data byte for byte, and that its level of
+ * detail pyramid reads back from a sidecar the same as it was written */
+int terrain_main(const char *filename) {
+	struct rbx_file *file = load_file(filename);
+	struct rbx_string *cluster_grid = find_cluster_grid(file);
+	if (cluster_grid == NULL) {
+		printf("No terrain in %s.\n", filename);
+		return EXIT_FAILURE;
+	}
+
+	struct rbx_terrain *terrain = translate_terrain(cluster_grid, NULL);
+	if (terrain == NULL) {
+		printf("Failed to decode the terrain.\n");
+		return EXIT_FAILURE;
+	}
+	size_t length;
+	uint8_t *encoded = write_terrain(terrain, &length);
+	if (encoded == NULL) {
+		printf("Failed to encode the terrain.\n");
+		return EXIT_FAILURE;
+	}
+	int same = length == cluster_grid->length &&
+		0 == memcmp(encoded, cluster_grid->data, length);
+	printf("ClusterGridV3 round trip: %lu bytes, %lu re-encoded, %s\n",
+		(unsigned long)cluster_grid->length, (unsigned long)length,
+		same ? "same" : "DIFFERENT");
+	free(encoded);
+
+	struct rbx_terrain_lod *lod = build_terrain_lod(terrain);
+	uint8_t *sidecar = lod ? write_terrain_lod(lod, &length) : NULL;
+	if (sidecar == NULL) {
+		printf("Failed to build the level of detail sidecar.\n");
+		return EXIT_FAILURE;
+	}
+	struct rbx_terrain_lod *read_back = read_terrain_lod(sidecar, length);
+	int lod_same = read_back != NULL && read_back->chunk_count == lod->chunk_count &&
+		0 == memcmp(read_back->position_array, lod->position_array,
+		            sizeof(int16_t)*3*lod->chunk_count) &&
+		0 == memcmp(read_back->cell_array, lod->cell_array,
+		            sizeof(struct terrain_lod_cell)*TERRAIN_LOD_CELLS*lod->chunk_count);
+	printf("LOD sidecar round trip: %u chunks, %lu bytes, %s\n",
+		lod->chunk_count, (unsigned long)length, lod_same ? "same" : "DIFFERENT");
+	free(sidecar);
+	free_terrain_lod(read_back);
+	free_terrain_lod(lod);
+
+	free_terrain(terrain);
+	free_rbx_file(file);
+	return same && lod_same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --stats mode, print where the time and memory of loading a file went */
+int stats_main(const char *filename) {
+	size_t length;
+	void *data = map_file(filename, &length);
+
+	struct rbx_load_stats stats;
+	struct rbx_file *file = read_rbx_file_ex(data, length, &stats, NULL);
+	if (file == NULL) {
+		printf("Failed to read %s.\n", filename);
+		return EXIT_FAILURE;
+	}
+
+	double total_wall = 0, total_cpu = 0;
+	printf("%-18s %12s %12s\n", "Phase", "wall ms", "cpu ms");
+	for (int i = 0; i < RBX_PHASE_COUNT; ++i) {
+		printf("%-18s %12.3f %12.3f\n",
+			rbx_phase_name(i), stats.wall_ns[i]*1e-6, stats.cpu_ns[i]*1e-6);
+		total_wall += stats.wall_ns[i];
+		total_cpu += stats.cpu_ns[i];
+	}
+	printf("%-18s %12.3f %12.3f\n\n", "total", total_wall*1e-6, total_cpu*1e-6);
+
+	printf("%-18s %12s %12s %12s\n", "Decode by type", "values", "wall ms", "cpu ms");
+	for (int i = 0; i < 256; ++i) {
+		if (stats.decode_value_count[i] > 0) {
+			printf("%-18s %12llu %12.3f %12.3f\n", rbx_type_name(i),
+				(unsigned long long)stats.decode_value_count[i],
+				stats.decode_wall_ns[i]*1e-6, stats.decode_cpu_ns[i]*1e-6);
+		}
+	}
+
+	static const char *record_names[RBX_RECORD_COUNT] = {"INST", "PROP", "PRNT"};
+	printf("\n%-18s %12s %12s %12s\n", "Records", "count", "compressed", "decompressed");
+	for (int i = 0; i < RBX_RECORD_COUNT; ++i) {
+		printf("%-18s %12llu %12llu %12llu\n", record_names[i],
+			(unsigned long long)stats.record_count[i],
+			(unsigned long long)stats.compressed_bytes[i],
+			(unsigned long long)stats.decompressed_bytes[i]);
+	}
+
+	printf("\nAllocations: %llu, %llu bytes in total, %llu bytes at peak\n",
+		(unsigned long long)stats.alloc_count,
+		(unsigned long long)stats.alloc_bytes,
+		(unsigned long long)stats.peak_bytes);
+
+	free_rbx_file(file);
+	return EXIT_SUCCESS;
+}
+
+/* Default mode, dump every object and the terrain of a file */
+int dump_main(const char *filename) {
+	size_t file_length;
+	void *data = map_file(filename, &file_length);
+
 	/* Do the thing */
 	struct rbx_file *file = read_rbx_file(data, file_length);
 
@@ -57,6 +443,7 @@ int main(int argc, char *argv[]) {
 
 	// Dump out the resulting data
 	if (file != NULL) {
+		TRACE_BEGIN("dump", NULL);
 		printf("Success, details:\n");
 
 		// // Print out a dump of the info
@@ -84,95 +471,97 @@ int main(int argc, char *argv[]) {
 				get_name(object));
 			for (int i = 0; i < object->prop_value_count; ++i) {
 				struct rbx_object_propentry *prop_entry = (object->prop_value_array + i);
+				struct rbx_value expanded;
+				struct rbx_value *value = rbx_entry_get(prop_entry, &expanded);
 
 				// Check for cluster grid data
 				if (!strcmp((char*)prop_entry->prop->name.data, "ClusterGridV3")) {
-					cluster_grid = &prop_entry->value->string_value;
+					cluster_grid = rbx_prop_string(prop_entry->prop, prop_entry->index);
 				}
 
 				printf(" | %s = ", prop_entry->prop->name.data);
-				uint8_t type = prop_entry->prop->value_type;
+				uint8_t type = value ? prop_entry->prop->value_type : 0;
 				switch (type) {
 				case RBX_TYPE_STRING:
-					if (prop_entry->value->string_value.length > 50) {
+					if (value->string_value.length > 50) {
 						printf("[%zu] \"%.*s\"...", 
-							prop_entry->value->string_value.length,
+							value->string_value.length,
 							50, 
-							prop_entry->value->string_value.data);
+							value->string_value.data);
 					} else {
-						printf("\"%s\"", prop_entry->value->string_value.data);
+						printf("\"%s\"", value->string_value.data);
 					}
 					break;
 				case RBX_TYPE_BOOLEAN:
-					if (prop_entry->value->boolean_value.data) {
+					if (value->boolean_value.data) {
 						printf("true");
 					} else {
 						printf("false");
 					}
 					break;
 				case RBX_TYPE_INT32:
-					printf("%u", prop_entry->value->int32_value.data);
+					printf("%u", value->int32_value.data);
 					break;
 				case RBX_TYPE_FLOAT:
-					printf("%f", prop_entry->value->float_value.data);
+					printf("%f", value->float_value.data);
 					break;
 				case RBX_TYPE_REAL:
-					printf("%f", prop_entry->value->real_value.data);
+					printf("%f", value->real_value.data);
 					break;
 				case RBX_TYPE_UDIM2:
 					printf("{(%f, %d), (%f, %d)}",
-						prop_entry->value->udim2_value.x.scale,
-						prop_entry->value->udim2_value.x.offset,
-						prop_entry->value->udim2_value.y.scale,
-						prop_entry->value->udim2_value.y.offset);
+						value->udim2_value.x.scale,
+						value->udim2_value.x.offset,
+						value->udim2_value.y.scale,
+						value->udim2_value.y.offset);
 					break;
 				case RBX_TYPE_BRICKCOLOR:
-					printf("BrickColor(%u)", prop_entry->value->brickcolor_value.data);
+					printf("BrickColor(%u)", value->brickcolor_value.data);
 					break;
 				case RBX_TYPE_COLOR3:
 					printf("Color3(%f, %f, %f)",
-						prop_entry->value->color3_value.r,
-						prop_entry->value->color3_value.g,
-						prop_entry->value->color3_value.b);
+						value->color3_value.r,
+						value->color3_value.g,
+						value->color3_value.b);
 					break;
 				case RBX_TYPE_VECTOR2:
 					printf("Vector2(%f, %f)",
-						prop_entry->value->vector2_value.x,
-						prop_entry->value->vector2_value.y);
+						value->vector2_value.x,
+						value->vector2_value.y);
 					break;
 				case RBX_TYPE_VECTOR3:
 					printf("Vector3(%f, %f, %f)",
-						prop_entry->value->vector3_value.x,
-						prop_entry->value->vector3_value.y,
-						prop_entry->value->vector3_value.z);
+						value->vector3_value.x,
+						value->vector3_value.y,
+						value->vector3_value.z);
 					break;
 				case RBX_TYPE_CFRAME:
 					printf("CFrame((%f, %f, %f), (%.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f))",
-						prop_entry->value->cframe_value.position.x,
-						prop_entry->value->cframe_value.position.y,
-						prop_entry->value->cframe_value.position.z,
-						prop_entry->value->cframe_value.rotation[0],
-						prop_entry->value->cframe_value.rotation[1],
-						prop_entry->value->cframe_value.rotation[2],
-						prop_entry->value->cframe_value.rotation[3],
-						prop_entry->value->cframe_value.rotation[4],
-						prop_entry->value->cframe_value.rotation[5],
-						prop_entry->value->cframe_value.rotation[6],
-						prop_entry->value->cframe_value.rotation[7],
-						prop_entry->value->cframe_value.rotation[8]);
+						value->cframe_value.position.x,
+						value->cframe_value.position.y,
+						value->cframe_value.position.z,
+						value->cframe_value.rotation[0],
+						value->cframe_value.rotation[1],
+						value->cframe_value.rotation[2],
+						value->cframe_value.rotation[3],
+						value->cframe_value.rotation[4],
+						value->cframe_value.rotation[5],
+						value->cframe_value.rotation[6],
+						value->cframe_value.rotation[7],
+						value->cframe_value.rotation[8]);
 					break;
 				case RBX_TYPE_TOKEN:
-					printf("EnumValue(%u)", prop_entry->value->token_value.data);
+					printf("EnumValue(%u)", value->token_value.data);
 					break;
 				case RBX_TYPE_REFERENT:
-					printf("Referent(%d)", prop_entry->value->referent_value.data);
+					printf("Referent(%d)", value->referent_value.data);
 					break;
 				case RBX_TYPE_OBJECT:
 					fflush(stdout);
-					if (prop_entry->value->object_value.data == NULL) {
+					if (value->object_value.data == NULL) {
 						printf("nil");
 					} else {
-						struct rbx_object *obj = prop_entry->value->object_value.data;
+						struct rbx_object *obj = value->object_value.data;
 						printf("<%s '%s' at %p>",
 							get_classname(obj),
 							get_name(obj),
@@ -189,13 +578,29 @@ int main(int argc, char *argv[]) {
 		// Is there cluster grid data?
 		if (cluster_grid != NULL) {
 			printf("Cluster grid data: %lu\n", cluster_grid->length);
-			struct rbx_terrain *data = translate_terrain(cluster_grid);
-			if (data) {
-				printf("Translated terrain, result:\n");
+			struct rbx_terrain_stats *stats = terrain_stats(cluster_grid);
+			if (stats) {
+				printf("Terrain stats: %u chunks, %llu of %llu voxels filled\n",
+					stats->chunk_count,
+					(unsigned long long)stats->filled_count,
+					(unsigned long long)stats->voxel_count);
+				if (stats->filled_count > 0) {
+					printf("Bounds: (%d, %d, %d) to (%d, %d, %d)\n",
+						stats->min_x, stats->min_y, stats->min_z,
+						stats->max_x, stats->max_y, stats->max_z);
+				}
+				for (uint32_t i = 0; i < 256; ++i) {
+					if (stats->material_histogram[i] > 0) {
+						printf("Material %3u: %llu\n", i,
+							(unsigned long long)stats->material_histogram[i]);
+					}
+				}
+				free_terrain_stats(stats);
 			} else {
-				printf("Failed to translate terrain.\n");
+				printf("Failed to read terrain stats.\n");
 			}
 		}
+		TRACE_END();
 
 		free_rbx_file(file);
 	} else {
@@ -203,4 +608,43 @@ int main(int argc, char *argv[]) {
 	}
 
 	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	/* Check args */
+	int status;
+	if (argc == 4 && 0 == strcmp(argv[1], "--diff")) {
+		status = diff_main(argv[2], argv[3]);
+	} else if (argc == 3 && 0 == strcmp(argv[1], "--duplicates")) {
+		status = duplicates_main(argv[2]);
+	} else if (argc == 3 && 0 == strcmp(argv[1], "--stats")) {
+		status = stats_main(argv[2]);
+	} else if (argc == 3 && 0 == strcmp(argv[1], "--analyze")) {
+		status = analyze_main(argv[2]);
+	} else if (argc == 4 && 0 == strcmp(argv[1], "--query")) {
+		status = query_main(argv[2], argv[3]);
+	} else if ((argc == 4 || argc == 5) && 0 == strcmp(argv[1], "--aggregate")) {
+		status = aggregate_main(argv[2], argv[3], argc == 5 ? argv[4] : NULL);
+	} else if (argc == 3 && 0 == strcmp(argv[1], "--terrain")) {
+		status = terrain_main(argv[2]);
+	} else if (argc == 2) {
+		status = dump_main(argv[1]);
+	} else {
+		printf("Bad arguments, usage: main filename\n"
+		       "                      main --diff filename_a filename_b\n"
+		       "                      main --duplicates filename\n"
+		       "                      main --stats filename\n"
+		       "                      main --analyze filename\n"
+		       "                      main --query 'expression' filename\n"
+		       "                      main --aggregate Property filename ['expression']\n"
+		       "                      main --terrain filename\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Traced builds write out everything that was recorded
+	const char *trace_file = getenv("RBX_TRACE_FILE");
+	TRACE_WRITE(trace_file ? trace_file : "trace.json");
+	(void)trace_file;
+
+	return status;
 }
\ No newline at end of file
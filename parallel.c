@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+#define MAX_THREADS 64
+
+/* Shared state of a parallel_for call */
+struct parallel_job {
+	parallel_fn fn;
+	void *context;
+	size_t count;
+	size_t grain;
+	size_t next; /* Start of the next block to hand out */
+	pthread_mutex_t lock;
+};
+
+unsigned parallel_thread_count(void) {
+	const char *env = getenv("RBX_THREADS");
+	long count = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1) {
+		count = 1;
+	} else if (count > MAX_THREADS) {
+		count = MAX_THREADS;
+	}
+	return (unsigned)count;
+}
+
+/* Worker loop, take blocks until there are none left */
+void *parallel_worker(void *arg) {
+	struct parallel_job *job = (struct parallel_job*)arg;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		size_t begin = job->next;
+		size_t end = begin + job->grain;
+		if (end > job->count) {
+			end = job->count;
+		}
+		job->next = end;
+		pthread_mutex_unlock(&job->lock);
+
+		if (begin >= end) {
+			return NULL;
+		}
+		job->fn(job->context, begin, end);
+	}
+}
+
+void parallel_for(size_t count, size_t grain, parallel_fn fn, void *context) {
+	if (grain == 0) {
+		grain = 1;
+	}
+
+	// Not worth spinning up threads for. A single block doesn't even ask
+	// how many there are, which goes to sysconf and is slow next to small
+	// jobs.
+	size_t block_count = (count + grain - 1) / grain;
+	unsigned thread_count = block_count > 1 ? parallel_thread_count() : 1;
+	if (thread_count > block_count) {
+		thread_count = (unsigned)block_count;
+	}
+	if (thread_count <= 1) {
+		if (count > 0) {
+			fn(context, 0, count);
+		}
+		return;
+	}
+
+	struct parallel_job job;
+	job.fn = fn;
+	job.context = context;
+	job.count = count;
+	job.grain = grain;
+	job.next = 0;
+	pthread_mutex_init(&job.lock, NULL);
+
+	// The calling thread works too, so start one less thread than we use.
+	// If a thread can't be started, the remaining ones pick up the slack.
+	pthread_t threads[MAX_THREADS];
+	unsigned started = 0;
+	for (unsigned i = 1; i < thread_count; ++i) {
+		if (0 != pthread_create(&threads[started], NULL, parallel_worker, &job)) {
+			break;
+		}
+		++started;
+	}
+	parallel_worker(&job);
+	for (unsigned i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&job.lock);
+}
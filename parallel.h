@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdlib.h>
+
+/* Work function for parallel_for, called with a sub-range [begin, end) of
+ * the items. It may be called from any of the worker threads. */
+typedef void (*parallel_fn)(void *context, size_t begin, size_t end);
+
+/* Number of threads that parallel_for will use
+ * - The number of online processors, or the RBX_THREADS environment
+ *   variable if it is set.
+ */
+unsigned parallel_thread_count(void);
+
+/* Run fn over the range [0, count) split into blocks of about grain items,
+ * handing the blocks out to a pool of threads as they become free. Returns
+ * once every block is done. Small ranges are run on the calling thread. */
+void parallel_for(size_t count, size_t grain, parallel_fn fn, void *context);
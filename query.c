@@ -0,0 +1,718 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "query.h"
+#include "parallel.h"
+#include "spatial.h"
+
+/* Selection words compared per parallel work item */
+#define COMPARE_BLOCK 256
+
+/******************************************************************************
+ * Parsing
+ */
+
+struct query_parser {
+	const char *text;
+	const char *pos;
+	char *error;
+	size_t error_size;
+	int failed;
+};
+
+/* Record the first error of a parse */
+void query_error(struct query_parser *parser, const char *message) {
+	if (!parser->failed) {
+		snprintf(parser->error, parser->error_size, "%s at position %zu",
+			message, (size_t)(parser->pos - parser->text) + 1);
+		parser->failed = 1;
+	}
+}
+
+void skip_space(struct query_parser *parser) {
+	while (isspace((unsigned char)*parser->pos)) {
+		++parser->pos;
+	}
+}
+
+int is_name_char(char c) {
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Take a keyword if it's next, ignoring case */
+int match_word(struct query_parser *parser, const char *word) {
+	skip_space(parser);
+	size_t length = strlen(word);
+	if (0 == strncasecmp(parser->pos, word, length) && !is_name_char(parser->pos[length])) {
+		parser->pos += length;
+		return 1;
+	}
+	return 0;
+}
+
+/* Take a symbol if it's next */
+int match_symbol(struct query_parser *parser, const char *symbol) {
+	skip_space(parser);
+	size_t length = strlen(symbol);
+	if (0 == strncmp(parser->pos, symbol, length)) {
+		parser->pos += length;
+		return 1;
+	}
+	return 0;
+}
+
+/* Take a comparison operator, returns 0 if there isn't one */
+int match_operator(struct query_parser *parser, uint8_t *op) {
+	// Two character operators first, so that < doesn't take <=
+	static const char *symbols[] = {"==", "!=", "<=", ">=", "<", ">"};
+	static const uint8_t ops[] = {RBX_QUERY_EQ, RBX_QUERY_NE, RBX_QUERY_LE,
+	                              RBX_QUERY_GE, RBX_QUERY_LT, RBX_QUERY_GT};
+	for (int i = 0; i < 6; ++i) {
+		if (match_symbol(parser, symbols[i])) {
+			*op = ops[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Take a name, NULL if there isn't one. Free it with free. */
+char *read_name(struct query_parser *parser) {
+	skip_space(parser);
+	const char *start = parser->pos;
+	while (is_name_char(*parser->pos)) {
+		++parser->pos;
+	}
+	if (parser->pos == start) {
+		return NULL;
+	}
+	size_t length = parser->pos - start;
+	char *name = (char*)malloc(length + 1);
+	if (name != NULL) {
+		memcpy(name, start, length);
+		name[length] = '\0';
+	}
+	return name;
+}
+
+/* Take a quoted string, with \" and \\ escapes. Returns NULL if there
+ * isn't one. */
+char *read_quoted(struct query_parser *parser, size_t *length) {
+	skip_space(parser);
+	if (*parser->pos != '"') {
+		return NULL;
+	}
+	const char *start = ++parser->pos;
+	while (*parser->pos != '"') {
+		if (*parser->pos == '\0') {
+			query_error(parser, "unterminated string");
+			return NULL;
+		}
+		parser->pos += (parser->pos[0] == '\\' && parser->pos[1] != '\0') ? 2 : 1;
+	}
+
+	// Copy it without the escapes, it can only get shorter
+	char *string = (char*)malloc(parser->pos - start + 1);
+	if (string == NULL) {
+		return NULL;
+	}
+	size_t count = 0;
+	for (const char *c = start; c < parser->pos; ++c) {
+		if (*c == '\\') {
+			++c;
+		}
+		string[count++] = *c;
+	}
+	string[count] = '\0';
+	*length = count;
+	++parser->pos;
+	return string;
+}
+
+struct rbx_query *new_node(struct query_parser *parser, uint8_t kind) {
+	struct rbx_query *node = (struct rbx_query*)calloc(1, sizeof(struct rbx_query));
+	if (node == NULL) {
+		query_error(parser, "out of memory");
+		return NULL;
+	}
+	node->kind = kind;
+	return node;
+}
+
+/* Read the literal of a comparison into node */
+int read_literal(struct query_parser *parser, struct rbx_query *node) {
+	skip_space(parser);
+	if (*parser->pos == '"') {
+		node->literal_kind = RBX_LITERAL_STRING;
+		node->string = read_quoted(parser, &node->length);
+		return node->string != NULL;
+	} else if (match_word(parser, "true")) {
+		node->literal_kind = RBX_LITERAL_BOOLEAN;
+		node->number = 1;
+		return 1;
+	} else if (match_word(parser, "false")) {
+		node->literal_kind = RBX_LITERAL_BOOLEAN;
+		node->number = 0;
+		return 1;
+	} else if (match_word(parser, "nil")) {
+		node->literal_kind = RBX_LITERAL_NIL;
+		return 1;
+	}
+
+	char *end;
+	node->number = strtod(parser->pos, &end);
+	if (end == parser->pos) {
+		query_error(parser, "expected a number, string, true, false or nil");
+		return 0;
+	}
+	node->literal_kind = RBX_LITERAL_NUMBER;
+	parser->pos = end;
+	return 1;
+}
+
+struct rbx_query *parse_or(struct query_parser *parser);
+
+/* class IsA Name, class == Name, class != Name, or Property op literal */
+struct rbx_query *parse_predicate(struct query_parser *parser) {
+	char *name = read_name(parser);
+	if (name == NULL) {
+		query_error(parser, "expected a property name, class, not or (");
+		return NULL;
+	}
+
+	struct rbx_query *node = NULL;
+	if (0 == strcmp(name, "class") || 0 == strcmp(name, "ClassName")) {
+		free(name);
+		uint8_t op = RBX_QUERY_EQ;
+		if (match_word(parser, "IsA")) {
+			node = new_node(parser, RBX_QUERY_ISA);
+		} else if (match_operator(parser, &op) && (op == RBX_QUERY_EQ || op == RBX_QUERY_NE)) {
+			node = new_node(parser, RBX_QUERY_CLASS);
+		} else {
+			query_error(parser, "expected IsA, == or != after class");
+			return NULL;
+		}
+		if (node == NULL) {
+			return NULL;
+		}
+		node->op = op;
+
+		// The class name, quoted or not
+		size_t length;
+		skip_space(parser);
+		node->name = (*parser->pos == '"') ? read_quoted(parser, &length) : read_name(parser);
+		if (node->name == NULL) {
+			query_error(parser, "expected a class name");
+			free_query(node);
+			return NULL;
+		}
+		return node;
+	}
+
+	node = new_node(parser, RBX_QUERY_COMPARE);
+	if (node == NULL) {
+		free(name);
+		return NULL;
+	}
+	node->name = name;
+	if (!match_operator(parser, &node->op)) {
+		query_error(parser, "expected ==, !=, <, <=, > or >=");
+		free_query(node);
+		return NULL;
+	}
+	if (!read_literal(parser, node)) {
+		free_query(node);
+		return NULL;
+	}
+	if ((node->literal_kind == RBX_LITERAL_BOOLEAN || node->literal_kind == RBX_LITERAL_NIL) &&
+	    node->op != RBX_QUERY_EQ && node->op != RBX_QUERY_NE) {
+		query_error(parser, "true, false and nil can only be compared with == and !=");
+		free_query(node);
+		return NULL;
+	}
+	return node;
+}
+
+/* not factor, ( expression ) or a predicate */
+struct rbx_query *parse_factor(struct query_parser *parser) {
+	if (match_word(parser, "not")) {
+		struct rbx_query *operand = parse_factor(parser);
+		if (operand == NULL) {
+			return NULL;
+		}
+		struct rbx_query *node = new_node(parser, RBX_QUERY_NOT);
+		if (node == NULL) {
+			free_query(operand);
+			return NULL;
+		}
+		node->left = operand;
+		return node;
+	} else if (match_symbol(parser, "(")) {
+		struct rbx_query *node = parse_or(parser);
+		if (node != NULL && !match_symbol(parser, ")")) {
+			query_error(parser, "expected )");
+			free_query(node);
+			return NULL;
+		}
+		return node;
+	}
+	return parse_predicate(parser);
+}
+
+/* Operands joined by a keyword, left to right */
+struct rbx_query *parse_chain(struct query_parser *parser, const char *word, uint8_t kind,
+                              struct rbx_query *(*parse_operand)(struct query_parser*)) {
+	struct rbx_query *node = parse_operand(parser);
+	while (node != NULL && match_word(parser, word)) {
+		struct rbx_query *right = parse_operand(parser);
+		struct rbx_query *joined = right ? new_node(parser, kind) : NULL;
+		if (joined == NULL) {
+			free_query(node);
+			free_query(right);
+			return NULL;
+		}
+		joined->left = node;
+		joined->right = right;
+		node = joined;
+	}
+	return node;
+}
+
+struct rbx_query *parse_and(struct query_parser *parser) {
+	return parse_chain(parser, "and", RBX_QUERY_AND, parse_factor);
+}
+
+struct rbx_query *parse_or(struct query_parser *parser) {
+	return parse_chain(parser, "or", RBX_QUERY_OR, parse_and);
+}
+
+struct rbx_query *parse_query(const char *text, char *error, size_t error_size) {
+	struct query_parser parser;
+	parser.text = text;
+	parser.pos = text;
+	parser.error = error;
+	parser.error_size = error_size;
+	parser.failed = 0;
+
+	struct rbx_query *query = parse_or(&parser);
+	skip_space(&parser);
+	if (query != NULL && *parser.pos != '\0') {
+		query_error(&parser, "expected and, or or the end of the query");
+		free_query(query);
+		return NULL;
+	}
+	if (query == NULL) {
+		query_error(&parser, "out of memory");
+	}
+	return query;
+}
+
+void free_query(struct rbx_query *query) {
+	if (query != NULL) {
+		free_query(query->left);
+		free_query(query->right);
+		free(query->name);
+		free(query->string);
+		free(query);
+	}
+}
+
+/******************************************************************************
+ * Classes
+ */
+
+/* Subclasses of the abstract classes that IsA knows about, other than
+ * BasePart and Instance */
+struct isa_entry {
+	const char *base;
+	const char *name;
+};
+const struct isa_entry isa_table[] = {
+	{"Model", "Workspace"},
+	{"LuaSourceContainer", "Script"},
+	{"LuaSourceContainer", "LocalScript"},
+	{"LuaSourceContainer", "ModuleScript"},
+	{"BaseScript", "Script"},
+	{"BaseScript", "LocalScript"},
+	{"Light", "PointLight"},
+	{"Light", "SpotLight"},
+	{"Light", "SurfaceLight"},
+	{"ValueBase", "BoolValue"},
+	{"ValueBase", "BrickColorValue"},
+	{"ValueBase", "CFrameValue"},
+	{"ValueBase", "Color3Value"},
+	{"ValueBase", "IntValue"},
+	{"ValueBase", "NumberValue"},
+	{"ValueBase", "ObjectValue"},
+	{"ValueBase", "RayValue"},
+	{"ValueBase", "StringValue"},
+	{"ValueBase", "Vector3Value"},
+};
+
+int class_is_a(struct rbx_object_class *type, const char *base) {
+	const char *name = (const char*)type->name.data;
+	if (0 == strcmp(name, base) || 0 == strcmp(base, "Instance")) {
+		return 1;
+	}
+	if (0 == strcmp(base, "BasePart")) {
+		struct rbx_object_prop *cframe, *size;
+		return get_part_columns(type, &cframe, &size);
+	}
+	for (size_t i = 0; i < sizeof(isa_table)/sizeof(isa_table[0]); ++i) {
+		if (0 == strcmp(isa_table[i].base, base) && 0 == strcmp(isa_table[i].name, name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/******************************************************************************
+ * Comparisons
+ */
+
+int compare_number(uint8_t op, double a, double b) {
+	switch (op) {
+	case RBX_QUERY_EQ: return a == b;
+	case RBX_QUERY_NE: return a != b;
+	case RBX_QUERY_LT: return a < b;
+	case RBX_QUERY_LE: return a <= b;
+	case RBX_QUERY_GT: return a > b;
+	case RBX_QUERY_GE: return a >= b;
+	default:           return 0;
+	}
+}
+
+int compare_float(uint8_t op, float a, float b) {
+	switch (op) {
+	case RBX_QUERY_EQ: return a == b;
+	case RBX_QUERY_NE: return a != b;
+	case RBX_QUERY_LT: return a < b;
+	case RBX_QUERY_LE: return a <= b;
+	case RBX_QUERY_GT: return a > b;
+	case RBX_QUERY_GE: return a >= b;
+	default:           return 0;
+	}
+}
+
+/* Test a value against a COMPARE node, the rbx_value_predicate used for
+ * the columns that aren't compared in bulk */
+int compare_value(struct rbx_value *value, void *user) {
+	struct rbx_query *query = (struct rbx_query*)user;
+	uint8_t literal = query->literal_kind;
+	switch (value->type) {
+	case RBX_TYPE_INT32:
+		return literal == RBX_LITERAL_NUMBER &&
+			compare_number(query->op, value->int32_value.data, query->number);
+	case RBX_TYPE_FLOAT:
+		return literal == RBX_LITERAL_NUMBER &&
+			compare_float(query->op, value->float_value.data, (float)query->number);
+	case RBX_TYPE_REAL:
+		return literal == RBX_LITERAL_NUMBER &&
+			compare_number(query->op, value->real_value.data, query->number);
+	case RBX_TYPE_TOKEN:
+		return literal == RBX_LITERAL_NUMBER &&
+			compare_number(query->op, value->token_value.data, query->number);
+	case RBX_TYPE_BRICKCOLOR:
+		return literal == RBX_LITERAL_NUMBER &&
+			compare_number(query->op, value->brickcolor_value.data, query->number);
+	case RBX_TYPE_BOOLEAN:
+		return literal == RBX_LITERAL_BOOLEAN &&
+			compare_number(query->op, value->boolean_value.data != 0, query->number);
+	case RBX_TYPE_OBJECT:
+		return literal == RBX_LITERAL_NIL &&
+			compare_number(query->op, value->object_value.data != NULL, 0);
+	case RBX_TYPE_STRING: {
+		if (literal != RBX_LITERAL_STRING) {
+			return 0;
+		}
+		struct rbx_string *string = &value->string_value;
+		size_t length = string->length < query->length ? string->length : query->length;
+		int order = memcmp(string->data, query->string, length);
+		if (order == 0) {
+			order = (string->length > query->length) - (string->length < query->length);
+		}
+		return compare_number(query->op, order, 0);
+	}
+	default:
+		return 0;
+	}
+}
+
+#ifdef __SSE2__
+__m128 compare_ps(uint8_t op, __m128 a, __m128 b) {
+	switch (op) {
+	case RBX_QUERY_EQ: return _mm_cmpeq_ps(a, b);
+	case RBX_QUERY_NE: return _mm_cmpneq_ps(a, b);
+	case RBX_QUERY_LT: return _mm_cmplt_ps(a, b);
+	case RBX_QUERY_LE: return _mm_cmple_ps(a, b);
+	case RBX_QUERY_GT: return _mm_cmpgt_ps(a, b);
+	default:           return _mm_cmpge_ps(a, b);
+	}
+}
+
+__m128d compare_pd(uint8_t op, __m128d a, __m128d b) {
+	switch (op) {
+	case RBX_QUERY_EQ: return _mm_cmpeq_pd(a, b);
+	case RBX_QUERY_NE: return _mm_cmpneq_pd(a, b);
+	case RBX_QUERY_LT: return _mm_cmplt_pd(a, b);
+	case RBX_QUERY_LE: return _mm_cmple_pd(a, b);
+	case RBX_QUERY_GT: return _mm_cmpgt_pd(a, b);
+	default:           return _mm_cmpge_pd(a, b);
+	}
+}
+#endif
+
+/* A plain numeric column being compared in bulk */
+struct compare_context {
+	struct rbx_object_prop *prop;
+	struct rbx_query *query;
+	uint64_t *selection;
+};
+
+/* Compare a range of selection words worth of values. The values sit in
+ * the low bytes of their 8 byte slots, so vectors of them are gathered
+ * from pairs of slots with a shuffle. */
+void compare_words(void *context, size_t begin, size_t end) {
+	struct compare_context *ctx = (struct compare_context*)context;
+	struct rbx_object_prop *prop = ctx->prop;
+	union rbx_slot *slots = prop->slot_array;
+	uint8_t op = ctx->query->op;
+	double number = ctx->query->number;
+
+	for (size_t w = begin; w < end; ++w) {
+		uint32_t first = (uint32_t)(w*64);
+		uint32_t last = first + 64 < prop->value_count ? first + 64 : prop->value_count;
+		uint32_t i = first;
+		uint64_t word = 0;
+		if (prop->value_type == RBX_TYPE_FLOAT) {
+#ifdef __SSE2__
+			const __m128 literal = _mm_set1_ps((float)number);
+			for (; i + 4 <= last; i += 4) {
+				__m128 a = _mm_loadu_ps((const float*)&slots[i]);
+				__m128 b = _mm_loadu_ps((const float*)&slots[i + 2]);
+				__m128 values = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+				uint64_t mask = _mm_movemask_ps(compare_ps(op, values, literal));
+				word |= mask << (i - first);
+			}
+#endif
+			for (; i < last; ++i) {
+				word |= (uint64_t)compare_float(op, slots[i].float_value.data,
+					(float)number) << (i - first);
+			}
+		} else if (prop->value_type == RBX_TYPE_INT32) {
+#ifdef __SSE2__
+			const __m128d literal = _mm_set1_pd(number);
+			for (; i + 4 <= last; i += 4) {
+				__m128 a = _mm_loadu_ps((const float*)&slots[i]);
+				__m128 b = _mm_loadu_ps((const float*)&slots[i + 2]);
+				__m128i values = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				__m128d low = _mm_cvtepi32_pd(values);
+				__m128d high = _mm_cvtepi32_pd(_mm_shuffle_epi32(values, _MM_SHUFFLE(1, 0, 3, 2)));
+				uint64_t mask = _mm_movemask_pd(compare_pd(op, low, literal)) |
+				                (_mm_movemask_pd(compare_pd(op, high, literal)) << 2);
+				word |= mask << (i - first);
+			}
+#endif
+			for (; i < last; ++i) {
+				word |= (uint64_t)compare_number(op, slots[i].int32_value.data,
+					number) << (i - first);
+			}
+		} else {
+#ifdef __SSE2__
+			const __m128d literal = _mm_set1_pd(number);
+			for (; i + 2 <= last; i += 2) {
+				__m128d values = _mm_loadu_pd((const double*)&slots[i]);
+				uint64_t mask = _mm_movemask_pd(compare_pd(op, values, literal));
+				word |= mask << (i - first);
+			}
+#endif
+			for (; i < last; ++i) {
+				word |= (uint64_t)compare_number(op, slots[i].real_value.data,
+					number) << (i - first);
+			}
+		}
+		ctx->selection[w] = word;
+	}
+}
+
+/* Select the objects of a class matching a COMPARE node */
+void select_compare(struct rbx_object_class *type, struct rbx_query *query,
+                    uint64_t *selection) {
+	struct rbx_object_prop *prop = type->prop_list;
+	while (prop != NULL && 0 != strcmp((const char*)prop->name.data, query->name)) {
+		prop = prop->next;
+	}
+	if (prop == NULL) {
+		memset(selection, 0x0, sizeof(uint64_t)*RBX_SELECTION_WORDS(type->object_count));
+		return;
+	}
+
+	uint8_t type_id = prop->value_type;
+	if (prop->encoding == RBX_ENCODING_PLAIN && query->literal_kind == RBX_LITERAL_NUMBER &&
+	    (type_id == RBX_TYPE_FLOAT || type_id == RBX_TYPE_INT32 || type_id == RBX_TYPE_REAL)) {
+		struct compare_context ctx;
+		ctx.prop = prop;
+		ctx.query = query;
+		ctx.selection = selection;
+		memset(selection, 0x0, sizeof(uint64_t)*RBX_SELECTION_WORDS(type->object_count));
+		parallel_for(RBX_SELECTION_WORDS(prop->value_count), COMPARE_BLOCK,
+			compare_words, &ctx);
+	} else {
+		rbx_prop_select(prop, compare_value, query, selection);
+	}
+}
+
+/******************************************************************************
+ * Running
+ */
+
+/* Select every object of a class, or none of them */
+void select_all(uint64_t *selection, uint32_t count, int all) {
+	size_t words = RBX_SELECTION_WORDS(count);
+	memset(selection, all ? 0xFF : 0x0, sizeof(uint64_t)*words);
+	if (all && count % 64 != 0) {
+		selection[words - 1] = ((uint64_t)1 << (count % 64)) - 1;
+	}
+}
+
+/* Evaluate a query over the objects of a class, returns 0 on allocation
+ * failure */
+int select_query(struct rbx_object_class *type, struct rbx_query *query, uint64_t *selection) {
+	uint32_t count = type->object_count;
+	size_t words = RBX_SELECTION_WORDS(count);
+	switch (query->kind) {
+	case RBX_QUERY_AND:
+	case RBX_QUERY_OR: {
+		if (!select_query(type, query->left, selection)) {
+			return 0;
+		}
+
+		// Skip the right side if the left decides it
+		uint32_t selected = rbx_selection_count(selection, count);
+		if (query->kind == RBX_QUERY_AND ? selected == 0 : selected == count) {
+			return 1;
+		}
+		uint64_t *right = (uint64_t*)malloc(sizeof(uint64_t)*(words + 1));
+		if (right == NULL || !select_query(type, query->right, right)) {
+			free(right);
+			return 0;
+		}
+		if (query->kind == RBX_QUERY_AND) {
+			rbx_selection_and(selection, right, count);
+		} else {
+			rbx_selection_or(selection, right, count);
+		}
+		free(right);
+		return 1;
+	}
+	case RBX_QUERY_NOT: {
+		uint64_t *operand = (uint64_t*)malloc(sizeof(uint64_t)*(words + 1));
+		if (operand == NULL || !select_query(type, query->left, operand)) {
+			free(operand);
+			return 0;
+		}
+		select_all(selection, count, 1);
+		rbx_selection_andnot(selection, operand, count);
+		free(operand);
+		return 1;
+	}
+	case RBX_QUERY_ISA:
+		select_all(selection, count, class_is_a(type, query->name));
+		return 1;
+	case RBX_QUERY_CLASS:
+		select_all(selection, count,
+			(0 == strcmp((const char*)type->name.data, query->name)) == (query->op == RBX_QUERY_EQ));
+		return 1;
+	case RBX_QUERY_COMPARE:
+		select_compare(type, query, selection);
+		return 1;
+	default:
+		select_all(selection, count, 0);
+		return 1;
+	}
+}
+
+struct rbx_query_result *query_objects(struct rbx_file *file, struct rbx_query *query) {
+	struct rbx_query_result *result =
+		(struct rbx_query_result*)calloc(1, sizeof(struct rbx_query_result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	size_t total_words = 0;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		total_words += RBX_SELECTION_WORDS(file->type_array[i].object_count);
+	}
+	result->selection_storage = (uint64_t*)malloc(sizeof(uint64_t)*(total_words + 1));
+	result->selection_array = (uint64_t**)malloc(sizeof(uint64_t*)*(file->type_count + 1));
+	if (!result->selection_storage || !result->selection_array) {
+		free_query_result(result);
+		return NULL;
+	}
+
+	// A class at a time
+	uint64_t *selection = result->selection_storage;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type = &file->type_array[i];
+		result->selection_array[i] = selection;
+		if (!select_query(type, query, selection)) {
+			free_query_result(result);
+			return NULL;
+		}
+		result->object_count += rbx_selection_count(selection, type->object_count);
+		selection += RBX_SELECTION_WORDS(type->object_count);
+	}
+
+	// Gather up the objects in referent order, through a selection of
+	// every object in the file
+	uint64_t *matched = (uint64_t*)calloc(RBX_SELECTION_WORDS(file->object_count) + 1,
+		sizeof(uint64_t));
+	result->object_array =
+		(struct rbx_object**)malloc(sizeof(struct rbx_object*)*(result->object_count + 1));
+	if (matched == NULL || result->object_array == NULL) {
+		free(matched);
+		free_query_result(result);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_class *type = &file->type_array[i];
+		uint64_t *selection = result->selection_array[i];
+		for (uint32_t j = 0; j < type->object_count; ++j) {
+			if (selection[j/64] == 0) {
+				j |= 63;
+			} else if ((selection[j/64] >> (j % 64)) & 1) {
+				uint32_t referent = type->object_referent_array[j];
+				matched[referent/64] |= (uint64_t)1 << (referent % 64);
+			}
+		}
+	}
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < file->object_count; ++i) {
+		if (matched[i/64] == 0) {
+			i |= 63;
+		} else if ((matched[i/64] >> (i % 64)) & 1) {
+			result->object_array[count++] = &file->object_array[i];
+		}
+	}
+	free(matched);
+
+	return result;
+}
+
+void free_query_result(struct rbx_query_result *result) {
+	if (result != NULL) {
+		free(result->object_array);
+		free(result->selection_array);
+		free(result->selection_storage);
+		free(result);
+	}
+}
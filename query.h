@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rbx_types.h"
+#include "fmt_rbx.h"
+
+/* Queries over the objects of a file
+ * - A query is a boolean expression of predicates, such as
+ *     class IsA BasePart and (Transparency > 0.9 or not Anchored == true)
+ *   where a predicate is one of
+ *     class IsA Name, class == Name, class != Name
+ *     Property op literal, op being ==, !=, <, <=, > or >=
+ *   and literals are numbers, "strings", true, false and nil. and, or and
+ *   not bind in the usual order, and parentheses group.
+ * - There is no class database, so IsA only knows about a few base
+ *   classes: BasePart is any class with a CFrame and a Vector3 Size (see
+ *   get_part_columns), Instance is every class, and otherwise the class
+ *   itself and a short list of known subclasses match.
+ * - Queries are run a class at a time, a column at a time, into selections
+ *   of the objects of the class (see RBX_SELECTION_WORDS) that are then
+ *   combined a word at a time. Plain numeric columns are compared 4 values
+ *   at a time with SSE when it's available, in parallel for big columns,
+ *   and encoded columns once per slot (see rbx_prop_select).
+ * - A comparison never matches an object without the property, or with a
+ *   property of a type the literal can't be compared with. Numbers compare
+ *   with Int32, Float, Real, Token and BrickColor values, strings with
+ *   String values, true and false with Boolean values and nil with object
+ *   references, only by == and != for the last two. Float values compare
+ *   with the number rounded to a float, so Transparency == 0.9 matches.
+ */
+
+/* Kinds of query node */
+#define RBX_QUERY_AND     0x1
+#define RBX_QUERY_OR      0x2
+#define RBX_QUERY_NOT     0x3
+#define RBX_QUERY_ISA     0x4
+#define RBX_QUERY_CLASS   0x5 /* class == Name, or != with op */
+#define RBX_QUERY_COMPARE 0x6
+
+/* Comparison operators */
+#define RBX_QUERY_EQ 0x0
+#define RBX_QUERY_NE 0x1
+#define RBX_QUERY_LT 0x2
+#define RBX_QUERY_LE 0x3
+#define RBX_QUERY_GT 0x4
+#define RBX_QUERY_GE 0x5
+
+/* Kinds of literal */
+#define RBX_LITERAL_NUMBER  0x1
+#define RBX_LITERAL_STRING  0x2
+#define RBX_LITERAL_BOOLEAN 0x3
+#define RBX_LITERAL_NIL     0x4
+
+/* A parsed query, as a tree of nodes */
+struct rbx_query {
+	uint8_t kind;              /* RBX_QUERY_* */
+	uint8_t op;                /* RBX_QUERY_EQ etc. for CLASS and COMPARE */
+	struct rbx_query *left;    /* Operands of AND and OR, NOT has only left */
+	struct rbx_query *right;
+	char *name;                /* Class or property name */
+
+	/* The literal of a COMPARE */
+	uint8_t literal_kind;      /* RBX_LITERAL_* */
+	double number;             /* Also 0 or 1 for booleans */
+	char *string;
+	size_t length;
+};
+
+/* Parse a query, NULL if it isn't valid, with a message saying why written
+ * to error. */
+struct rbx_query *parse_query(const char *text, char *error, size_t error_size);
+
+void free_query(struct rbx_query *query);
+
+/* The objects a query matched */
+struct rbx_query_result {
+	uint32_t object_count;
+	struct rbx_object **object_array; /* In referent order */
+
+	/* The matches of each class, indexed like the file's type_array */
+	uint64_t **selection_array;
+	uint64_t *selection_storage;
+};
+
+/* Run a query over a file, NULL on allocation failure */
+struct rbx_query_result *query_objects(struct rbx_file *file, struct rbx_query *query);
+
+void free_query_result(struct rbx_query_result *result);
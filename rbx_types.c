@@ -1,2 +1,301 @@
+#include <stdint.h>
+#include <string.h>
 
-#include "rbx_types.h"
\ No newline at end of file
+#include "rbx_types.h"
+
+const char *rbx_type_name(uint8_t type) {
+	switch (type) {
+	case RBX_TYPE_STRING:     return "String";
+	case RBX_TYPE_BOOLEAN:    return "Boolean";
+	case RBX_TYPE_INT32:      return "Int32";
+	case RBX_TYPE_FLOAT:      return "Float";
+	case RBX_TYPE_REAL:       return "Real";
+	case RBX_TYPE_UDIM2:      return "UDim2";
+	case RBX_TYPE_RAY:        return "Ray";
+	case RBX_TYPE_FACES:      return "Faces";
+	case RBX_TYPE_AXIS:       return "Axis";
+	case RBX_TYPE_BRICKCOLOR: return "BrickColor";
+	case RBX_TYPE_COLOR3:     return "Color3";
+	case RBX_TYPE_VECTOR2:    return "Vector2";
+	case RBX_TYPE_VECTOR3:    return "Vector3";
+	case RBX_TYPE_CFRAME:     return "CFrame";
+	case RBX_TYPE_TOKEN:      return "Token";
+	case RBX_TYPE_REFERENT:   return "Referent";
+	case RBX_TYPE_OBJECT:     return "Object";
+	default:                  return "Unknown";
+	}
+}
+
+const uint8_t rbx_rotation_ids[RBX_ROTATION_ID_COUNT] = {
+	0x02, 0x03, 0x05, 0x06, 0x07, 0x09, 0x0A, 0x0C, 0x0D, 0x0E, 0x10, 0x11,
+	0x14, 0x15, 0x17, 0x18, 0x19, 0x1B, 0x1C, 0x1E, 0x1F, 0x20, 0x22, 0x23,
+};
+
+size_t rbx_pool_stride(uint8_t type) {
+	switch (type) {
+	case RBX_TYPE_STRING:  return sizeof(struct rbx_string);
+	case RBX_TYPE_UDIM2:   return sizeof(struct rbx_udim2);
+	case RBX_TYPE_RAY:     return sizeof(struct rbx_ray);
+	case RBX_TYPE_COLOR3:  return sizeof(struct rbx_color3);
+	case RBX_TYPE_VECTOR3: return sizeof(struct rbx_vector3);
+	case RBX_TYPE_CFRAME:  return sizeof(struct rbx_cframe);
+	default:               return 0;
+	}
+}
+
+/* Index of the slot of a value, index must be below value_count */
+uint32_t slot_index(struct rbx_object_prop *prop, uint32_t index) {
+	if (prop->encoding == RBX_ENCODING_CONSTANT) {
+		return 0;
+	} else if (prop->encoding == RBX_ENCODING_RUNS) {
+		// First run that ends after index
+		uint32_t low = 0, high = prop->slot_count - 1;
+		while (low < high) {
+			uint32_t mid = low + (high - low)/2;
+			if (prop->run_end_array[mid] > index) {
+				high = mid;
+			} else {
+				low = mid + 1;
+			}
+		}
+		return low;
+	} else if (prop->encoding == RBX_ENCODING_DICTIONARY) {
+		return prop->code_array[index];
+	} else if (prop->encoding == RBX_ENCODING_BITS) {
+		return (prop->bit_array[index/64] >> (index % 64)) & 1;
+	}
+	return index;
+}
+
+union rbx_slot *rbx_prop_slot(struct rbx_object_prop *prop, uint32_t index) {
+	if (index >= prop->value_count) {
+		return NULL;
+	}
+	return &prop->slot_array[slot_index(prop, index)];
+}
+
+/* Pool entry of a value, NULL if there's no value at that index */
+void *pooled_value(struct rbx_object_prop *prop, uint32_t index) {
+	union rbx_slot *slot = rbx_prop_slot(prop, index);
+	if (slot == NULL) {
+		return NULL;
+	}
+	size_t stride = rbx_pool_stride(prop->value_type);
+	return (uint8_t*)prop->pool + stride*slot->pool_index;
+}
+
+struct rbx_value *rbx_slot_get(struct rbx_object_prop *prop, union rbx_slot *slot,
+                               struct rbx_value *value) {
+	void *pooled = (uint8_t*)prop->pool + rbx_pool_stride(prop->value_type)*slot->pool_index;
+	value->type = prop->value_type;
+	switch (prop->value_type) {
+	case RBX_TYPE_STRING:
+		value->string_value = *(struct rbx_string*)pooled;
+		break;
+	case RBX_TYPE_BOOLEAN:
+		value->boolean_value = slot->boolean_value;
+		break;
+	case RBX_TYPE_INT32:
+		value->int32_value = slot->int32_value;
+		break;
+	case RBX_TYPE_FLOAT:
+		value->float_value = slot->float_value;
+		break;
+	case RBX_TYPE_REAL:
+		value->real_value = slot->real_value;
+		break;
+	case RBX_TYPE_UDIM2:
+		value->udim2_value = *(struct rbx_udim2*)pooled;
+		break;
+	case RBX_TYPE_RAY:
+		value->ray_value = *(struct rbx_ray*)pooled;
+		break;
+	case RBX_TYPE_FACES:
+		value->faces_value = slot->faces_value;
+		break;
+	case RBX_TYPE_AXIS:
+		value->axis_value = slot->axis_value;
+		break;
+	case RBX_TYPE_BRICKCOLOR:
+		value->brickcolor_value = slot->brickcolor_value;
+		break;
+	case RBX_TYPE_COLOR3:
+		value->color3_value = *(struct rbx_color3*)pooled;
+		break;
+	case RBX_TYPE_VECTOR2:
+		value->vector2_value = slot->vector2_value;
+		break;
+	case RBX_TYPE_VECTOR3:
+		value->vector3_value = *(struct rbx_vector3*)pooled;
+		break;
+	case RBX_TYPE_CFRAME:
+		value->cframe_value = *(struct rbx_cframe*)pooled;
+		break;
+	case RBX_TYPE_TOKEN:
+		value->token_value = slot->token_value;
+		break;
+	case RBX_TYPE_REFERENT:
+		value->referent_value = slot->referent_value;
+		break;
+	case RBX_TYPE_OBJECT:
+		value->object_value = slot->object_value;
+		break;
+	default:
+		return NULL;
+	}
+	return value;
+}
+
+struct rbx_value *rbx_prop_get(struct rbx_object_prop *prop, uint32_t index,
+                               struct rbx_value *value) {
+	union rbx_slot *slot = rbx_prop_slot(prop, index);
+	if (slot == NULL) {
+		return NULL;
+	}
+	return rbx_slot_get(prop, slot, value);
+}
+
+struct rbx_string *rbx_prop_string(struct rbx_object_prop *prop, uint32_t index) {
+	return (struct rbx_string*)pooled_value(prop, index);
+}
+
+struct rbx_vector3 *rbx_prop_vector3(struct rbx_object_prop *prop, uint32_t index) {
+	return (struct rbx_vector3*)pooled_value(prop, index);
+}
+
+struct rbx_cframe *rbx_prop_cframe(struct rbx_object_prop *prop, uint32_t index) {
+	return (struct rbx_cframe*)pooled_value(prop, index);
+}
+
+struct rbx_value *rbx_entry_get(struct rbx_object_propentry *entry, struct rbx_value *value) {
+	return rbx_prop_get(entry->prop, entry->index, value);
+}
+
+void rbx_selection_and(uint64_t *dst, const uint64_t *src, uint32_t count) {
+	for (size_t i = 0; i < RBX_SELECTION_WORDS(count); ++i) {
+		dst[i] &= src[i];
+	}
+}
+
+void rbx_selection_or(uint64_t *dst, const uint64_t *src, uint32_t count) {
+	for (size_t i = 0; i < RBX_SELECTION_WORDS(count); ++i) {
+		dst[i] |= src[i];
+	}
+}
+
+void rbx_selection_andnot(uint64_t *dst, const uint64_t *src, uint32_t count) {
+	for (size_t i = 0; i < RBX_SELECTION_WORDS(count); ++i) {
+		dst[i] &= ~src[i];
+	}
+}
+
+/* Bits set in a word */
+uint32_t popcount_64(uint64_t x) {
+	x = x - ((x >> 1) & 0x5555555555555555ull);
+	x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+	return (uint32_t)((x*0x0101010101010101ull) >> 56);
+}
+
+uint32_t rbx_selection_count(const uint64_t *selection, uint32_t count) {
+	uint32_t total = 0;
+	for (size_t i = 0; i < RBX_SELECTION_WORDS(count); ++i) {
+		total += popcount_64(selection[i]);
+	}
+	return total;
+}
+
+/* Set the bits of objects [begin, end) in a selection */
+void select_range(uint64_t *selection, uint32_t begin, uint32_t end) {
+	for (; begin < end && begin % 64 != 0; ++begin) {
+		selection[begin/64] |= (uint64_t)1 << (begin % 64);
+	}
+	for (; begin + 64 <= end; begin += 64) {
+		selection[begin/64] = ~(uint64_t)0;
+	}
+	for (; begin < end; ++begin) {
+		selection[begin/64] |= (uint64_t)1 << (begin % 64);
+	}
+}
+
+/* Test a slot against a predicate */
+int slot_matches(struct rbx_object_prop *prop, uint32_t slot,
+                 rbx_value_predicate predicate, void *user) {
+	struct rbx_value value;
+	struct rbx_value *expanded = rbx_slot_get(prop, &prop->slot_array[slot], &value);
+	return expanded != NULL && predicate(expanded, user);
+}
+
+uint32_t rbx_prop_select(struct rbx_object_prop *prop, rbx_value_predicate predicate,
+                         void *user, uint64_t *selection) {
+	if (selection != NULL) {
+		memset(selection, 0x0,
+			sizeof(uint64_t)*RBX_SELECTION_WORDS(prop->parent_type->object_count));
+	}
+	uint32_t matched = 0;
+	if (prop->value_count == 0) {
+		return 0;
+	}
+
+	if (prop->encoding == RBX_ENCODING_CONSTANT) {
+		// Every value or none of them
+		if (slot_matches(prop, 0, predicate, user)) {
+			matched = prop->value_count;
+			if (selection != NULL) {
+				select_range(selection, 0, prop->value_count);
+			}
+		}
+	} else if (prop->encoding == RBX_ENCODING_RUNS) {
+		// Whole runs at a time
+		uint32_t begin = 0;
+		for (uint32_t k = 0; k < prop->slot_count; ++k) {
+			uint32_t end = prop->run_end_array[k];
+			if (slot_matches(prop, k, predicate, user)) {
+				matched += end - begin;
+				if (selection != NULL) {
+					select_range(selection, begin, end);
+				}
+			}
+			begin = end;
+		}
+	} else if (prop->encoding == RBX_ENCODING_BITS) {
+		// The bits are a selection of the true values already
+		uint64_t match_false = slot_matches(prop, 0, predicate, user) ? ~(uint64_t)0 : 0;
+		uint64_t match_true = slot_matches(prop, 1, predicate, user) ? ~(uint64_t)0 : 0;
+		size_t words = RBX_SELECTION_WORDS(prop->value_count);
+		for (size_t w = 0; w < words; ++w) {
+			uint64_t bits = prop->bit_array[w];
+			uint64_t word = (bits & match_true) | (~bits & match_false);
+			if (w == words - 1 && prop->value_count % 64 != 0) {
+				word &= ((uint64_t)1 << (prop->value_count % 64)) - 1;
+			}
+			matched += popcount_64(word);
+			if (selection != NULL) {
+				selection[w] = word;
+			}
+		}
+	} else if (prop->encoding == RBX_ENCODING_DICTIONARY) {
+		// Test each distinct value, then look the codes up
+		uint8_t match_table[RBX_DICTIONARY_SIZE];
+		for (uint32_t k = 0; k < prop->slot_count; ++k) {
+			match_table[k] = slot_matches(prop, k, predicate, user) != 0;
+		}
+		for (uint32_t i = 0; i < prop->value_count; ++i) {
+			uint64_t match = match_table[prop->code_array[i]];
+			matched += match;
+			if (selection != NULL) {
+				selection[i/64] |= match << (i % 64);
+			}
+		}
+	} else {
+		for (uint32_t i = 0; i < prop->value_count; ++i) {
+			if (slot_matches(prop, i, predicate, user)) {
+				++matched;
+				if (selection != NULL) {
+					selection[i/64] |= (uint64_t)1 << (i % 64);
+				}
+			}
+		}
+	}
+	return matched;
+}
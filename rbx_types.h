@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 
 /* See: 
  * http://developer.roblox.com/forum/development-discussion/10719-binary-file-format?limitstart=0#116475
@@ -37,6 +38,14 @@
 /* Special type that we use for translated object referents */
 #define RBX_TYPE_OBJECT     0xFF
 
+/* Name of a value type, "Unknown" for the unused ones */
+const char *rbx_type_name(uint8_t type);
+
+/* The IDs of the 24 axis aligned CFrame rotations, the IDs in between them
+ * name two columns on the same axis and don't make a rotation. */
+#define RBX_ROTATION_ID_COUNT 24
+extern const uint8_t rbx_rotation_ids[RBX_ROTATION_ID_COUNT];
+
 /* Value types */
 struct rbx_string {
 	uint8_t *data;
@@ -127,6 +136,54 @@ struct rbx_value {
 	};
 };
 
+/* A value in compact storage
+ * - The values of a property are stored as an array of 8 byte slots.
+ * - Types that fit are stored in the slot itself. Strings, UDim2s, Rays,
+ *   Color3s, Vector3s and CFrames are stored in a side pool of the
+ *   property, and the slot holds their index in the pool.
+ */
+union rbx_slot {
+	uint64_t bits;
+	uint32_t pool_index;
+	struct rbx_boolean boolean_value;
+	struct rbx_int32 int32_value;
+	struct rbx_float float_value;
+	struct rbx_real real_value;
+	struct rbx_faces faces_value;
+	struct rbx_axis axis_value;
+	struct rbx_brickcolor brickcolor_value;
+	struct rbx_vector2 vector2_value;
+	struct rbx_token token_value;
+	struct rbx_referent referent_value;
+	struct rbx_object_ref object_value;
+};
+
+/* Size of a pool entry of a type, 0 for types stored in the slot */
+size_t rbx_pool_stride(uint8_t type);
+
+/* How the slots of a property map onto its values
+ * - PLAIN: one slot per value.
+ * - CONSTANT: a single slot holding every value.
+ * - RUNS: one slot per run of equal values, run_end_array holds one past
+ *   the last index of each run.
+ * - DICTIONARY: one slot per distinct value, code_array holds the slot of
+ *   each value.
+ * - BITS: booleans only, slot 0 is false and slot 1 true. bit_array holds
+ *   the bit of each value, as a selection of the objects that are true.
+ * The reader picks whichever takes the least memory, except that it
+ * doesn't look for a dictionary in columns of long strings, such as script
+ * sources. Pooled values have a pool entry per slot, not per value, in
+ * every encoding.
+ */
+#define RBX_ENCODING_PLAIN      0
+#define RBX_ENCODING_CONSTANT   1
+#define RBX_ENCODING_RUNS       2
+#define RBX_ENCODING_DICTIONARY 3
+#define RBX_ENCODING_BITS       4
+
+/* Most distinct values a dictionary encoded property can have */
+#define RBX_DICTIONARY_SIZE 256
+
 /* Property of a roblox object
  * - Properties are stored as a linked list. Since we don't know how many
  *   there are ahead of time, we allocate them one at a time and add them to
@@ -136,9 +193,24 @@ struct rbx_object_prop {
 	uint8_t value_type;
 	struct rbx_object_class *parent_type; /* Type that this prop is for */
 	struct rbx_string name;               /* Name of the property */
-	struct rbx_value **value_array;       /* List of values, length =
-	                                         parent_type.object_count */
 	struct rbx_object_prop *next;         /* Next prop in linked list */
+
+	/* Values, indexed by the position of the object in parent_type */
+	uint32_t value_count;                 /* Values that were read, the
+	                                         objects after them have none */
+	uint8_t encoding;                     /* RBX_ENCODING_* */
+	uint32_t slot_count;
+	union rbx_slot *slot_array;
+	void *pool;                           /* Values that don't fit a slot */
+	uint8_t *string_data;                 /* Characters of pooled strings */
+	uint32_t *run_end_array;              /* RBX_ENCODING_RUNS only */
+	uint8_t *code_array;                  /* RBX_ENCODING_DICTIONARY only */
+	uint64_t *bit_array;                  /* RBX_ENCODING_BITS only */
+
+	/* Where the column came from, zero for props not read from a record */
+	uint32_t compressed_bytes;   /* Of the PROP record */
+	uint32_t decompressed_bytes;
+	double decode_ns;            /* Only measured when reading with stats */
 };
 
 /* A type of roblox object 
@@ -152,19 +224,75 @@ struct rbx_object_class {
 	uint32_t *object_referent_array; /* Referents of the objects of this type */
 	uint32_t prop_count; /* Updated as entries are added to the prop_list */
 	struct rbx_object_prop *prop_list; /* linked list */
+	uint32_t compressed_bytes;   /* Of the INST record */
+	uint32_t decompressed_bytes;
 };
 
+/* Slot holding the value at an index, NULL if there is no value there */
+union rbx_slot *rbx_prop_slot(struct rbx_object_prop *prop, uint32_t index);
+
+/* Expand a slot of a property into value, returns value or NULL if the
+ * property's type can't be expanded. */
+struct rbx_value *rbx_slot_get(struct rbx_object_prop *prop, union rbx_slot *slot,
+                               struct rbx_value *value);
+
+/* Get a value of a property, expanded into value. Returns value, or NULL
+ * if there is no value at that index. */
+struct rbx_value *rbx_prop_get(struct rbx_object_prop *prop, uint32_t index,
+                               struct rbx_value *value);
+
+/* Pointers to pooled values, NULL if there is no value at that index. The
+ * property must be of the matching type. */
+struct rbx_string *rbx_prop_string(struct rbx_object_prop *prop, uint32_t index);
+struct rbx_vector3 *rbx_prop_vector3(struct rbx_object_prop *prop, uint32_t index);
+struct rbx_cframe *rbx_prop_cframe(struct rbx_object_prop *prop, uint32_t index);
+
+/* Tests a value, non-zero if it matches */
+typedef int (*rbx_value_predicate)(struct rbx_value *value, void *user);
+
+/* A selection of objects of a type, bit i of word i/64 for object i. The
+ * bits past the last object are always 0. */
+#define RBX_SELECTION_WORDS(count) (((size_t)(count) + 63)/64)
+
+/* Combine selections of count objects a word at a time, into dst */
+void rbx_selection_and(uint64_t *dst, const uint64_t *src, uint32_t count);
+void rbx_selection_or(uint64_t *dst, const uint64_t *src, uint32_t count);
+void rbx_selection_andnot(uint64_t *dst, const uint64_t *src, uint32_t count); /* dst & ~src */
+
+/* Number of objects in a selection of count objects */
+uint32_t rbx_selection_count(const uint64_t *selection, uint32_t count);
+
+/* Select the objects of prop's type whose value matches a predicate into
+ * selection, RBX_SELECTION_WORDS(object_count) words, or only count them
+ * if selection is NULL. Objects without a value never match. The predicate
+ * is tested once per slot rather than once per value, so encoded
+ * properties are filtered without expanding them, and boolean ones a word
+ * of bits at a time. Returns the number of objects that matched. */
+uint32_t rbx_prop_select(struct rbx_object_prop *prop, rbx_value_predicate predicate,
+                         void *user, uint64_t *selection);
+
 /* A roblox object
  * - An object, that is a bag of property -> rbx_value mappings
  *   with a referent id.
+ * - The values themselves stay in the properties, an entry says where.
  */
 struct rbx_object_propentry {
 	struct rbx_object_prop *prop;
-	struct rbx_value *value;
+	uint32_t index; /* Of the object's value in the prop */
 };
+
+/* Get the value of a property entry, see rbx_prop_get */
+struct rbx_value *rbx_entry_get(struct rbx_object_propentry *entry, struct rbx_value *value);
 struct rbx_object {
 	struct rbx_object_class *type;
 	uint32_t prop_value_count;
 	struct rbx_object_propentry *prop_value_array;
 	uint32_t referent;
+
+	/* Hierarchy, filled in from the PRNT record once all objects exist */
+	struct rbx_object *parent;       /* NULL for top level objects */
+	uint32_t child_count;
+	struct rbx_object **child_array; /* Points into the file's child_index */
+	uint32_t tree_enter;             /* Index of the object in tree_order */
+	uint32_t tree_exit;              /* One past its last descendant */
 };
\ No newline at end of file
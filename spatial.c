@@ -0,0 +1,767 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "spatial.h"
+#include "parallel.h"
+
+/* Max items in a leaf node */
+#define LEAF_SIZE 4
+
+/* Ranges smaller than this are built as a single task */
+#define TASK_SIZE 4096
+
+/* Depth of the traversal stack, the tree depth is bounded by the 30 bits of
+ * the Morton codes plus the median splits of runs of equal codes. */
+#define STACK_SIZE 128
+
+/* Pairs buffered by a sweep worker before they are passed on */
+#define PAIR_BUFFER 1024
+
+/* Bins used to estimate the cost of sweeping along an axis */
+#define COST_BINS 1024
+
+int get_part_columns(struct rbx_object_class *type_info,
+	struct rbx_object_prop **cframe, struct rbx_object_prop **size) {
+	*cframe = NULL;
+	*size = NULL;
+	struct rbx_object_prop *prop = type_info->prop_list;
+	for (; prop != NULL; prop = prop->next) {
+		const char *name = (const char*)prop->name.data;
+		if (prop->value_type == RBX_TYPE_CFRAME && 0 == strcmp(name, "CFrame")) {
+			*cframe = prop;
+		} else if (prop->value_type == RBX_TYPE_VECTOR3 &&
+		           (0 == strcmp(name, "size") || 0 == strcmp(name, "Size"))) {
+			*size = prop;
+		}
+	}
+	return *cframe != NULL && *size != NULL;
+}
+
+void get_part_box(struct rbx_cframe *cframe, struct rbx_vector3 *size,
+	struct spatial_box *box) {
+	// Half extents of the rotated box, |R| * size/2
+	const float *r = cframe->rotation;
+	float hx = 0.5f*size->x, hy = 0.5f*size->y, hz = 0.5f*size->z;
+	float ex = fabsf(r[0])*hx + fabsf(r[1])*hy + fabsf(r[2])*hz;
+	float ey = fabsf(r[3])*hx + fabsf(r[4])*hy + fabsf(r[5])*hz;
+	float ez = fabsf(r[6])*hx + fabsf(r[7])*hy + fabsf(r[8])*hz;
+
+	box->min.x = cframe->position.x - ex;
+	box->min.y = cframe->position.y - ey;
+	box->min.z = cframe->position.z - ez;
+	box->max.x = cframe->position.x + ex;
+	box->max.y = cframe->position.y + ey;
+	box->max.z = cframe->position.z + ez;
+}
+
+/* Grow a box to contain another one */
+void box_union(struct spatial_box *box, struct spatial_box *other) {
+	box->min.x = fminf(box->min.x, other->min.x);
+	box->min.y = fminf(box->min.y, other->min.y);
+	box->min.z = fminf(box->min.z, other->min.z);
+	box->max.x = fmaxf(box->max.x, other->max.x);
+	box->max.y = fmaxf(box->max.y, other->max.y);
+	box->max.z = fmaxf(box->max.z, other->max.z);
+}
+
+int box_overlaps(struct spatial_box *a, struct spatial_box *b) {
+	return a->min.x <= b->max.x && b->min.x <= a->max.x &&
+	       a->min.y <= b->max.y && b->min.y <= a->max.y &&
+	       a->min.z <= b->max.z && b->min.z <= a->max.z;
+}
+
+/* Spread the low 10 bits of a value out to every third bit */
+uint32_t spread_bits(uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/* Quantize a coordinate to 10 bits */
+uint32_t quantize(float value, float min, float scale) {
+	float q = (value - min) * scale;
+	if (!(q >= 0.0f)) {
+		return 0; // Also catches NaN
+	} else if (q > 1023.0f) {
+		return 1023;
+	}
+	return (uint32_t)q;
+}
+
+/* State shared by the stages of a build */
+struct build_context {
+	struct rbx_cframe **cframe_array;
+	struct rbx_vector3 **size_array;
+	struct rbx_object **object_array;
+	struct spatial_box *box_array;
+	struct spatial_box centers; /* Bounds of the part centers */
+	uint32_t *code_array;
+	uint32_t *order_array;
+	struct rbx_spatial_index *index;
+	uint32_t task_count;
+	uint32_t *task_array;       /* (node, begin, end) triples */
+};
+
+/* Stage: world bounds of each part */
+void build_boxes(void *context, size_t begin, size_t end) {
+	struct build_context *ctx = (struct build_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		get_part_box(ctx->cframe_array[i], ctx->size_array[i], &ctx->box_array[i]);
+	}
+}
+
+/* Stage: Morton code of the center of each part */
+void build_codes(void *context, size_t begin, size_t end) {
+	struct build_context *ctx = (struct build_context*)context;
+	struct spatial_box *c = &ctx->centers;
+	float sx = c->max.x > c->min.x ? 1023.0f / (c->max.x - c->min.x) : 0.0f;
+	float sy = c->max.y > c->min.y ? 1023.0f / (c->max.y - c->min.y) : 0.0f;
+	float sz = c->max.z > c->min.z ? 1023.0f / (c->max.z - c->min.z) : 0.0f;
+	for (size_t i = begin; i < end; ++i) {
+		struct spatial_box *box = &ctx->box_array[i];
+		uint32_t x = quantize(0.5f*(box->min.x + box->max.x), c->min.x, sx);
+		uint32_t y = quantize(0.5f*(box->min.y + box->max.y), c->min.y, sy);
+		uint32_t z = quantize(0.5f*(box->min.z + box->max.z), c->min.z, sz);
+		ctx->code_array[i] = (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+		ctx->order_array[i] = (uint32_t)i;
+	}
+}
+
+/* Stage: move the parts into Morton order */
+void build_permute(void *context, size_t begin, size_t end) {
+	struct build_context *ctx = (struct build_context*)context;
+	struct rbx_spatial_index *index = ctx->index;
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t from = ctx->order_array[i];
+		index->item_array[i] = ctx->object_array[from];
+		index->box_array[i] = ctx->box_array[from];
+	}
+}
+
+/* Sort keys, carrying a value array along (LSD radix sort) */
+int radix_sort(uint32_t *keys, uint32_t *values, uint32_t count) {
+	uint32_t *keys_tmp = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	uint32_t *values_tmp = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	if (count && (!keys_tmp || !values_tmp)) {
+		free(keys_tmp);
+		free(values_tmp);
+		return 0;
+	}
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t offsets[257] = {0};
+		for (uint32_t i = 0; i < count; ++i) {
+			++offsets[((keys[i] >> shift) & 0xFF) + 1];
+		}
+		for (int i = 0; i < 256; ++i) {
+			offsets[i + 1] += offsets[i];
+		}
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t slot = offsets[(keys[i] >> shift) & 0xFF]++;
+			keys_tmp[slot] = keys[i];
+			values_tmp[slot] = values[i];
+		}
+
+		// Swap buffers, after an even number of passes the data is back in
+		// the original arrays.
+		uint32_t *tmp = keys; keys = keys_tmp; keys_tmp = tmp;
+		tmp = values; values = values_tmp; values_tmp = tmp;
+	}
+
+	free(keys_tmp);
+	free(values_tmp);
+	return 1;
+}
+
+/* Find where to split a sorted range of codes: the first index with the
+ * highest differing bit set, or the middle if the codes are all equal. */
+uint32_t find_split(uint32_t *codes, uint32_t begin, uint32_t end) {
+	uint32_t first = codes[begin];
+	uint32_t last = codes[end - 1];
+	if (first == last) {
+		return (begin + end) / 2;
+	}
+
+	uint32_t bit = 0x80000000u;
+	while (!((first ^ last) & bit)) {
+		bit >>= 1;
+	}
+
+	uint32_t lo = begin, hi = end - 1;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (codes[mid] & bit) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+/* Build the subtree over [begin, end) at a node
+ * - A range of n items uses at most 2n-1 nodes, so the right child can be
+ *   placed right after the space reserved for the left subtree, which lets
+ *   subtrees be built independently. */
+void build_subtree(struct rbx_spatial_index *index, uint32_t *codes,
+	uint32_t node, uint32_t begin, uint32_t end) {
+	struct spatial_node *out = &index->node_array[node];
+	if (end - begin <= LEAF_SIZE) {
+		out->index = begin;
+		out->count = end - begin;
+		out->box = index->box_array[begin];
+		for (uint32_t i = begin + 1; i < end; ++i) {
+			box_union(&out->box, &index->box_array[i]);
+		}
+		return;
+	}
+
+	uint32_t split = find_split(codes, begin, end);
+	uint32_t right = node + 2*(split - begin);
+	build_subtree(index, codes, node + 1, begin, split);
+	build_subtree(index, codes, right, split, end);
+	out->index = right;
+	out->count = 0;
+	out->box = index->node_array[node + 1].box;
+	box_union(&out->box, &index->node_array[right].box);
+}
+
+/* Stage: build the subtrees found by plan_subtrees */
+void build_tasks(void *context, size_t begin, size_t end) {
+	struct build_context *ctx = (struct build_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t *task = &ctx->task_array[i*3];
+		build_subtree(ctx->index, ctx->code_array, task[0], task[1], task[2]);
+	}
+}
+
+/* Split the top of the tree into tasks that can be built in parallel
+ * - The interior nodes created here are written to planned in pre-order so
+ *   that their bounds can be filled in afterwards. */
+void plan_subtrees(struct build_context *ctx, uint32_t node, uint32_t begin,
+	uint32_t end, uint32_t *planned, uint32_t *planned_count) {
+	if (end - begin <= TASK_SIZE) {
+		uint32_t *task = &ctx->task_array[3*ctx->task_count++];
+		task[0] = node;
+		task[1] = begin;
+		task[2] = end;
+		return;
+	}
+
+	uint32_t split = find_split(ctx->code_array, begin, end);
+	uint32_t right = node + 2*(split - begin);
+	ctx->index->node_array[node].index = right;
+	ctx->index->node_array[node].count = 0;
+	planned[(*planned_count)++] = node;
+	plan_subtrees(ctx, node + 1, begin, split, planned, planned_count);
+	plan_subtrees(ctx, right, split, end, planned, planned_count);
+}
+
+struct rbx_spatial_index *build_spatial_index(struct rbx_file *file) {
+	struct rbx_spatial_index *index =
+		(struct rbx_spatial_index*)calloc(1, sizeof(struct rbx_spatial_index));
+	if (!index) {
+		return NULL;
+	}
+
+	// Count the parts
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_prop *cframe, *size;
+		if (get_part_columns(file->type_array + i, &cframe, &size)) {
+			count += file->type_array[i].object_count;
+		}
+	}
+	if (count == 0) {
+		return index;
+	}
+
+	struct build_context ctx;
+	memset(&ctx, 0x0, sizeof(ctx));
+	ctx.index = index;
+	ctx.cframe_array = (struct rbx_cframe**)malloc(sizeof(void*)*count);
+	ctx.size_array = (struct rbx_vector3**)malloc(sizeof(void*)*count);
+	ctx.object_array = (struct rbx_object**)malloc(sizeof(void*)*count);
+	ctx.box_array = (struct spatial_box*)malloc(sizeof(struct spatial_box)*count);
+	ctx.code_array = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	ctx.order_array = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	ctx.task_array = (uint32_t*)malloc(sizeof(uint32_t)*3*count);
+	index->item_count = count;
+	index->item_array = (struct rbx_object**)malloc(sizeof(void*)*count);
+	index->box_array = (struct spatial_box*)malloc(sizeof(struct spatial_box)*count);
+	index->node_count = 2*count - 1;
+	index->node_array =
+		(struct spatial_node*)malloc(sizeof(struct spatial_node)*index->node_count);
+	uint32_t *planned = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	int ok = ctx.cframe_array && ctx.size_array && ctx.object_array &&
+	         ctx.box_array && ctx.code_array && ctx.order_array &&
+	         ctx.task_array && index->item_array && index->box_array &&
+	         index->node_array && planned;
+
+	if (ok) {
+		// Gather the columns of the part types
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < file->type_count; ++i) {
+			struct rbx_object_class *type_info = (file->type_array + i);
+			struct rbx_object_prop *cframe, *size;
+			if (!get_part_columns(type_info, &cframe, &size)) {
+				continue;
+			}
+			for (uint32_t j = 0; j < type_info->object_count; ++j) {
+				ctx.cframe_array[n] = rbx_prop_cframe(cframe, j);
+				ctx.size_array[n] = rbx_prop_vector3(size, j);
+				ctx.object_array[n] =
+					&file->object_array[type_info->object_referent_array[j]];
+				++n;
+			}
+		}
+
+		// Bounds, then centers for the Morton code quantization
+		parallel_for(count, TASK_SIZE, build_boxes, &ctx);
+		struct rbx_vector3 c;
+		c.x = 0.5f*(ctx.box_array[0].min.x + ctx.box_array[0].max.x);
+		c.y = 0.5f*(ctx.box_array[0].min.y + ctx.box_array[0].max.y);
+		c.z = 0.5f*(ctx.box_array[0].min.z + ctx.box_array[0].max.z);
+		ctx.centers.min = ctx.centers.max = c;
+		for (uint32_t i = 1; i < count; ++i) {
+			struct spatial_box center;
+			center.min.x = 0.5f*(ctx.box_array[i].min.x + ctx.box_array[i].max.x);
+			center.min.y = 0.5f*(ctx.box_array[i].min.y + ctx.box_array[i].max.y);
+			center.min.z = 0.5f*(ctx.box_array[i].min.z + ctx.box_array[i].max.z);
+			center.max = center.min;
+			box_union(&ctx.centers, &center);
+		}
+		parallel_for(count, TASK_SIZE, build_codes, &ctx);
+
+		// Sort along the curve and build the tree
+		ok = radix_sort(ctx.code_array, ctx.order_array, count);
+	}
+	if (ok) {
+		parallel_for(count, TASK_SIZE, build_permute, &ctx);
+
+		uint32_t planned_count = 0;
+		plan_subtrees(&ctx, 0, 0, count, planned, &planned_count);
+		parallel_for(ctx.task_count, 1, build_tasks, &ctx);
+
+		// Fill in the bounds of the planned nodes, children first
+		for (uint32_t i = planned_count; i-- > 0;) {
+			struct spatial_node *node = &index->node_array[planned[i]];
+			node->box = index->node_array[planned[i] + 1].box;
+			box_union(&node->box, &index->node_array[node->index].box);
+		}
+	}
+
+	free(ctx.cframe_array);
+	free(ctx.size_array);
+	free(ctx.object_array);
+	free(ctx.box_array);
+	free(ctx.code_array);
+	free(ctx.order_array);
+	free(ctx.task_array);
+	free(planned);
+	if (!ok) {
+		free_spatial_index(index);
+		return NULL;
+	}
+	return index;
+}
+
+void free_spatial_index(struct rbx_spatial_index *index) {
+	if (index != NULL) {
+		free(index->item_array);
+		free(index->box_array);
+		free(index->node_array);
+		free(index);
+	}
+}
+
+/* Add an object to a query result */
+void add_result(struct spatial_result *result, struct rbx_object *object) {
+	if (result->count == result->capacity) {
+		uint32_t capacity = result->capacity ? 2*result->capacity : 64;
+		struct rbx_object **array = (struct rbx_object**)
+			realloc(result->object_array, sizeof(void*)*capacity);
+		if (!array) {
+			return;
+		}
+		result->object_array = array;
+		result->capacity = capacity;
+	}
+	result->object_array[result->count++] = object;
+}
+
+/* Shape of a query, tested against node and item bounds */
+struct spatial_query {
+	int (*test)(struct spatial_query *query, struct spatial_box *box);
+	struct spatial_box box;
+	struct rbx_vector3 center;
+	float radius;
+	struct rbx_vector3 origin;
+	struct rbx_vector3 inverse; /* 1 / ray direction */
+};
+
+int test_box(struct spatial_query *query, struct spatial_box *box) {
+	return box_overlaps(&query->box, box);
+}
+
+int test_sphere(struct spatial_query *query, struct spatial_box *box) {
+	// Distance from the center to the closest point in the box
+	struct rbx_vector3 *c = &query->center;
+	float dx = fmaxf(fmaxf(box->min.x - c->x, c->x - box->max.x), 0.0f);
+	float dy = fmaxf(fmaxf(box->min.y - c->y, c->y - box->max.y), 0.0f);
+	float dz = fmaxf(fmaxf(box->min.z - c->z, c->z - box->max.z), 0.0f);
+	return dx*dx + dy*dy + dz*dz <= query->radius*query->radius;
+}
+
+int test_ray(struct spatial_query *query, struct spatial_box *box) {
+	// Slab test, clipped to the segment t in [0, 1]
+	float tmin = 0.0f, tmax = 1.0f;
+	const float *origin = &query->origin.x;
+	const float *inverse = &query->inverse.x;
+	const float *lo = &box->min.x;
+	const float *hi = &box->max.x;
+	for (int i = 0; i < 3; ++i) {
+		if (isinf(inverse[i])) {
+			// Parallel to this slab
+			if (origin[i] < lo[i] || origin[i] > hi[i]) {
+				return 0;
+			}
+			continue;
+		}
+		float t0 = (lo[i] - origin[i]) * inverse[i];
+		float t1 = (hi[i] - origin[i]) * inverse[i];
+		tmin = fmaxf(tmin, fminf(t0, t1));
+		tmax = fminf(tmax, fmaxf(t0, t1));
+	}
+	return tmin <= tmax;
+}
+
+/* Walk the tree collecting the items that pass the query's test */
+void run_query(struct rbx_spatial_index *index, struct spatial_query *query,
+	struct spatial_result *result) {
+	result->count = 0;
+	if (index->item_count == 0) {
+		return;
+	}
+
+	uint32_t stack[STACK_SIZE];
+	uint32_t depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		struct spatial_node *node = &index->node_array[stack[--depth]];
+		if (!query->test(query, &node->box)) {
+			continue;
+		}
+		if (node->count > 0) {
+			for (uint32_t i = node->index; i < node->index + node->count; ++i) {
+				if (query->test(query, &index->box_array[i])) {
+					add_result(result, index->item_array[i]);
+				}
+			}
+		} else {
+			stack[depth++] = node->index;
+			stack[depth++] = (uint32_t)(node - index->node_array) + 1;
+		}
+	}
+}
+
+void spatial_query_box(struct rbx_spatial_index *index,
+	struct spatial_box *box, struct spatial_result *result) {
+	struct spatial_query query;
+	query.test = test_box;
+	query.box = *box;
+	run_query(index, &query, result);
+}
+
+void spatial_query_sphere(struct rbx_spatial_index *index,
+	struct rbx_vector3 center, float radius, struct spatial_result *result) {
+	struct spatial_query query;
+	query.test = test_sphere;
+	query.center = center;
+	query.radius = radius;
+	run_query(index, &query, result);
+}
+
+void spatial_query_ray(struct rbx_spatial_index *index,
+	struct rbx_ray *ray, struct spatial_result *result) {
+	struct spatial_query query;
+	query.test = test_ray;
+	query.origin = ray->origin;
+	query.inverse.x = 1.0f / ray->direction.x;
+	query.inverse.y = 1.0f / ray->direction.y;
+	query.inverse.z = 1.0f / ray->direction.z;
+	run_query(index, &query, result);
+}
+
+void free_spatial_result(struct spatial_result *result) {
+	free(result->object_array);
+	result->object_array = NULL;
+	result->count = 0;
+	result->capacity = 0;
+}
+
+/* Parts in structure of arrays form for the sweep and prune */
+struct sweep_context {
+	uint32_t count;
+	float *position[3];
+	float *rotation[9];
+	float *half[3];     /* size / 2 */
+	float *min[3];      /* World bounds */
+	float *max[3];
+	uint32_t *key_array;
+	uint32_t *order_array;
+	struct rbx_object **object_array;
+	float *sorted_min[3]; /* Bounds in order of min x */
+	float *sorted_max[3];
+	struct rbx_object **sorted_object_array;
+	int axis;             /* Axis to sweep along */
+
+	overlap_fn fn;
+	void *fn_context;
+	pthread_mutex_t lock;
+	uint64_t pair_count;
+};
+
+/* Stage: world bounds, 4 parts at a time when SSE is available */
+void sweep_boxes(void *context, size_t begin, size_t end) {
+	struct sweep_context *ctx = (struct sweep_context*)context;
+	size_t i = begin;
+#ifdef __SSE2__
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	for (; i + 4 <= end; i += 4) {
+		__m128 hx = _mm_loadu_ps(ctx->half[0] + i);
+		__m128 hy = _mm_loadu_ps(ctx->half[1] + i);
+		__m128 hz = _mm_loadu_ps(ctx->half[2] + i);
+		for (int a = 0; a < 3; ++a) {
+			__m128 r0 = _mm_and_ps(_mm_loadu_ps(ctx->rotation[a*3 + 0] + i), abs_mask);
+			__m128 r1 = _mm_and_ps(_mm_loadu_ps(ctx->rotation[a*3 + 1] + i), abs_mask);
+			__m128 r2 = _mm_and_ps(_mm_loadu_ps(ctx->rotation[a*3 + 2] + i), abs_mask);
+			__m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, hx), _mm_mul_ps(r1, hy)),
+			                      _mm_mul_ps(r2, hz));
+			__m128 p = _mm_loadu_ps(ctx->position[a] + i);
+			_mm_storeu_ps(ctx->min[a] + i, _mm_sub_ps(p, e));
+			_mm_storeu_ps(ctx->max[a] + i, _mm_add_ps(p, e));
+		}
+	}
+#endif
+	for (; i < end; ++i) {
+		for (int a = 0; a < 3; ++a) {
+			float e = fabsf(ctx->rotation[a*3 + 0][i])*ctx->half[0][i] +
+			          fabsf(ctx->rotation[a*3 + 1][i])*ctx->half[1][i] +
+			          fabsf(ctx->rotation[a*3 + 2][i])*ctx->half[2][i];
+			ctx->min[a][i] = ctx->position[a][i] - e;
+			ctx->max[a][i] = ctx->position[a][i] + e;
+		}
+	}
+}
+
+/* Stage: sort keys of the min along the sweep axis (float bits flipped to
+ * sort as unsigned) */
+void sweep_keys(void *context, size_t begin, size_t end) {
+	struct sweep_context *ctx = (struct sweep_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t bits;
+		memcpy(&bits, &ctx->min[ctx->axis][i], sizeof(bits));
+		ctx->key_array[i] = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+		ctx->order_array[i] = (uint32_t)i;
+	}
+}
+
+/* Stage: move the bounds into sorted order, rotating the axes so that the
+ * sweep axis comes first */
+void sweep_permute(void *context, size_t begin, size_t end) {
+	struct sweep_context *ctx = (struct sweep_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t from = ctx->order_array[i];
+		for (int a = 0; a < 3; ++a) {
+			ctx->sorted_min[a][i] = ctx->min[(ctx->axis + a) % 3][from];
+			ctx->sorted_max[a][i] = ctx->max[(ctx->axis + a) % 3][from];
+		}
+		ctx->sorted_object_array[i] = ctx->object_array[from];
+	}
+}
+
+/* Pass a buffer of pairs on to the callback */
+void flush_pairs(struct sweep_context *ctx, uint32_t *pairs, uint32_t count) {
+	pthread_mutex_lock(&ctx->lock);
+	for (uint32_t i = 0; i < count; ++i) {
+		ctx->fn(ctx->fn_context, ctx->sorted_object_array[pairs[2*i]],
+		        ctx->sorted_object_array[pairs[2*i + 1]]);
+	}
+	ctx->pair_count += count;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/* Stage: sweep, each part is tested against the parts after it in the
+ * sorted order until their min passes its max on the sweep axis. */
+void sweep_range(void *context, size_t begin, size_t end) {
+	struct sweep_context *ctx = (struct sweep_context*)context;
+	uint32_t pairs[2*PAIR_BUFFER];
+	uint32_t pair_count = 0;
+	const float *min_x = ctx->sorted_min[0], *max_x = ctx->sorted_max[0];
+	const float *min_y = ctx->sorted_min[1], *max_y = ctx->sorted_max[1];
+	const float *min_z = ctx->sorted_min[2], *max_z = ctx->sorted_max[2];
+	for (uint32_t i = (uint32_t)begin; i < end; ++i) {
+		for (uint32_t j = i + 1; j < ctx->count && min_x[j] < max_x[i]; ++j) {
+			if (min_x[i] < max_x[j] &&
+			    min_y[j] < max_y[i] && min_y[i] < max_y[j] &&
+			    min_z[j] < max_z[i] && min_z[i] < max_z[j]) {
+				pairs[2*pair_count] = i;
+				pairs[2*pair_count + 1] = j;
+				if (++pair_count == PAIR_BUFFER) {
+					flush_pairs(ctx, pairs, pair_count);
+					pair_count = 0;
+				}
+			}
+		}
+	}
+	if (pair_count > 0) {
+		flush_pairs(ctx, pairs, pair_count);
+	}
+}
+
+/* Estimate the work a sweep along an axis would do, from a coarse
+ * histogram of how many parts cover each stretch of the axis. The number
+ * of candidate pairs in a bin grows with the square of its coverage. */
+double sweep_cost(const float *min, const float *max, uint32_t count) {
+	float lo = min[0], hi = max[0];
+	for (uint32_t i = 1; i < count; ++i) {
+		lo = fminf(lo, min[i]);
+		hi = fmaxf(hi, max[i]);
+	}
+	if (!(hi > lo)) {
+		return (double)count*count;
+	}
+
+	// Difference array of the coverage of each bin
+	int64_t diff[COST_BINS + 1] = {0};
+	float scale = (COST_BINS - 1) / (hi - lo);
+	for (uint32_t i = 0; i < count; ++i) {
+		float b0 = (min[i] - lo) * scale;
+		float b1 = (max[i] - lo) * scale;
+		uint32_t first = b0 >= 0.0f && b0 < COST_BINS ? (uint32_t)b0 : 0;
+		uint32_t last = b1 >= 0.0f && b1 < COST_BINS ? (uint32_t)b1 : COST_BINS - 1;
+		++diff[first];
+		--diff[last + 1];
+	}
+
+	double cost = 0.0;
+	int64_t coverage = 0;
+	for (int b = 0; b < COST_BINS; ++b) {
+		coverage += diff[b];
+		cost += (double)coverage*coverage;
+	}
+	return cost;
+}
+
+int find_overlapping_parts(struct rbx_file *file, overlap_fn fn, void *context,
+	uint64_t *pair_count) {
+	*pair_count = 0;
+
+	// Count the parts
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < file->type_count; ++i) {
+		struct rbx_object_prop *cframe, *size;
+		if (get_part_columns(file->type_array + i, &cframe, &size)) {
+			count += file->type_array[i].object_count;
+		}
+	}
+	if (count == 0) {
+		return 1;
+	}
+
+	// One block for all of the float columns
+	struct sweep_context ctx;
+	memset(&ctx, 0x0, sizeof(ctx));
+	float *columns = (float*)malloc(sizeof(float)*27*(size_t)count);
+	ctx.key_array = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	ctx.order_array = (uint32_t*)malloc(sizeof(uint32_t)*count);
+	ctx.object_array = (struct rbx_object**)malloc(sizeof(void*)*count);
+	ctx.sorted_object_array = (struct rbx_object**)malloc(sizeof(void*)*count);
+	int ok = columns && ctx.key_array && ctx.order_array &&
+	         ctx.object_array && ctx.sorted_object_array;
+	if (ok) {
+		float **column_ptrs[] = {
+			&ctx.position[0], &ctx.position[1], &ctx.position[2],
+			&ctx.rotation[0], &ctx.rotation[1], &ctx.rotation[2],
+			&ctx.rotation[3], &ctx.rotation[4], &ctx.rotation[5],
+			&ctx.rotation[6], &ctx.rotation[7], &ctx.rotation[8],
+			&ctx.half[0], &ctx.half[1], &ctx.half[2],
+			&ctx.min[0], &ctx.min[1], &ctx.min[2],
+			&ctx.max[0], &ctx.max[1], &ctx.max[2],
+			&ctx.sorted_min[0], &ctx.sorted_min[1], &ctx.sorted_min[2],
+			&ctx.sorted_max[0], &ctx.sorted_max[1], &ctx.sorted_max[2],
+		};
+		for (int i = 0; i < 27; ++i) {
+			*column_ptrs[i] = columns + (size_t)i*count;
+		}
+		ctx.count = count;
+		ctx.fn = fn;
+		ctx.fn_context = context;
+		pthread_mutex_init(&ctx.lock, NULL);
+
+		// Gather the part columns
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < file->type_count; ++i) {
+			struct rbx_object_class *type_info = (file->type_array + i);
+			struct rbx_object_prop *cframe, *size;
+			if (!get_part_columns(type_info, &cframe, &size)) {
+				continue;
+			}
+			for (uint32_t j = 0; j < type_info->object_count; ++j) {
+				struct rbx_cframe *cf = rbx_prop_cframe(cframe, j);
+				struct rbx_vector3 *sz = rbx_prop_vector3(size, j);
+				ctx.position[0][n] = cf->position.x;
+				ctx.position[1][n] = cf->position.y;
+				ctx.position[2][n] = cf->position.z;
+				for (int k = 0; k < 9; ++k) {
+					ctx.rotation[k][n] = cf->rotation[k];
+				}
+				ctx.half[0][n] = 0.5f*sz->x;
+				ctx.half[1][n] = 0.5f*sz->y;
+				ctx.half[2][n] = 0.5f*sz->z;
+				ctx.object_array[n] =
+					&file->object_array[type_info->object_referent_array[j]];
+				++n;
+			}
+		}
+
+		parallel_for(count, TASK_SIZE, sweep_boxes, &ctx);
+
+		// Sweep along the axis with the fewest expected candidate pairs, so
+		// that parts lined up along a plane don't degrade to all pairs.
+		double best = 0.0;
+		for (int a = 0; a < 3; ++a) {
+			double cost = sweep_cost(ctx.min[a], ctx.max[a], count);
+			if (a == 0 || cost < best) {
+				best = cost;
+				ctx.axis = a;
+			}
+		}
+		parallel_for(count, TASK_SIZE, sweep_keys, &ctx);
+		ok = radix_sort(ctx.key_array, ctx.order_array, count);
+		if (ok) {
+			parallel_for(count, TASK_SIZE, sweep_permute, &ctx);
+
+			// Small blocks, since the work per part is very uneven
+			parallel_for(count, 256, sweep_range, &ctx);
+			*pair_count = ctx.pair_count;
+		}
+		pthread_mutex_destroy(&ctx.lock);
+	}
+
+	free(columns);
+	free(ctx.key_array);
+	free(ctx.order_array);
+	free(ctx.object_array);
+	free(ctx.sorted_object_array);
+	return ok;
+}
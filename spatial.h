@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rbx_types.h"
+#include "fmt_rbx.h"
+
+/* Spatial index over the parts in a file
+ * - Parts are the objects of any type with a CFrame and a Vector3 size
+ *   property, which covers all of the BasePart derived classes.
+ * - The index is a linear BVH (LBVH): the parts are sorted along a Morton
+ *   curve through their centers, and the tree is formed by splitting the
+ *   sorted list on the highest differing bit of the codes.
+ * - Queries test against the world axis aligned bounds of the parts.
+ */
+
+/* Axis aligned bounding box */
+struct spatial_box {
+	struct rbx_vector3 min;
+	struct rbx_vector3 max;
+};
+
+/* Node in the BVH, the left child of an interior node is the node right
+ * after it in the node array. */
+struct spatial_node {
+	struct spatial_box box;
+	uint32_t index; /* Interior: right child, Leaf: first item */
+	uint32_t count; /* Items in a leaf, 0 for interior nodes */
+};
+
+struct rbx_spatial_index {
+	uint32_t item_count;
+	struct rbx_object **item_array;  /* Parts, in leaf order */
+	struct spatial_box *box_array;   /* World bounds of each item */
+	uint32_t node_count;             /* Size of node_array, not all used */
+	struct spatial_node *node_array; /* Node 0 is the root */
+};
+
+/* Growable list of objects returned by a query, reused between queries */
+struct spatial_result {
+	uint32_t count;
+	uint32_t capacity;
+	struct rbx_object **object_array;
+};
+
+/* Find the CFrame and size columns of a type, returns 0 if it isn't a
+ * part type. */
+int get_part_columns(struct rbx_object_class *type_info,
+	struct rbx_object_prop **cframe, struct rbx_object_prop **size);
+
+/* World bounds of a part with a given CFrame and size */
+void get_part_box(struct rbx_cframe *cframe, struct rbx_vector3 *size,
+	struct spatial_box *box);
+
+/* Build a spatial index of the parts in a file, NULL on allocation
+ * failure. */
+struct rbx_spatial_index *build_spatial_index(struct rbx_file *file);
+
+void free_spatial_index(struct rbx_spatial_index *index);
+
+/* Queries, each one replaces the contents of result with the parts found */
+void spatial_query_box(struct rbx_spatial_index *index,
+	struct spatial_box *box, struct spatial_result *result);
+void spatial_query_sphere(struct rbx_spatial_index *index,
+	struct rbx_vector3 center, float radius, struct spatial_result *result);
+/* The ray is the segment from origin to origin + direction */
+void spatial_query_ray(struct rbx_spatial_index *index,
+	struct rbx_ray *ray, struct spatial_result *result);
+
+void free_spatial_result(struct spatial_result *result);
+
+/* Called for each pair of overlapping parts found by find_overlapping_parts,
+ * calls are serialized so it doesn't need to be thread safe. */
+typedef void (*overlap_fn)(void *context, struct rbx_object *a, struct rbx_object *b);
+
+/* Broad phase: find every pair of parts whose world bounds overlap (boxes
+ * that only touch aren't reported), using a parallel sweep and prune along
+ * whichever axis looks cheapest to sweep. The pairs are streamed out
+ * through fn as they are found, in no particular order. Returns 0 on
+ * allocation failure. */
+int find_overlapping_parts(struct rbx_file *file, overlap_fn fn, void *context,
+	uint64_t *pair_count);
@@ -1,22 +1,16 @@
 
 #include <stdint.h>
-#include <assert.h>
-#include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "lz4.h"
+
 #include "terrain.h"
+#include "parallel.h"
+#include "trace.h"
 
-// static void printbytes(uint8_t *ptr, size_t length) {
-// 	for (int i = 0; i < length; ++i) {
-// 		uint8_t c = ptr[i];
-// 		if (isprint(c)) {
-// 			printf("%02X ", c);
-// 		} else {
-// 			printf("%02X ", c);
-// 		}
-// 	}
-// 	printf("\n");
-// }
+// Chunks per parallel work item
+#define DECODE_BLOCK 4
 
 int32_t read_int32(uint8_t **ptr) {
 	int32_t value = *((int32_t*)(*ptr));
@@ -48,112 +42,840 @@ uint16_t reverse_uint16(uint16_t value) {
 	return ((value & 0xFF00) >> 8) | ((value & 0x00FF) << 8);
 }
 
-const char *byte_to_binary(uint8_t x) {
-	static char b[9];
-	b[0] = '\0';
-	int z;
-	for (z = 128; z > 0; z >>= 1) {
-		strcat(b, ((x & z) == z) ? "1" : "0");
-	}
-	return b;
+uint8_t block_type(uint8_t block) {
+	return (block & 0x38) >> 3;
 }
 
-uint8_t block_type(uint8_t d0) {
-	return (d0 & 0x38) >> 3;
+uint8_t block_rot(uint8_t block) {
+	return (block & 0xC0) >> 6;
 }
 
-uint8_t block_rot(uint8_t d0) {
-	return (d0 & 0xC0) >> 6;
+uint32_t terrain_voxel_index(uint32_t x, uint32_t y, uint32_t z) {
+	return (y*TERRAIN_CHUNK_SIZE_Z + z)*TERRAIN_CHUNK_SIZE_X + x;
 }
 
-void read_segment_d0(uint8_t **ptr, uint16_t *left) {
-	uint8_t tag = read_uint8(ptr);
-	if (tag == 0x28) {
-		uint16_t toskip = read_uint8(ptr);
-		if (toskip == 0xFF) {	
-			toskip = reverse_uint16(read_uint16(ptr));
+/* Read one run of a layer: a value byte followed by a length byte, or by
+ * 0xFF and a big endian 16 bit length for long runs. Returns 0 if the
+ * segment runs past the end of the data or past the end of the layer. */
+int read_segment(uint8_t **ptr, uint8_t *end, uint16_t left,
+	uint8_t *value, uint16_t *length) {
+	if (end - *ptr < 2) {
+		return 0;
+	}
+	*value = read_uint8(ptr);
+	*length = read_uint8(ptr);
+	if (*length == 0xFF) {
+		if (end - *ptr < 2) {
+			return 0;
 		}
-		printf("Empty  Segment [0x%04X]\n", toskip);
-		assert(*left >= toskip);
-		*left -= toskip;
-	} else {
-		uint8_t d0 = tag;
-		uint16_t length_or_tag = read_uint8(ptr);
+		*length = reverse_uint16(read_uint16(ptr));
+	}
+	return *length <= left;
+}
+
+/* Append a run to a layer, merging it into the previous run if it has the
+ * same value */
+void append_run(struct terrain_layer *layer, uint16_t *left, uint8_t value, uint16_t length) {
+	*left -= length;
+	if (length == 0) {
+		return;
+	}
+	uint32_t last = layer->run_count - 1;
+	if (layer->run_count > 0 && layer->value_array[last] == value) {
+		layer->end_array[last] = TERRAIN_CHUNK_VOXELS - *left;
+		return;
+	}
+	layer->end_array[layer->run_count] = TERRAIN_CHUNK_VOXELS - *left;
+	layer->value_array[layer->run_count] = value;
+	++layer->run_count;
+}
+
+/* Block layer, empty runs are tagged with TERRAIN_BLOCK_EMPTY which is also
+ * what we store for them. */
+int read_segment_d0(uint8_t **ptr, uint8_t *end, uint16_t *left, struct terrain_layer *layer) {
+	uint8_t block;
+	uint16_t length;
+	if (!read_segment(ptr, end, *left, &block, &length)) {
+		return 0;
+	}
+	append_run(layer, left, block, length);
+	return 1;
+}
+
+/* Material layer, empty runs are tagged with TERRAIN_MATERIAL_EMPTY_TAG */
+int read_segment_d1(uint8_t **ptr, uint8_t *end, uint16_t *left, struct terrain_layer *layer) {
+	uint8_t material;
+	uint16_t length;
+	if (!read_segment(ptr, end, *left, &material, &length)) {
+		return 0;
+	}
+	if (material == TERRAIN_MATERIAL_EMPTY_TAG) {
+		material = 0;
+	}
+	append_run(layer, left, material, length);
+	return 1;
+}
+
+/* Count the segments of one layer, returns 0 if it is malformed */
+int count_segments(uint8_t **ptr, uint8_t *end, uint32_t *count) {
+	uint16_t left = TERRAIN_CHUNK_VOXELS;
+	*count = 0;
+	while (left > 0) {
+		uint8_t value;
 		uint16_t length;
-		if (length_or_tag == 0xFF) {
-			length = reverse_uint16(read_uint16(ptr));
+		if (!read_segment(ptr, end, left, &value, &length)) {
+			return 0;
+		}
+		left -= length;
+		++*count;
+	}
+	return 1;
+}
+
+/* Decode the layers of a chunk into the run arrays it has been given,
+ * which have room for the number of segments found by the index. */
+void read_chunk(uint8_t *ptr, uint8_t *end, struct terrain_chunk *chunk) {
+	uint16_t left = TERRAIN_CHUNK_VOXELS;
+	while (left > 0) {
+		read_segment_d0(&ptr, end, &left, &chunk->block);
+	}
+	left = TERRAIN_CHUNK_VOXELS;
+	while (left > 0) {
+		read_segment_d1(&ptr, end, &left, &chunk->material);
+	}
+}
+
+struct terrain_chunk_index *index_terrain_chunks(struct rbx_string *source) {
+	uint8_t *ptr = source->data;
+	uint8_t *end = source->data + source->length;
+
+	struct terrain_chunk_index *index = (struct terrain_chunk_index*)
+		calloc(1, sizeof(struct terrain_chunk_index));
+	if (!index) {
+		return NULL;
+	}
+
+	uint32_t capacity = 0;
+	while (ptr < end) {
+		if (index->chunk_count == capacity) {
+			capacity = capacity ? 2*capacity : 64;
+			struct terrain_chunk_entry *grown = (struct terrain_chunk_entry*)
+				realloc(index->chunk_array, sizeof(struct terrain_chunk_entry)*capacity);
+			if (!grown) {
+				free_terrain_chunk_index(index);
+				return NULL;
+			}
+			index->chunk_array = grown;
+		}
+		struct terrain_chunk_entry *entry = &index->chunk_array[index->chunk_count++];
+		if (end - ptr < 6) {
+			free_terrain_chunk_index(index);
+			return NULL;
+		}
+		entry->position_x = read_int16(&ptr);
+		entry->position_y = read_int16(&ptr);
+		entry->position_z = read_int16(&ptr);
+		entry->offset = (uint32_t)(ptr - source->data);
+		if (!count_segments(&ptr, end, &entry->block_segments)) {
+			free_terrain_chunk_index(index);
+			return NULL;
+		}
+		entry->material_offset = (uint32_t)(ptr - source->data);
+		if (!count_segments(&ptr, end, &entry->material_segments)) {
+			free_terrain_chunk_index(index);
+			return NULL;
+		}
+	}
+	return index;
+}
+
+void free_terrain_chunk_index(struct terrain_chunk_index *index) {
+	if (index != NULL) {
+		free(index->chunk_array);
+		free(index);
+	}
+}
+
+uint32_t hash_chunk_position(int32_t x, int32_t y, int32_t z) {
+	uint32_t hash = (uint32_t)x*73856093u ^ (uint32_t)y*19349663u ^ (uint32_t)z*83492791u;
+	return hash ^ (hash >> 16);
+}
+
+/* Build the open addressing table of chunks keyed by position, returns 0 on
+ * allocation failure. */
+int build_chunk_table(struct rbx_terrain *terrain) {
+	uint32_t size = 16;
+	while (size < 2*terrain->chunk_count) {
+		size *= 2;
+	}
+	terrain->chunk_table = (uint32_t*)calloc(size, sizeof(uint32_t));
+	if (!terrain->chunk_table) {
+		return 0;
+	}
+	terrain->chunk_table_mask = size - 1;
+	for (uint32_t i = 0; i < terrain->chunk_count; ++i) {
+		struct terrain_chunk *chunk = &terrain->chunk_array[i];
+		uint32_t slot = hash_chunk_position(chunk->position_x,
+			chunk->position_y, chunk->position_z) & terrain->chunk_table_mask;
+		while (terrain->chunk_table[slot] != 0) {
+			slot = (slot + 1) & terrain->chunk_table_mask;
+		}
+		terrain->chunk_table[slot] = i + 1;
+	}
+	return 1;
+}
+
+/* Context for decoding chunks in parallel */
+struct decode_context {
+	struct rbx_string *source;
+	struct terrain_chunk_index *index;
+	struct rbx_terrain *terrain;
+};
+
+void decode_chunks(void *context, size_t begin, size_t end) {
+	struct decode_context *ctx = (struct decode_context*)context;
+	uint8_t *data_end = ctx->source->data + ctx->source->length;
+	TRACE_BEGIN("decode terrain chunks", NULL);
+	for (size_t i = begin; i < end; ++i) {
+		struct terrain_chunk_entry *entry = &ctx->index->chunk_array[i];
+		read_chunk(ctx->source->data + entry->offset, data_end,
+			&ctx->terrain->chunk_array[i]);
+	}
+	TRACE_END();
+}
+
+int region_contains(struct terrain_region *region, struct terrain_chunk_entry *entry) {
+	return entry->position_x >= region->min_x && entry->position_x <= region->max_x &&
+	       entry->position_y >= region->min_y && entry->position_y <= region->max_y &&
+	       entry->position_z >= region->min_z && entry->position_z <= region->max_z;
+}
+
+struct rbx_terrain *translate_terrain(struct rbx_string *source, struct terrain_region *region) {
+	struct terrain_chunk_index *index = index_terrain_chunks(source);
+	if (!index) {
+		return NULL;
+	}
+
+	// Drop the chunks outside of the region before sizing anything
+	if (region != NULL) {
+		uint32_t kept = 0;
+		for (uint32_t i = 0; i < index->chunk_count; ++i) {
+			if (region_contains(region, &index->chunk_array[i])) {
+				index->chunk_array[kept++] = index->chunk_array[i];
+			}
+		}
+		index->chunk_count = kept;
+	}
+
+	struct rbx_terrain *terrain =
+		(struct rbx_terrain*)calloc(1, sizeof(struct rbx_terrain));
+	if (!terrain) {
+		free_terrain_chunk_index(index);
+		return NULL;
+	}
+
+	// Hand each chunk its share of one allocation for all of the runs, the
+	// end arrays first for alignment.
+	size_t total = 0;
+	for (uint32_t i = 0; i < index->chunk_count; ++i) {
+		total += index->chunk_array[i].block_segments +
+			index->chunk_array[i].material_segments;
+	}
+	terrain->chunk_count = index->chunk_count;
+	terrain->chunk_array = (struct terrain_chunk*)
+		malloc(sizeof(struct terrain_chunk)*(index->chunk_count + 1));
+	terrain->run_storage = malloc(3*total + 1);
+	if (!terrain->chunk_array || !terrain->run_storage) {
+		free_terrain_chunk_index(index);
+		free_terrain(terrain);
+		return NULL;
+	}
+	uint16_t *end_storage = (uint16_t*)terrain->run_storage;
+	uint8_t *value_storage = (uint8_t*)(end_storage + total);
+	for (uint32_t i = 0; i < index->chunk_count; ++i) {
+		struct terrain_chunk_entry *entry = &index->chunk_array[i];
+		struct terrain_chunk *chunk = &terrain->chunk_array[i];
+		chunk->position_x = entry->position_x;
+		chunk->position_y = entry->position_y;
+		chunk->position_z = entry->position_z;
+		chunk->block.run_count = 0;
+		chunk->block.end_array = end_storage;
+		chunk->block.value_array = value_storage;
+		end_storage += entry->block_segments;
+		value_storage += entry->block_segments;
+		chunk->material.run_count = 0;
+		chunk->material.end_array = end_storage;
+		chunk->material.value_array = value_storage;
+		end_storage += entry->material_segments;
+		value_storage += entry->material_segments;
+	}
+
+	struct decode_context ctx;
+	ctx.source = source;
+	ctx.index = index;
+	ctx.terrain = terrain;
+	parallel_for(index->chunk_count, DECODE_BLOCK, decode_chunks, &ctx);
+	free_terrain_chunk_index(index);
+
+	if (!build_chunk_table(terrain)) {
+		free_terrain(terrain);
+		return NULL;
+	}
+	return terrain;
+}
+
+void free_terrain(struct rbx_terrain *terrain) {
+	if (terrain != NULL) {
+		free(terrain->chunk_array);
+		free(terrain->chunk_table);
+		free(terrain->run_storage);
+		free(terrain);
+	}
+}
+/* Size of the segments of a layer once encoded */
+size_t encoded_layer_size(struct terrain_layer *layer) {
+	size_t size = 0;
+	for (uint32_t i = 0, begin = 0; i < layer->run_count; ++i) {
+		size += (layer->end_array[i] - begin) < 0xFF ? 2 : 4;
+		begin = layer->end_array[i];
+	}
+	return size;
+}
+
+uint8_t *write_layer(uint8_t *ptr, struct terrain_layer *layer,
+	uint8_t empty_value, uint8_t empty_tag) {
+	for (uint32_t i = 0, begin = 0; i < layer->run_count; ++i) {
+		uint8_t value = layer->value_array[i];
+		uint16_t length = layer->end_array[i] - begin;
+		begin = layer->end_array[i];
+		*(ptr++) = value == empty_value ? empty_tag : value;
+		if (length < 0xFF) {
+			*(ptr++) = (uint8_t)length;
 		} else {
-			length = length_or_tag;
-		}
-		printf("Normal Segment [0x%04X] %s: (block: %u, rot: %u)\n", 
-			length, 
-			byte_to_binary(d0),
-			block_type(d0),
-			block_rot(d0));
-		assert(*left >= length);
-		*left -= length;
-	}
-}
-
-void read_segment_d1(uint8_t **ptr, uint16_t *left) {
-	uint8_t tag = read_uint8(ptr);
-	if (tag == 0x11) {
-		uint16_t toskip = read_uint8(ptr);
-		if (toskip == 0xFF) {	
-			toskip = reverse_uint16(read_uint16(ptr));
-		}
-		printf("Empty  Segment [0x%04X]\n", toskip);
-		assert(*left >= toskip);
-		*left -= toskip;
-	} else {
-		uint8_t d0 = tag;
-		uint16_t length_or_tag = read_uint8(ptr);
-		uint16_t length;
-		if (length_or_tag == 0xFF) {
-			length = reverse_uint16(read_uint16(ptr));
+			*(ptr++) = 0xFF;
+			*(ptr++) = length >> 8;
+			*(ptr++) = length & 0xFF;
+		}
+	}
+	return ptr;
+}
+
+/* Context for encoding chunks in parallel */
+struct encode_context {
+	struct rbx_terrain *terrain;
+	size_t *offset_array; /* Size of each chunk, then where it starts */
+	uint8_t *data;
+};
+
+void size_chunks(void *context, size_t begin, size_t end) {
+	struct encode_context *ctx = (struct encode_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		struct terrain_chunk *chunk = &ctx->terrain->chunk_array[i];
+		ctx->offset_array[i] = 6 +
+			encoded_layer_size(&chunk->block) +
+			encoded_layer_size(&chunk->material);
+	}
+}
+
+void encode_chunks(void *context, size_t begin, size_t end) {
+	struct encode_context *ctx = (struct encode_context*)context;
+	for (size_t i = begin; i < end; ++i) {
+		struct terrain_chunk *chunk = &ctx->terrain->chunk_array[i];
+		uint8_t *ptr = ctx->data + ctx->offset_array[i];
+		int16_t position[3] = {chunk->position_x, chunk->position_y, chunk->position_z};
+		memcpy(ptr, position, 6);
+		ptr = write_layer(ptr + 6, &chunk->block,
+			TERRAIN_BLOCK_EMPTY, TERRAIN_BLOCK_EMPTY);
+		write_layer(ptr, &chunk->material, 0, TERRAIN_MATERIAL_EMPTY_TAG);
+	}
+}
+
+uint8_t *write_terrain(struct rbx_terrain *terrain, size_t *length) {
+	struct encode_context ctx;
+	ctx.terrain = terrain;
+	ctx.offset_array = (size_t*)malloc(sizeof(size_t)*(terrain->chunk_count + 1));
+	if (!ctx.offset_array) {
+		return NULL;
+	}
+
+	// Size the chunks, then each one can be written at its own offset
+	parallel_for(terrain->chunk_count, DECODE_BLOCK, size_chunks, &ctx);
+	size_t total = 0;
+	for (uint32_t i = 0; i < terrain->chunk_count; ++i) {
+		size_t size = ctx.offset_array[i];
+		ctx.offset_array[i] = total;
+		total += size;
+	}
+	ctx.data = (uint8_t*)malloc(total + 1);
+	if (!ctx.data) {
+		free(ctx.offset_array);
+		return NULL;
+	}
+	parallel_for(terrain->chunk_count, DECODE_BLOCK, encode_chunks, &ctx);
+
+	free(ctx.offset_array);
+	*length = total;
+	return ctx.data;
+}
+
+struct terrain_chunk *terrain_find_chunk(struct rbx_terrain *terrain,
+	int32_t x, int32_t y, int32_t z) {
+	uint32_t slot = hash_chunk_position(x, y, z) & terrain->chunk_table_mask;
+	for (;; slot = (slot + 1) & terrain->chunk_table_mask) {
+		uint32_t index = terrain->chunk_table[slot];
+		if (index == 0) {
+			return NULL;
+		}
+		struct terrain_chunk *chunk = &terrain->chunk_array[index - 1];
+		if (chunk->position_x == x && chunk->position_y == y && chunk->position_z == z) {
+			return chunk;
+		}
+	}
+}
+
+uint8_t terrain_layer_get(struct terrain_layer *layer, uint32_t index) {
+	// First run ending after the index
+	uint32_t low = 0, high = layer->run_count - 1;
+	while (low < high) {
+		uint32_t mid = (low + high) / 2;
+		if (layer->end_array[mid] <= index) {
+			low = mid + 1;
 		} else {
-			length = length_or_tag;
+			high = mid;
 		}
-		printf("Normal Segment [0x%04X] %s: (material: %u)\n", 
-			length, 
-			byte_to_binary(d0),
-			d0);
-		assert(*left >= length);
-		*left -= length;
 	}
+	return layer->value_array[low];
 }
 
-void read_chunk(uint8_t **ptr) {
-	struct terrain_chunk chunk = {0};
+/* Floor division for voxel to chunk coordinates */
+int32_t floor_div(int32_t a, int32_t b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+int terrain_get_voxel(struct rbx_terrain *terrain, int32_t x, int32_t y, int32_t z,
+	uint8_t *block, uint8_t *material) {
+	int32_t chunk_x = floor_div(x, TERRAIN_CHUNK_SIZE_X);
+	int32_t chunk_y = floor_div(y, TERRAIN_CHUNK_SIZE_Y);
+	int32_t chunk_z = floor_div(z, TERRAIN_CHUNK_SIZE_Z);
+	struct terrain_chunk *chunk = terrain_find_chunk(terrain, chunk_x, chunk_y, chunk_z);
+	if (!chunk) {
+		*block = TERRAIN_BLOCK_EMPTY;
+		*material = 0;
+		return 0;
+	}
+	uint32_t index = terrain_voxel_index(
+		x - chunk_x*TERRAIN_CHUNK_SIZE_X,
+		y - chunk_y*TERRAIN_CHUNK_SIZE_Y,
+		z - chunk_z*TERRAIN_CHUNK_SIZE_Z);
+	*block = terrain_layer_get(&chunk->block, index);
+	*material = terrain_layer_get(&chunk->material, index);
+	return 1;
+}
+
+void terrain_expand_layer(struct terrain_layer *layer, uint8_t *voxel_array) {
+	uint32_t begin = 0;
+	for (uint32_t i = 0; i < layer->run_count; ++i) {
+		memset(voxel_array + begin, layer->value_array[i], layer->end_array[i] - begin);
+		begin = layer->end_array[i];
+	}
+}
 
-	chunk.position_x = read_int16(ptr);
-	chunk.position_y = read_int16(ptr);
-	chunk.position_z = read_int16(ptr);
+void terrain_expand_chunk(struct terrain_chunk *chunk,
+	uint8_t *block_array, uint8_t *material_array) {
+	terrain_expand_layer(&chunk->block, block_array);
+	terrain_expand_layer(&chunk->material, material_array);
+}
 
-	uint16_t left = 0x4000;
+/* Grow the local voxel bounds of a chunk to hold the voxels [begin, end) */
+void add_run_bounds(struct terrain_chunk_stats *chunk, uint32_t begin, uint32_t end) {
+	uint32_t last = end - 1;
+	uint8_t min_x = 0, max_x = TERRAIN_CHUNK_SIZE_X - 1;
+	uint8_t min_z = 0, max_z = TERRAIN_CHUNK_SIZE_Z - 1;
+	uint8_t min_y = begin / (TERRAIN_CHUNK_SIZE_X*TERRAIN_CHUNK_SIZE_Z);
+	uint8_t max_y = last / (TERRAIN_CHUNK_SIZE_X*TERRAIN_CHUNK_SIZE_Z);
 
-	printf("Pos: %d, %d, %d\n", 
-		chunk.position_x,
-		chunk.position_y,
-		chunk.position_z);
+	// A run that wraps onto another row reaches both ends of the row, and
+	// one that wraps onto another layer reaches both ends of the layer.
+	if (min_y == max_y) {
+		uint32_t first_row = begin / TERRAIN_CHUNK_SIZE_X;
+		uint32_t last_row = last / TERRAIN_CHUNK_SIZE_X;
+		min_z = first_row % TERRAIN_CHUNK_SIZE_Z;
+		max_z = last_row % TERRAIN_CHUNK_SIZE_Z;
+		if (first_row == last_row) {
+			min_x = begin % TERRAIN_CHUNK_SIZE_X;
+			max_x = last % TERRAIN_CHUNK_SIZE_X;
+		}
+	}
 
-	while (left > 0) {
-		read_segment_d0(ptr, &left);
+	if (chunk->filled_count == 0) {
+		chunk->min_x = min_x; chunk->min_y = min_y; chunk->min_z = min_z;
+		chunk->max_x = max_x; chunk->max_y = max_y; chunk->max_z = max_z;
+		return;
 	}
+	if (min_x < chunk->min_x) chunk->min_x = min_x;
+	if (min_y < chunk->min_y) chunk->min_y = min_y;
+	if (min_z < chunk->min_z) chunk->min_z = min_z;
+	if (max_x > chunk->max_x) chunk->max_x = max_x;
+	if (max_y > chunk->max_y) chunk->max_y = max_y;
+	if (max_z > chunk->max_z) chunk->max_z = max_z;
+}
 
-	for (int i = 0; i < 4; ++i)
-		printf("==================================================\n");
+/* Context for computing the stats of chunks in parallel */
+struct stats_context {
+	struct rbx_string *source;
+	struct terrain_chunk_index *index;
+	struct rbx_terrain_stats *stats;
+};
 
-	left = 0x4000;
-	while (left > 0) {
-		read_segment_d1(ptr, &left);
+void chunk_stats(void *context, size_t begin, size_t end) {
+	struct stats_context *ctx = (struct stats_context*)context;
+	uint8_t *data_end = ctx->source->data + ctx->source->length;
+	TRACE_BEGIN("terrain chunk stats", NULL);
+	for (size_t i = begin; i < end; ++i) {
+		struct terrain_chunk_entry *entry = &ctx->index->chunk_array[i];
+		struct terrain_chunk_stats *chunk = &ctx->stats->chunk_array[i];
+		chunk->position_x = entry->position_x;
+		chunk->position_y = entry->position_y;
+		chunk->position_z = entry->position_z;
+		chunk->filled_count = 0;
+
+		// Sum the run lengths of each material, the runs of the material
+		// layer were already checked by the index.
+		uint32_t histogram[256] = {0};
+		uint8_t *ptr = ctx->source->data + entry->material_offset;
+		uint16_t left = TERRAIN_CHUNK_VOXELS;
+		while (left > 0) {
+			uint8_t material;
+			uint16_t length;
+			read_segment(&ptr, data_end, left, &material, &length);
+			if (material != TERRAIN_MATERIAL_EMPTY_TAG && length > 0) {
+				uint32_t voxel = TERRAIN_CHUNK_VOXELS - left;
+				add_run_bounds(chunk, voxel, voxel + length);
+				chunk->filled_count += length;
+				histogram[material] += length;
+			}
+			left -= length;
+		}
+
+		// There can't be more materials than segments, so the chunk's share
+		// of the pair storage was sized by its segment count.
+		chunk->material_count = 0;
+		for (uint32_t m = 0; m < 256; ++m) {
+			if (histogram[m] > 0) {
+				chunk->material_array[chunk->material_count].material = (uint8_t)m;
+				chunk->material_array[chunk->material_count].count = histogram[m];
+				++chunk->material_count;
+			}
+		}
 	}
+	TRACE_END();
 }
 
-struct rbx_terrain *translate_terrain(struct rbx_string *source) {
-	uint8_t *ptr = source->data;
+struct rbx_terrain_stats *terrain_stats(struct rbx_string *source) {
+	struct terrain_chunk_index *index = index_terrain_chunks(source);
+	if (!index) {
+		return NULL;
+	}
+
+	struct rbx_terrain_stats *stats =
+		(struct rbx_terrain_stats*)calloc(1, sizeof(struct rbx_terrain_stats));
+	size_t pair_total = 0;
+	for (uint32_t i = 0; i < index->chunk_count; ++i) {
+		pair_total += index->chunk_array[i].material_segments;
+	}
+	if (stats) {
+		stats->chunk_count = index->chunk_count;
+		stats->chunk_array = (struct terrain_chunk_stats*)
+			malloc(sizeof(struct terrain_chunk_stats)*(index->chunk_count + 1));
+		stats->material_storage = (struct terrain_material_count*)
+			malloc(sizeof(struct terrain_material_count)*(pair_total + 1));
+	}
+	if (!stats || !stats->chunk_array || !stats->material_storage) {
+		free_terrain_chunk_index(index);
+		free_terrain_stats(stats);
+		return NULL;
+	}
+	struct terrain_material_count *pairs = stats->material_storage;
+	for (uint32_t i = 0; i < index->chunk_count; ++i) {
+		stats->chunk_array[i].material_array = pairs;
+		pairs += index->chunk_array[i].material_segments;
+	}
 
-	read_chunk(&ptr);
+	struct stats_context ctx;
+	ctx.source = source;
+	ctx.index = index;
+	ctx.stats = stats;
+	parallel_for(index->chunk_count, DECODE_BLOCK, chunk_stats, &ctx);
+	free_terrain_chunk_index(index);
+
+	// Fold the chunks into the totals for the map
+	stats->voxel_count = (uint64_t)stats->chunk_count*TERRAIN_CHUNK_VOXELS;
+	for (uint32_t i = 0; i < stats->chunk_count; ++i) {
+		struct terrain_chunk_stats *chunk = &stats->chunk_array[i];
+		for (uint32_t j = 0; j < chunk->material_count; ++j) {
+			stats->material_histogram[chunk->material_array[j].material] +=
+				chunk->material_array[j].count;
+		}
+		if (chunk->filled_count == 0) {
+			continue;
+		}
+		int32_t base_x = chunk->position_x*TERRAIN_CHUNK_SIZE_X;
+		int32_t base_y = chunk->position_y*TERRAIN_CHUNK_SIZE_Y;
+		int32_t base_z = chunk->position_z*TERRAIN_CHUNK_SIZE_Z;
+		int32_t min_x = base_x + chunk->min_x, max_x = base_x + chunk->max_x;
+		int32_t min_y = base_y + chunk->min_y, max_y = base_y + chunk->max_y;
+		int32_t min_z = base_z + chunk->min_z, max_z = base_z + chunk->max_z;
+		if (stats->filled_count == 0) {
+			stats->min_x = min_x; stats->min_y = min_y; stats->min_z = min_z;
+			stats->max_x = max_x; stats->max_y = max_y; stats->max_z = max_z;
+		} else {
+			if (min_x < stats->min_x) stats->min_x = min_x;
+			if (min_y < stats->min_y) stats->min_y = min_y;
+			if (min_z < stats->min_z) stats->min_z = min_z;
+			if (max_x > stats->max_x) stats->max_x = max_x;
+			if (max_y > stats->max_y) stats->max_y = max_y;
+			if (max_z > stats->max_z) stats->max_z = max_z;
+		}
+		stats->filled_count += chunk->filled_count;
+	}
+	return stats;
+}
+
+void free_terrain_stats(struct rbx_terrain_stats *stats) {
+	if (stats != NULL) {
+		free(stats->chunk_array);
+		free(stats->material_storage);
+		free(stats);
+	}
+}
+
+static const uint8_t TERRAIN_LOD_MAGIC[8] = {'R', 'B', 'X', 'T', 'L', 'O', 'D', 0};
+#define TERRAIN_LOD_VERSION 1
+#define TERRAIN_LOD_HEADER 20
+
+void lod_level_size(uint32_t level, uint32_t *size_x, uint32_t *size_y, uint32_t *size_z) {
+	*size_x = TERRAIN_CHUNK_SIZE_X >> level;
+	*size_y = TERRAIN_CHUNK_SIZE_Y >> level;
+	*size_z = TERRAIN_CHUNK_SIZE_Z >> level;
+	if (*size_y == 0) {
+		*size_y = 1;
+	}
+}
+
+/* Offset of a level within the cells of a chunk */
+uint32_t lod_level_offset(uint32_t level) {
+	uint32_t offset = 0;
+	for (uint32_t k = 1; k < level; ++k) {
+		uint32_t x, y, z;
+		lod_level_size(k, &x, &y, &z);
+		offset += x*y*z;
+	}
+	return offset;
+}
 
-	return NULL;
-}
\ No newline at end of file
+struct terrain_lod_cell *terrain_lod_level(struct rbx_terrain_lod *lod,
+	uint32_t chunk, uint32_t level,
+	uint32_t *size_x, uint32_t *size_y, uint32_t *size_z) {
+	lod_level_size(level, size_x, size_y, size_z);
+	return lod->cell_array + (size_t)chunk*TERRAIN_LOD_CELLS + lod_level_offset(level);
+}
+
+/* Majority of up to 8 weighted materials, ties go to the lower material */
+uint8_t majority_material(uint8_t *material_array, uint32_t *weight_array, uint32_t count) {
+	uint8_t best = 0;
+	uint32_t best_weight = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (material_array[i] == 0) {
+			continue;
+		}
+		uint32_t weight = 0;
+		for (uint32_t j = 0; j < count; ++j) {
+			if (material_array[j] == material_array[i]) {
+				weight += weight_array[j];
+			}
+		}
+		if (weight > best_weight ||
+			(weight == best_weight && material_array[i] < best))
+		{
+			best = material_array[i];
+			best_weight = weight;
+		}
+	}
+	return best;
+}
+
+/* Build a level from the level below it, or from the voxels for level 1 */
+void build_lod_level(struct terrain_lod_cell *parent, uint32_t level,
+	struct terrain_lod_cell *child, uint8_t *voxel_array) {
+	uint32_t size_x, size_y, size_z, child_x, child_y, child_z;
+	lod_level_size(level, &size_x, &size_y, &size_z);
+	lod_level_size(level - 1, &child_x, &child_y, &child_z);
+	if (level == 1) {
+		child_x = TERRAIN_CHUNK_SIZE_X;
+		child_y = TERRAIN_CHUNK_SIZE_Y;
+		child_z = TERRAIN_CHUNK_SIZE_Z;
+	}
+	uint32_t step_y = child_y / size_y;
+
+	for (uint32_t y = 0; y < size_y; ++y)
+	for (uint32_t z = 0; z < size_z; ++z)
+	for (uint32_t x = 0; x < size_x; ++x) {
+		uint8_t material_array[8];
+		uint32_t weight_array[8];
+		uint32_t count = 0, occupancy = 0;
+		for (uint32_t dy = 0; dy < step_y; ++dy)
+		for (uint32_t dz = 0; dz < 2; ++dz)
+		for (uint32_t dx = 0; dx < 2; ++dx) {
+			uint32_t index = ((y*step_y + dy)*child_z + (z*2 + dz))*child_x + (x*2 + dx);
+			if (voxel_array) {
+				material_array[count] = voxel_array[index];
+				weight_array[count] = 1;
+				occupancy += voxel_array[index] != 0 ? 255 : 0;
+			} else {
+				material_array[count] = child[index].material;
+				weight_array[count] = child[index].occupancy;
+				occupancy += child[index].occupancy;
+			}
+			++count;
+		}
+		struct terrain_lod_cell *cell = &parent[(y*size_z + z)*size_x + x];
+		cell->material = majority_material(material_array, weight_array, count);
+		cell->occupancy = (uint8_t)((occupancy + count/2) / count);
+	}
+}
+
+/* Context for building the pyramids of chunks in parallel */
+struct lod_context {
+	struct rbx_terrain *terrain;
+	struct rbx_terrain_lod *lod;
+};
+
+void build_lod_chunks(void *context, size_t begin, size_t end) {
+	struct lod_context *ctx = (struct lod_context*)context;
+	uint8_t material_array[TERRAIN_CHUNK_VOXELS];
+	for (size_t i = begin; i < end; ++i) {
+		terrain_expand_layer(&ctx->terrain->chunk_array[i].material, material_array);
+		struct terrain_lod_cell *cells = ctx->lod->cell_array + i*TERRAIN_LOD_CELLS;
+		build_lod_level(cells, 1, NULL, material_array);
+		for (uint32_t level = 2; level <= TERRAIN_LOD_LEVELS; ++level) {
+			build_lod_level(cells + lod_level_offset(level), level,
+				cells + lod_level_offset(level - 1), NULL);
+		}
+	}
+}
+
+/* Allocate a pyramid for a number of chunks */
+struct rbx_terrain_lod *alloc_terrain_lod(uint32_t chunk_count) {
+	struct rbx_terrain_lod *lod =
+		(struct rbx_terrain_lod*)calloc(1, sizeof(struct rbx_terrain_lod));
+	if (!lod) {
+		return NULL;
+	}
+	lod->chunk_count = chunk_count;
+	lod->position_array = (int16_t*)malloc(sizeof(int16_t)*3*(chunk_count + 1));
+	lod->cell_array = (struct terrain_lod_cell*)
+		malloc(sizeof(struct terrain_lod_cell)*TERRAIN_LOD_CELLS*(chunk_count + 1));
+	if (!lod->position_array || !lod->cell_array) {
+		free_terrain_lod(lod);
+		return NULL;
+	}
+	return lod;
+}
+
+struct rbx_terrain_lod *build_terrain_lod(struct rbx_terrain *terrain) {
+	struct rbx_terrain_lod *lod = alloc_terrain_lod(terrain->chunk_count);
+	if (!lod) {
+		return NULL;
+	}
+	for (uint32_t i = 0; i < terrain->chunk_count; ++i) {
+		lod->position_array[3*i + 0] = terrain->chunk_array[i].position_x;
+		lod->position_array[3*i + 1] = terrain->chunk_array[i].position_y;
+		lod->position_array[3*i + 2] = terrain->chunk_array[i].position_z;
+	}
+	struct lod_context ctx;
+	ctx.terrain = terrain;
+	ctx.lod = lod;
+	parallel_for(terrain->chunk_count, DECODE_BLOCK, build_lod_chunks, &ctx);
+	return lod;
+}
+
+void free_terrain_lod(struct rbx_terrain_lod *lod) {
+	if (lod != NULL) {
+		free(lod->position_array);
+		free(lod->cell_array);
+		free(lod);
+	}
+}
+
+void write_uint32(uint8_t *ptr, uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		ptr[i] = (value >> (8*i)) & 0xFF;
+	}
+}
+
+uint32_t read_le_uint32(uint8_t *ptr) {
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+uint8_t *write_terrain_lod(struct rbx_terrain_lod *lod, size_t *length) {
+	// Positions then cells, compressed as one block
+	size_t position_size = sizeof(int16_t)*3*lod->chunk_count;
+	size_t cell_size = sizeof(struct terrain_lod_cell)*TERRAIN_LOD_CELLS*lod->chunk_count;
+	size_t raw_size = position_size + cell_size;
+	if (raw_size > 0x7E000000) {
+		return NULL;
+	}
+	uint8_t *raw = (uint8_t*)malloc(raw_size + 1);
+	uint8_t *data = (uint8_t*)malloc(TERRAIN_LOD_HEADER + LZ4_compressBound((int)raw_size));
+	if (!raw || !data) {
+		free(raw);
+		free(data);
+		return NULL;
+	}
+	memcpy(raw, lod->position_array, position_size);
+	memcpy(raw + position_size, lod->cell_array, cell_size);
+	int compressed = LZ4_compress((char*)raw, (char*)data + TERRAIN_LOD_HEADER, (int)raw_size);
+	free(raw);
+
+	memcpy(data, TERRAIN_LOD_MAGIC, 8);
+	write_uint32(data + 8, TERRAIN_LOD_VERSION);
+	write_uint32(data + 12, lod->chunk_count);
+	write_uint32(data + 16, (uint32_t)compressed);
+	*length = TERRAIN_LOD_HEADER + compressed;
+	return data;
+}
+
+struct rbx_terrain_lod *read_terrain_lod(uint8_t *data, size_t length) {
+	if (length < TERRAIN_LOD_HEADER || memcmp(data, TERRAIN_LOD_MAGIC, 8) != 0 ||
+		read_le_uint32(data + 8) != TERRAIN_LOD_VERSION)
+	{
+		return NULL;
+	}
+	uint32_t chunk_count = read_le_uint32(data + 12);
+	uint32_t compressed = read_le_uint32(data + 16);
+	size_t position_size = sizeof(int16_t)*3*(size_t)chunk_count;
+	size_t cell_size = sizeof(struct terrain_lod_cell)*TERRAIN_LOD_CELLS*(size_t)chunk_count;
+	size_t raw_size = position_size + cell_size;
+	if (compressed > length - TERRAIN_LOD_HEADER || raw_size > 0x7E000000) {
+		return NULL;
+	}
+
+	struct rbx_terrain_lod *lod = alloc_terrain_lod(chunk_count);
+	uint8_t *raw = (uint8_t*)malloc(raw_size + 1);
+	if (!lod || !raw) {
+		free_terrain_lod(lod);
+		free(raw);
+		return NULL;
+	}
+	int result = LZ4_decompress_safe((char*)data + TERRAIN_LOD_HEADER, (char*)raw,
+		(int)compressed, (int)raw_size);
+	if (result != (int)raw_size) {
+		free_terrain_lod(lod);
+		free(raw);
+		return NULL;
+	}
+	memcpy(lod->position_array, raw, position_size);
+	memcpy(lod->cell_array, raw + position_size, cell_size);
+	free(raw);
+	return lod;
+}
@@ -1,18 +1,200 @@
-
 #pragma once
 
 #include <stdint.h>
 
 #include "rbx_types.h"
 
+/* Terrain, decoded from the ClusterGridV3 property of the Terrain object
+ * - The data is a list of chunks, each one a 32x16x32 (x, y, z) block of
+ *   voxels stored as two run length encoded layers: the block layer, whose
+ *   bytes pack a shape and rotation, then the material layer.
+ * - Voxel i of a chunk is at x = i % 32, z = (i / 32) % 32, y = i / 1024.
+ * - Chunks are kept in their run length encoded form, which takes about as
+ *   much memory as the encoded data, rather than 32KB of voxels each.
+ */
+
+#define TERRAIN_CHUNK_SIZE_X 32
+#define TERRAIN_CHUNK_SIZE_Y 16
+#define TERRAIN_CHUNK_SIZE_Z 32
+#define TERRAIN_CHUNK_VOXELS 0x4000
+
+/* Block layer byte of an empty voxel, and the run tags marking empty runs
+ * in each of the layers */
+#define TERRAIN_BLOCK_EMPTY 0x28
+#define TERRAIN_MATERIAL_EMPTY_TAG 0x11
+
+/* Run length encoded layer of a chunk, run i covers the voxels from
+ * end_array[i - 1] (or 0) up to end_array[i], so the run holding a voxel is
+ * found by binary search. Adjacent runs always have different values. */
+struct terrain_layer {
+	uint32_t run_count;
+	uint16_t *end_array;
+	uint8_t *value_array;
+};
+
 struct terrain_chunk {
 	int16_t position_x;
 	int16_t position_y;
 	int16_t position_z;
+	struct terrain_layer block;    /* Block byte of each voxel,
+	                                  TERRAIN_BLOCK_EMPTY for empty voxels */
+	struct terrain_layer material; /* Material of each voxel, 0 for empty
+	                                  voxels */
 };
 
 struct rbx_terrain {
+	uint32_t chunk_count;
+	struct terrain_chunk *chunk_array;
+	uint32_t chunk_table_mask;
+	uint32_t *chunk_table; /* Open addressing table of chunk index + 1 keyed
+	                          by chunk position, 0 => empty slot */
+	void *run_storage;     /* Backing memory of the run arrays */
+};
+
+/* Where a chunk is in the encoded data */
+struct terrain_chunk_entry {
+	int16_t position_x;
+	int16_t position_y;
+	int16_t position_z;
+	uint32_t offset;            /* Of the chunk's block layer */
+	uint32_t material_offset;   /* Of the chunk's material layer */
+	uint32_t block_segments;    /* Segments in each of its layers */
+	uint32_t material_segments;
+};
 
+struct terrain_chunk_index {
+	uint32_t chunk_count;
+	struct terrain_chunk_entry *chunk_array;
 };
 
-struct rbx_terrain *translate_terrain(struct rbx_string *source);
\ No newline at end of file
+/* Index of a voxel within its chunk */
+uint32_t terrain_voxel_index(uint32_t x, uint32_t y, uint32_t z);
+
+/* Shape and rotation packed into a block byte */
+uint8_t block_type(uint8_t block);
+uint8_t block_rot(uint8_t block);
+
+/* Find the chunks in ClusterGridV3 data by walking the lengths of their
+ * segments without decoding them, NULL if the data is malformed or on
+ * allocation failure. */
+struct terrain_chunk_index *index_terrain_chunks(struct rbx_string *source);
+
+void free_terrain_chunk_index(struct terrain_chunk_index *index);
+
+/* Box of chunk positions, in units of chunks, the bounds are inclusive */
+struct terrain_region {
+	int16_t min_x, min_y, min_z;
+	int16_t max_x, max_y, max_z;
+};
+
+/* Decode the ClusterGridV3 data, NULL if it is malformed or on allocation
+ * failure. The data is indexed first, then the chunks are decoded in
+ * parallel straight into their place in the result.
+ * - If region isn't NULL only the chunks inside of it are decoded, the
+ *   others are still walked by the index but cost nothing more. */
+struct rbx_terrain *translate_terrain(struct rbx_string *source, struct terrain_region *region);
+
+void free_terrain(struct rbx_terrain *terrain);
+
+/* Encode terrain back into ClusterGridV3 data, in parallel over chunks.
+ * Returns a malloc'd buffer, NULL on allocation failure. */
+uint8_t *write_terrain(struct rbx_terrain *terrain, size_t *length);
+
+/* Find a chunk by its position, in units of chunks */
+struct terrain_chunk *terrain_find_chunk(struct rbx_terrain *terrain,
+	int32_t x, int32_t y, int32_t z);
+
+/* Value of a voxel within a layer */
+uint8_t terrain_layer_get(struct terrain_layer *layer, uint32_t index);
+
+/* Look up a voxel by its position, in units of voxels. Returns 0 and an
+ * empty voxel if there is no chunk there. */
+int terrain_get_voxel(struct rbx_terrain *terrain, int32_t x, int32_t y, int32_t z,
+	uint8_t *block, uint8_t *material);
+
+/* Expand the layers of a chunk into arrays of TERRAIN_CHUNK_VOXELS voxels */
+void terrain_expand_layer(struct terrain_layer *layer, uint8_t *voxel_array);
+void terrain_expand_chunk(struct terrain_chunk *chunk,
+	uint8_t *block_array, uint8_t *material_array);
+
+/* Voxels of one material */
+struct terrain_material_count {
+	uint8_t material;
+	uint32_t count;
+};
+
+struct terrain_chunk_stats {
+	int16_t position_x;
+	int16_t position_y;
+	int16_t position_z;
+	uint32_t filled_count;
+	uint8_t min_x, min_y, min_z; /* Bounds of the filled voxels within the */
+	uint8_t max_x, max_y, max_z; /* chunk, inclusive, if there are any */
+	uint32_t material_count;
+	struct terrain_material_count *material_array; /* By material */
+};
+
+struct rbx_terrain_stats {
+	uint64_t voxel_count;  /* In all of the chunks */
+	uint64_t filled_count;
+	uint64_t material_histogram[256];
+	int32_t min_x, min_y, min_z; /* Bounds of the filled voxels in world */
+	int32_t max_x, max_y, max_z; /* voxel positions, inclusive */
+	uint32_t chunk_count;
+	struct terrain_chunk_stats *chunk_array;
+	struct terrain_material_count *material_storage;
+};
+
+/* Material histograms, occupancy and bounds of ClusterGridV3 data, per
+ * chunk and for the whole map. These are summed straight from the runs of
+ * the material layers, in parallel over chunks, without decoding any
+ * voxels. NULL if the data is malformed or on allocation failure. */
+struct rbx_terrain_stats *terrain_stats(struct rbx_string *source);
+
+void free_terrain_stats(struct rbx_terrain_stats *stats);
+
+/* Level of detail pyramid of terrain
+ * - Level k of a chunk has one cell per 2^k voxels along each axis, the
+ *   y axis stops halving at one cell, so level 1 of a chunk is 16x8x16
+ *   cells and level 5 is a single cell.
+ * - A cell holds the fraction of its voxels that are filled, and the
+ *   material most of them are made of (0 if none are filled). Above level
+ *   1 the material is the one with the most occupancy among the children.
+ */
+
+#define TERRAIN_LOD_LEVELS 5
+#define TERRAIN_LOD_CELLS (2048 + 256 + 32 + 4 + 1) /* Per chunk, all levels */
+
+struct terrain_lod_cell {
+	uint8_t material;
+	uint8_t occupancy; /* Filled fraction, 0 to 255 */
+};
+
+struct rbx_terrain_lod {
+	uint32_t chunk_count;
+	int16_t *position_array;             /* x, y, z of each chunk */
+	struct terrain_lod_cell *cell_array; /* TERRAIN_LOD_CELLS per chunk, the
+	                                        levels in order from level 1,
+	                                        cells in the same order as the
+	                                        voxels of a chunk */
+};
+
+/* Build the pyramid of decoded terrain, in parallel over chunks, NULL on
+ * allocation failure. */
+struct rbx_terrain_lod *build_terrain_lod(struct rbx_terrain *terrain);
+
+void free_terrain_lod(struct rbx_terrain_lod *lod);
+
+/* Cells of a level (1 to TERRAIN_LOD_LEVELS) of one chunk, and the size of
+ * the level in cells */
+struct terrain_lod_cell *terrain_lod_level(struct rbx_terrain_lod *lod,
+	uint32_t chunk, uint32_t level,
+	uint32_t *size_x, uint32_t *size_y, uint32_t *size_z);
+
+/* Sidecar file holding a pyramid: an 8 byte magic, then the version, chunk
+ * count and compressed length as 32 bit little endian ints, then the LZ4
+ * compressed positions and cells.
+ * - write_terrain_lod returns a malloc'd buffer, NULL on failure.
+ * - read_terrain_lod returns NULL if the data is malformed. */
+uint8_t *write_terrain_lod(struct rbx_terrain_lod *lod, size_t *length);
+struct rbx_terrain_lod *read_terrain_lod(uint8_t *data, size_t length);
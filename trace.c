@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#ifdef RBX_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define TRACE_DETAIL_LENGTH 32
+
+struct trace_event {
+	const char *name; /* NULL for the end of a span */
+	double ts;        /* Microseconds since the first event */
+	uint32_t tid;
+	char detail[TRACE_DETAIL_LENGTH];
+};
+
+/* Events of every thread, appended under the lock. Recording is rare
+ * compared to the work being traced, so one lock is cheap enough. */
+struct trace_state {
+	pthread_mutex_t lock;
+	size_t event_count;
+	size_t event_capacity;
+	struct trace_event *event_array;
+	double start;
+	uint32_t thread_count;
+	pthread_key_t thread_key;
+};
+
+struct trace_state trace = {PTHREAD_MUTEX_INITIALIZER};
+pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+double trace_clock_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+void trace_init(void) {
+	pthread_key_create(&trace.thread_key, NULL);
+	trace.start = trace_clock_us();
+}
+
+/* Id of the calling thread, the key holds the id so that 0 means unset */
+uint32_t trace_thread_id(void) {
+	uintptr_t id = (uintptr_t)pthread_getspecific(trace.thread_key);
+	if (id == 0) {
+		pthread_mutex_lock(&trace.lock);
+		id = ++trace.thread_count;
+		pthread_mutex_unlock(&trace.lock);
+		pthread_setspecific(trace.thread_key, (void*)id);
+	}
+	return (uint32_t)id;
+}
+
+void trace_record(const char *name, const char *detail) {
+	pthread_once(&trace_once, trace_init);
+	uint32_t tid = trace_thread_id();
+	double ts = trace_clock_us() - trace.start;
+
+	pthread_mutex_lock(&trace.lock);
+	if (trace.event_count == trace.event_capacity) {
+		size_t capacity = trace.event_capacity ? 2*trace.event_capacity : 1024;
+		struct trace_event *events = (struct trace_event*)
+			realloc(trace.event_array, capacity*sizeof(struct trace_event));
+		if (events == NULL) {
+			// Drop the event rather than fail the work being traced
+			pthread_mutex_unlock(&trace.lock);
+			return;
+		}
+		trace.event_array = events;
+		trace.event_capacity = capacity;
+	}
+	struct trace_event *event = &trace.event_array[trace.event_count++];
+	event->name = name;
+	event->ts = ts;
+	event->tid = tid;
+	event->detail[0] = '\0';
+	if (detail != NULL) {
+		strncpy(event->detail, detail, TRACE_DETAIL_LENGTH - 1);
+		event->detail[TRACE_DETAIL_LENGTH - 1] = '\0';
+	}
+	pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_begin(const char *name, const char *detail) {
+	trace_record(name, detail);
+}
+
+void trace_end(void) {
+	trace_record(NULL, NULL);
+}
+
+/* Write a string as a JSON string literal */
+void write_json_string(FILE *f, const char *text) {
+	fputc('"', f);
+	for (; *text; ++text) {
+		unsigned char c = (unsigned char)*text;
+		if (c == '"' || c == '\\') {
+			fprintf(f, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(f, "\\u%04x", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+int trace_write(const char *filename) {
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&trace.lock);
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (size_t i = 0; i < trace.event_count; ++i) {
+		struct trace_event *event = &trace.event_array[i];
+		fprintf(f, "%s\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+			i ? "," : "", event->name ? 'B' : 'E', event->tid, event->ts);
+		if (event->name != NULL) {
+			fprintf(f, ",\"name\":");
+			write_json_string(f, event->name);
+			if (event->detail[0] != '\0') {
+				fprintf(f, ",\"args\":{\"detail\":");
+				write_json_string(f, event->detail);
+				fprintf(f, "}");
+			}
+		}
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n]}\n");
+	pthread_mutex_unlock(&trace.lock);
+	return 0 == fclose(f);
+}
+
+#endif
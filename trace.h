@@ -0,0 +1,36 @@
+#pragma once
+
+/* Chrome trace event output
+ * - Built with -DRBX_TRACE (make traced), TRACE_BEGIN / TRACE_END record
+ *   the start and end of a span of work on the calling thread, and
+ *   TRACE_WRITE writes everything recorded so far as Chrome trace JSON, for
+ *   chrome://tracing or Perfetto.
+ * - Without RBX_TRACE the macros compile to nothing.
+ * - Threads are numbered in the order that they first record an event,
+ *   starting from 1.
+ */
+
+#ifdef RBX_TRACE
+
+/* Begin a span called name, which must be a string constant. detail may be
+ * NULL, it's copied (up to TRACE_DETAIL_LENGTH - 1 chars) and shown as an
+ * argument of the span. */
+void trace_begin(const char *name, const char *detail);
+
+/* End the innermost open span of the calling thread */
+void trace_end(void);
+
+/* Write the trace to a file, returns 0 if it couldn't be written */
+int trace_write(const char *filename);
+
+#define TRACE_BEGIN(name, detail) trace_begin((name), (detail))
+#define TRACE_END() trace_end()
+#define TRACE_WRITE(filename) trace_write(filename)
+
+#else
+
+#define TRACE_BEGIN(name, detail) ((void)0)
+#define TRACE_END() ((void)0)
+#define TRACE_WRITE(filename) ((void)0)
+
+#endif